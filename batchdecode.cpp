@@ -0,0 +1,278 @@
+//Batch re-decoder: decodes archived disk captures again with the current codec, no adapter needed.
+//
+//  fdsemu-batch [-o dir] [-j threads] [-summary file] dir|file ...
+//
+//inputs are .fdscap capture files (as saved by the read dialog) and raw adapter dumps (.raw, as written by
+//FDS_readDisk).  directories are scanned for those, not recursively.  each capture is one work unit, decoded
+//on its own thread with the same steps as a disk read: plain decode, then other thresholds and glitch policies
+//and the other revolutions in the file while blocks are still bad.  name.bin and name.fds are written to the
+//output directory (default: next to the capture) and each file's block list goes to the summary as soon as it
+//is done, so nothing is kept once a file is finished.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+#include "fdsemu-lib/Codec.h"
+#include "fdsemu-lib/CaptureFile.h"
+#include "fdsemu-lib/Hypothesis.h"
+#include "fdsemu-lib/MultiRead.h"
+#include "fdsemu-lib/Parallel.h"
+#include "fdsemu-lib/System.h"
+
+typedef struct SBatch {
+    std::vector<std::string> inputs;
+    std::string outDir;             //empty = next to each input
+    FILE *summary;
+    std::mutex lock;                //summary and stdout
+    std::atomic<int> done;
+    std::atomic<int> failed;
+    std::atomic<int> badFiles;
+    std::atomic<int> badBlocks;
+} TBatch;
+
+static bool has_ext(const std::string &name, const char *ext) {
+    size_t len = strlen(ext);
+
+    if (name.size() < len)
+        return false;
+    for (size_t i = 0; i < len; i++) {
+        if (tolower(name[name.size() - len + i]) != ext[i])
+            return false;
+    }
+    return true;
+}
+
+static bool is_capture(const std::string &name) {
+    return has_ext(name, ".fdscap") || has_ext(name, ".raw");
+}
+
+typedef struct SDirScan {
+    TBatch *batch;
+    std::string path;
+} TDirScan;
+
+static void add_dir_entry(void *arg, const char *name) {
+    TDirScan *scan = (TDirScan*)arg;
+
+    if (is_capture(name))
+        scan->batch->inputs.push_back(scan->path + "/" + name);
+}
+
+//output name: input without its extension, in outDir if set
+static std::string out_name(TBatch *batch, const std::string &input, const char *ext) {
+    std::string base = input.substr(0, input.rfind('.'));
+    size_t slash = base.find_last_of("/\\");
+
+    if (batch->outDir.size())
+        base = batch->outDir + "/" + (slash == std::string::npos ? base : base.substr(slash + 1));
+    return base + ext;
+}
+
+static bool write_file(const std::string &name, uint8_t *data, int size, uint8_t *header = 0, int headerSize = 0) {
+    FILE *f = fopen(name.c_str(), "wb");
+    bool ok;
+
+    if (f == 0)
+        return false;
+    ok = (headerSize == 0 || fwrite(header, 1, headerSize, f) == (size_t)headerSize) && fwrite(data, 1, size, f) == (size_t)size;
+    fclose(f);
+    return ok;
+}
+
+//same steps as FDS_readDisk2 after the capture
+static void decode_capture(TBatch *batch, int index) {
+    static const char *statusNames[] = { "BAD", "ok", "copied", "voted", "CRC fixed", "unknown type" };
+    std::string input = batch->inputs[index];
+    std::string text;
+    CCaptureFile capfile;
+    TDecoderContext ctx;
+    TQuantizer quant;
+    std::vector<THypothesis> hypotheses;
+    std::vector<uint8_t> raw03;
+    std::vector<TRawRange> lost;
+    uint32_t hist[256];
+    uint8_t *raw = 0, *bin;
+    void *mapped = 0;
+    size_t mappedSize = 0;
+    int rawSize = 0, binSize, first = 0, bad, revs = 1, r, i, status;
+    char line[256];
+    const char *from;
+    uint64_t t = getMicros();
+
+    //raw dumps are just the adapter bytes of one revolution, .fdscap may hold several
+    if (has_ext(input, ".fdscap")) {
+        if (capfile.Open(input.c_str())) {
+            revs = capfile.GetRevolutions();
+            for (r = 0; r < revs; r++) {
+                if (capfile.GetRevolution(r)->flags & CAPREV_MERGED)
+                    first = r;
+            }
+            if (revs) {
+                raw = capfile.GetRaw(first, &rawSize);
+                capfile.GetLost(first, &lost);
+            }
+            capfile.GetQuantizer(&quant);
+        }
+    }
+    else if ((mapped = file_map(input.c_str(), &mappedSize)) != 0) {
+        raw = (uint8_t*)mapped;
+        rawSize = (int)mappedSize;
+        quantizer_default(&quant);
+    }
+    if (raw == 0 || rawSize == 0) {
+        std::lock_guard<std::mutex> hold(batch->lock);
+
+        fprintf(batch->summary, "%s: can't read\n", input.c_str());
+        batch->failed++;
+        return;
+    }
+
+    decoder_init(&ctx, 0, 0);
+    raw_histogram(raw, rawSize, hist);
+    hypothesis_defaults(&hypotheses, hist);
+    hypotheses[0].quant = quant;
+
+    CMultiRead multi(&ctx);
+
+    raw03.assign(raw, raw + rawSize);
+    raw_to_raw03_q(&quant, &raw03[0], rawSize);
+    multi.Add(&raw03[0], rawSize, lost.size() ? &lost[0] : 0, (int)lost.size(), hypotheses[0].name);
+    bad = multi.Combine();
+    if (bad) {
+        hypothesis_decode(&multi, &ctx, hypotheses, 1, raw, rawSize, lost.size() ? &lost[0] : 0, (int)lost.size());
+        bad = multi.Combine();
+    }
+    for (r = 0; r < revs && bad; r++) {
+        uint8_t *revRaw;
+        int revSize;
+        char prefix[24];
+
+        if (r == first)
+            continue;
+        revRaw = capfile.GetRaw(r, &revSize);
+        capfile.GetLost(r, &lost);
+        snprintf(prefix, sizeof(prefix), "revolution %d, ", r + 1);
+        hypothesis_decode(&multi, &ctx, hypotheses, 0, revRaw, revSize, lost.size() ? &lost[0] : 0, (int)lost.size(), prefix);
+        bad = multi.Combine();
+    }
+    multi.GetResult(&bin, &binSize);
+    if (mapped)
+        file_unmap(mapped, mappedSize);
+    capfile.Close();
+
+    snprintf(line, sizeof(line), "%s: %d blocks, %d bad, %d decodes, %d ms\n", input.c_str(), multi.GetBlockCount(), bad,
+        multi.GetReads(), (int)((getMicros() - t) / 1000));
+    text = line;
+
+    //.fds goes through the simple standard layout decoder, the same way flash slots are saved
+    {
+        std::vector<uint8_t> rebuilt(binSize * 8 + 8);
+        std::vector<uint8_t> fds(FDSSIZE + 16);
+        uint8_t fwnesHdr[16] = { 0x46, 0x44, 0x53, 0x1a, 1 };
+        std::string name = out_name(batch, input, ".bin");
+        bool ok = true;
+
+        if (!write_file(name, bin, binSize)) {
+            text += "  can't write " + name + "\n";
+            ok = false;
+        }
+        bin_to_raw03(bin, &rebuilt[0], binSize, (int)rebuilt.size());
+        name = out_name(batch, input, ".fds");
+        if (!raw03_to_fds(&ctx, &rebuilt[0], &fds[0], (int)rebuilt.size())) {
+            text += "  not a standard layout disk, " + name + " not written\n";
+            ok = false;
+        }
+        else if (!write_file(name, &fds[0], FDSSIZE, fwnesHdr, sizeof(fwnesHdr))) {
+            text += "  can't write " + name + "\n";
+            ok = false;
+        }
+        if (!ok)
+            batch->failed++;
+    }
+    free(bin);
+    for (i = 0; i < multi.GetBlockCount(); i++) {
+        TBlockInfo *b = multi.GetBlock(i, &status, &from);
+
+        snprintf(line, sizeof(line), "  %d: type %X at %X, %X bytes, %s%s%s\n", i + 1, b->type, b->start, b->len,
+            statusNames[status], *from ? " from " : "", from);
+        text += line;
+    }
+
+    batch->done++;
+    batch->badBlocks += bad;
+    if (bad)
+        batch->badFiles++;
+    std::lock_guard<std::mutex> hold(batch->lock);
+    fputs(text.c_str(), batch->summary);
+    fflush(batch->summary);
+    if (batch->summary != stdout)
+        printf("%d/%d %s: %d bad blocks\n", (int)batch->done, (int)batch->inputs.size(), input.c_str(), bad);
+}
+
+static void decode_item(void *arg, int i) {
+    decode_capture((TBatch*)arg, i);
+}
+
+int main(int argc, char *argv[]) {
+    TBatch batch;
+    int threads = 0;
+    uint64_t t;
+    int i;
+
+    batch.summary = stdout;
+    batch.done = 0;
+    batch.failed = 0;
+    batch.badFiles = 0;
+    batch.badBlocks = 0;
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            batch.outDir = argv[++i];
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-summary") == 0 && i + 1 < argc) {
+            i++;
+            if ((batch.summary = fopen(argv[i], "w")) == 0) {
+                printf("Can't create %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (argv[i][0] == '-') {
+            printf("usage: %s [-o dir] [-j threads] [-summary file] dir|file ...\n", argv[0]);
+            return 1;
+        }
+        else {
+            TDirScan scan = { &batch, argv[i] };
+
+            if (!dir_list(argv[i], add_dir_entry, &scan))
+                batch.inputs.push_back(argv[i]);
+        }
+    }
+    if (batch.inputs.empty()) {
+        printf("No captures found.\n");
+        return 1;
+    }
+
+    //one work unit per capture, the decoders' own parallel steps run inside it
+    if (threads <= 0)
+        threads = cpu_count();
+    if (threads > (int)batch.inputs.size())
+        threads = (int)batch.inputs.size();
+    t = getMicros();
+    parallel_for((int)batch.inputs.size(), decode_item, &batch, threads);
+    t = getMicros() - t;
+
+    printf("%d captures (%d failed), %d with bad blocks (%d blocks), %.1f s, %.1f captures/s on %d threads\n",
+        (int)batch.inputs.size(), (int)batch.failed, (int)batch.badFiles, (int)batch.badBlocks, t / 1e6,
+        batch.inputs.size() * 1e6 / (t ? t : 1), threads);
+    if (batch.summary != stdout)
+        fclose(batch.summary);
+    return batch.failed ? 1 : 0;
+}
@@ -0,0 +1,331 @@
+//Codec benchmark: times each codec stage over real and synthetic captures.
+//
+//  fdsemu-bench [-json file] [-time ms] [file ...]
+//
+//files can be .fds images (encoded to a capture first) or raw adapter captures (as written by FDS_readDisk).
+//a few synthetic captures are always included so runs can be compared without a disk at hand.
+//-json also writes one JSON object per line to file ("-" = stdout instead of the table), for tracking results
+//across releases.  the codec's diagnostics are discarded, stdout only has the results.
+//
+//a "symbol" is one pulse for the raw/raw03 stages and one disk bit for the bin/fds stages.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <string>
+#include "fdsemu-lib/Codec.h"
+#include "fdsemu-lib/System.h"
+
+enum {
+    RAWSIZE = 0x90000,              //same as a disk read
+    BINSIZE = 0x10000,
+    LEADIN = DEFAULT_LEAD_IN / 8,   //bytes of lead-in before block 1
+    DEFAULT_TIME = 500,             //ms per stage and input
+    MIN_ITERATIONS = 3,
+};
+
+typedef struct SCapture {
+    std::string name;
+    std::vector<uint8_t> raw;       //adapter capture (pulse widths in 6MHz clocks)
+} TCapture;
+
+typedef struct SResult {
+    int iterations;
+    uint64_t best;                  //microseconds
+    uint64_t total;
+} TResult;
+
+static uint32_t seed = 1;
+
+static uint32_t rnd() {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) & 0x7fff;
+}
+
+//adapter value for each raw03 symbol, the middle of each raw_to_raw03 range
+static const uint8_t rawValue[4] = { 0x5c, 0x88, 0xb8, 0x30 };
+
+//make a disk side with some files, random or zero filled
+static void make_fds(uint8_t *fds, int files) {
+    int p, f, i, size;
+
+    memset(fds, 0, FDSSIZE);
+    fds[0] = 1;
+    memcpy(fds + 1, "*NINTENDO-HVC*", 14);
+    for (i = 15; i < 0x38; i++)
+        fds[i] = rnd();
+    p = 0x38;
+    fds[p++] = 2;
+    fds[p++] = files;
+    for (f = 0; f < files; f++) {
+        size = rnd() % 4000 + 1;
+        if (p + 16 + 1 + size > FDSSIZE)
+            break;
+        fds[p] = 3;
+        fds[p + 1] = f;
+        fds[p + 2] = f;
+        for (i = 3; i < 11; i++)
+            fds[p + i] = 'A' + rnd() % 26;
+        fds[p + 12] = 0x60;
+        fds[p + 13] = size & 0xff;
+        fds[p + 14] = size >> 8;
+        p += 16;
+        fds[p++] = 4;
+        for (i = 0; i < size; i++)
+            fds[p++] = rnd();
+    }
+}
+
+//encode a .fds side the way the drive would return it.  noise = number of short bursts of garbage
+static bool fds_to_capture(TCapture *cap, uint8_t *fds, int noise) {
+    std::vector<uint8_t> bin(BINSIZE);
+    int binSize, i, j, pos;
+
+    memset(&bin[0], 0, LEADIN);
+    binSize = fds_to_bin(&bin[LEADIN], fds, BINSIZE - LEADIN);
+    if (binSize == 0)
+        return false;
+    cap->raw.resize(RAWSIZE);
+    bin_to_raw03(&bin[0], &cap->raw[0], binSize + LEADIN, RAWSIZE);
+
+    //drive keeps spinning after the last file
+    for (i = 0; i < RAWSIZE; i++) {
+        if (cap->raw[i] > 2)
+            cap->raw[i] = 1 + rnd() % 2;
+    }
+    for (i = 0; i < noise; i++) {
+        pos = (rnd() << 5 ^ rnd()) % (RAWSIZE - 32);
+        for (j = 0; j < 16; j++)
+            cap->raw[pos + j] = rnd() % 4;
+    }
+    for (i = 0; i < RAWSIZE; i++)
+        cap->raw[i] = rawValue[cap->raw[i] & 3];
+    return true;
+}
+
+static bool load_capture(TCapture *cap, const char *filename) {
+    FILE *f;
+    long size;
+    const char *ext = strrchr(filename, '.');
+
+    if ((f = fopen(filename, "rb")) == 0) {
+        printf("Can't open %s\n", filename);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    cap->name = filename;
+    cap->raw.resize(size);
+    if (size == 0 || fread(&cap->raw[0], 1, size, f) != (size_t)size) {
+        fclose(f);
+        printf("Can't read %s\n", filename);
+        return false;
+    }
+    fclose(f);
+
+    //.fds: first side only, skip the fwNES header if there is one
+    if (ext && (strcmp(ext, ".fds") == 0 || strcmp(ext, ".FDS") == 0)) {
+        std::vector<uint8_t> fds(FDSSIZE, 0);
+        int skip = (size >= 16 && memcmp(&cap->raw[0], "FDS\x1a", 4) == 0) ? 16 : 0;
+
+        memcpy(&fds[0], &cap->raw[skip], (size - skip) < FDSSIZE ? (size - skip) : (long)FDSSIZE);
+        if (!fds_to_capture(cap, &fds[0], 0)) {
+            printf("%s: not an FDS image\n", filename);
+            return false;
+        }
+    }
+    return true;
+}
+
+static void add_result(TResult *r, uint64_t t) {
+    if (r->iterations == 0 || t < r->best)
+        r->best = t;
+    r->total += t;
+    r->iterations++;
+}
+
+static bool done(TResult *r, int timeLimit) {
+    return r->iterations >= MIN_ITERATIONS && r->total >= (uint64_t)timeLimit * 1000;
+}
+
+//file names can have backslashes (windows paths)
+static std::string json_string(const char *str) {
+    std::string ret;
+
+    for (; *str; str++) {
+        if (*str == '\\' || *str == '"')
+            ret += '\\';
+        ret += *str;
+    }
+    return ret;
+}
+
+static void report(FILE *json, const char *input, const char *stage, TResult *r, int bytes, int symbols) {
+    double best = r->best ? (double)r->best : 1;
+    double mbs = bytes / best;                          //bytes per microsecond = MB/s
+    double nss = best * 1000.0 / symbols;
+
+    if (json) {
+        fprintf(json, "{\"input\":\"%s\",\"stage\":\"%s\",\"bytes\":%d,\"symbols\":%d,\"iterations\":%d,"
+            "\"best_us\":%llu,\"mean_us\":%.1f,\"mb_s\":%.2f,\"ns_symbol\":%.3f}\n",
+            json_string(input).c_str(), stage, bytes, symbols, r->iterations, (unsigned long long)r->best,
+            (double)r->total / r->iterations, mbs, nss);
+    }
+    if (json != stdout) {
+        printf("%-24.24s %-14s %8d %6d %10.3f %10.2f %10.3f\n", input, stage, bytes, r->iterations,
+            (double)r->best / 1000.0, mbs, nss);
+    }
+}
+
+static void bench(FILE *json, int timeLimit, TCapture *cap) {
+    int rawSize = (int)cap->raw.size();
+    std::vector<uint8_t> raw03(rawSize);
+    std::vector<uint8_t> work(rawSize);
+    std::vector<uint8_t> fds(FDSSIZE + 16);
+    std::vector<uint8_t> bin(BINSIZE);
+    const char *name = cap->name.c_str();
+    TDecoderContext ctx;
+    TResult r;
+    uint64_t t;
+    uint8_t *out;
+    int outSize, binSize;
+
+    decoder_init(&ctx, 0, 0);
+
+    memset(&r, 0, sizeof(r));
+    do {
+        memcpy(&work[0], &cap->raw[0], rawSize);
+        t = getMicros();
+        raw_to_raw03(&work[0], rawSize);
+        add_result(&r, getMicros() - t);
+    } while (!done(&r, timeLimit));
+    report(json, name, "raw_to_raw03", &r, rawSize, rawSize);
+    memcpy(&raw03[0], &work[0], rawSize);
+
+    //histogram, fitted thresholds and the tracking quantizer, as used on a capture with bad CRCs
+    memset(&r, 0, sizeof(r));
+    do {
+        uint32_t hist[256];
+        TQuantizer q;
+
+        memcpy(&work[0], &cap->raw[0], rawSize);
+        t = getMicros();
+        raw_histogram(&work[0], rawSize, hist);
+        quantizer_from_histogram(&q, hist);
+        q.track = true;
+        raw_to_raw03_q(&q, &work[0], rawSize);
+        add_result(&r, getMicros() - t);
+    } while (!done(&r, timeLimit));
+    report(json, name, "raw_to_raw03_q", &r, rawSize, rawSize);
+
+    memset(&r, 0, sizeof(r));
+    do {
+        t = getMicros();
+        raw03_to_bin(&ctx, &raw03[0], rawSize, &out, &outSize);
+        add_result(&r, getMicros() - t);
+        free(out);
+    } while (!done(&r, timeLimit));
+    report(json, name, "raw03_to_bin", &r, rawSize, rawSize);
+
+    memset(&r, 0, sizeof(r));
+    do {
+        t = getMicros();
+        raw03_to_fds(&ctx, &raw03[0], &fds[0], rawSize);
+        add_result(&r, getMicros() - t);
+    } while (!done(&r, timeLimit));
+    report(json, name, "raw03_to_fds", &r, rawSize, rawSize);
+
+    //encoder stages work from the decoded side
+    if (fds[0] != 1) {
+        if (json != stdout)
+            printf("%-24.24s no disk header found, skipping encoder stages\n", name);
+        return;
+    }
+
+    memset(&r, 0, sizeof(r));
+    do {
+        t = getMicros();
+        binSize = fds_to_bin(&bin[0], &fds[0], BINSIZE);
+        add_result(&r, getMicros() - t);
+    } while (!done(&r, timeLimit));
+    report(json, name, "fds_to_bin", &r, FDSSIZE, FDSSIZE * 8);
+    if (binSize == 0)
+        return;
+
+    memset(&r, 0, sizeof(r));
+    do {
+        t = getMicros();
+        calc_crc(&bin[0], binSize);
+        add_result(&r, getMicros() - t);
+    } while (!done(&r, timeLimit));
+    report(json, name, "calc_crc", &r, binSize, binSize * 8);
+
+    memset(&r, 0, sizeof(r));
+    do {
+        t = getMicros();
+        bin_to_raw03(&bin[0], &work[0], binSize, rawSize);
+        add_result(&r, getMicros() - t);
+    } while (!done(&r, timeLimit));
+    report(json, name, "bin_to_raw03", &r, binSize, binSize * 8);
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<TCapture> corpus;
+    std::vector<uint8_t> fds(FDSSIZE);
+    FILE *json = 0;
+    int timeLimit = DEFAULT_TIME;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-json") == 0 && i + 1 < argc) {
+            i++;
+            json = strcmp(argv[i], "-") == 0 ? stdout : fopen(argv[i], "w");
+            if (json == 0) {
+                printf("Can't create %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-time") == 0 && i + 1 < argc) {
+            timeLimit = atoi(argv[++i]);
+        }
+        else if (argv[i][0] == '-') {
+            printf("usage: %s [-json file] [-time ms] [file.fds|capture.raw ...]\n", argv[0]);
+            return 1;
+        }
+        else {
+            TCapture cap;
+
+            if (!load_capture(&cap, argv[i]))
+                return 1;
+            corpus.push_back(cap);
+        }
+    }
+
+    //synthetic captures: clean, noisy and a nearly empty disk
+    static const struct { const char *name; int files; int noise; } synth[] = {
+        { "synthetic-clean", 12, 0 },
+        { "synthetic-noisy", 12, 40 },
+        { "synthetic-small", 1, 5 },
+    };
+    for (i = 0; i < (int)(sizeof(synth) / sizeof(synth[0])); i++) {
+        TCapture cap;
+
+        seed = i + 1;
+        make_fds(&fds[0], synth[i].files);
+        cap.name = synth[i].name;
+        if (fds_to_capture(&cap, &fds[0], synth[i].noise))
+            corpus.push_back(cap);
+    }
+
+    if (json != stdout)
+        printf("%-24s %-14s %8s %6s %10s %10s %10s\n", "input", "stage", "bytes", "iter", "best ms", "MB/s", "ns/symbol");
+    for (i = 0; i < (int)corpus.size(); i++) {
+        bench(json, timeLimit, &corpus[i]);
+    }
+    if (json && json != stdout)
+        fclose(json);
+    return 0;
+}
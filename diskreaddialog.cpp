@@ -1,5 +1,11 @@
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <QFileDialog>
+#include <QMessageBox>
 #include "diskreaddialog.h"
+#include "fdsemu-lib/Codec.h"
 #include "ui_diskreaddialog.h"
 
 DiskReadDialog::DiskReadDialog(QWidget *parent) :
@@ -7,12 +13,17 @@ DiskReadDialog::DiskReadDialog(QWidget *parent) :
     ui(new Ui::DiskReadDialog)
 {
     ui->setupUi(this);
+    shown = 0;
+    captureShown = 0;
+    binbuf = 0;
+    binlen = 0;
     ui->saveButton->setEnabled(false);
     ui->plainTextEdit->setPlainText(QString("Insert disk and press 'Read disk...' button."));
 }
 
 DiskReadDialog::~DiskReadDialog()
 {
+    free(binbuf);
     delete ui;
 }
 
@@ -26,39 +37,129 @@ void DiskReadDialog::on_cancelButton_clicked()
 }
 
 bool FDS_readDisk(char *filename_raw, char *filename_bin, char *filename_fds, void(*callback)(void*,int), void *data);
-bool FDS_readDisk2(QStringList *messages, uint8_t **rawbuf, int *rawlen, uint8_t **binbuf, int *binlen, void(*callback)(void*,int), void *data);
+bool FDS_readDisk2(QStringList *messages, uint8_t **rawbuf, int *rawlen, uint8_t **binbuf, int *binlen, int reads, TQuantizer *quant,
+    CCaptureWriter *record, void(*callback)(void*,uint8_t*,int), void *data);
+
+//append messages added since the last call
+void DiskReadDialog::showMessages()
+{
+    for(;shown<messages.size();shown++) {
+        ui->plainTextEdit->moveCursor(QTextCursor::End);
+        ui->plainTextEdit->insertPlainText(messages.at(shown));
+        ui->plainTextEdit->moveCursor(QTextCursor::End);
+    }
+}
+
+//new data of the revolution being read, a shorter one is the next revolution starting
+void DiskReadDialog::showCapture(uint8_t *raw, int size)
+{
+    if(size < captureShown) {
+        ui->waveform->clear();
+        captureShown = 0;
+    }
+    ui->waveform->appendData(raw + captureShown, size - captureShown);
+    captureShown = size;
+}
+
+//blocks of the final decode over the waveform, decoded again here to get where they are in the capture
+void DiskReadDialog::showBlocks(uint8_t *raw, int size, TQuantizer *quant)
+{
+    enum { MAXBLOCKS = 512 };
+
+    TBlockInfo blocks[MAXBLOCKS];
+    TDecoderContext ctx;
+    uint8_t *raw03 = (uint8_t*)malloc(size);
+    uint8_t *bin;
+    int binSize;
+
+    memcpy(raw03, raw, size);
+    raw_to_raw03_q(quant, raw03, size);
+    decoder_init(&ctx, 0, 0);
+    ctx.blocks = blocks;
+    ctx.maxBlocks = MAXBLOCKS;
+    raw03_to_bin(&ctx, raw03, size, &bin, &binSize);
+    ui->waveform->setBlocks(blocks, ctx.blockCount < MAXBLOCKS ? ctx.blockCount : MAXBLOCKS);
+    free(bin);
+    free(raw03);
+}
+
+//called during the read, show blocks as they're decoded and the capture as it comes in
+static void readCallback(void *data, uint8_t *raw, int bytes)
+{
+    DiskReadDialog *dlg = (DiskReadDialog*)data;
+
+    dlg->showMessages();
+    dlg->showCapture(raw, bytes);
+    qApp->processEvents();
+}
 
 void DiskReadDialog::on_pushButton_clicked()
 {
     QString str;
-    QStringList messages;
-    uint8_t *rawbuf, *binbuf;
-    int rawlen, binlen;
-    int i;
+    uint8_t *rawbuf;
+    int rawlen;
+    uint32_t hist[256];
+    TQuantizer quant;
 
+    free(binbuf);
     rawbuf = binbuf = 0;
     rawlen = binlen = 0;
+    capture.Clear();
 
     ui->plainTextEdit->setPlainText("");
+    ui->histogram->clear();
+    ui->waveform->clear();
+    captureShown = 0;
     ui->saveButton->setEnabled(false);
     ui->cancelButton->setEnabled(false);
     ui->pushButton->setEnabled(false);
+    ui->readsSpinBox->setEnabled(false);
     qApp->processEvents();
 
 //    FDS_readDisk(0,0,0,0,0);
     messages.clear();
-    if(FDS_readDisk2(&messages,&rawbuf,&rawlen,&binbuf,&binlen,0,0) == false) {
+    shown = 0;
+    if(FDS_readDisk2(&messages,&rawbuf,&rawlen,&binbuf,&binlen,ui->readsSpinBox->value(),&quant,&capture,readCallback,this) == false) {
         messages.append("Read failed.");
     }
-    qApp->processEvents();
-    ui->plainTextEdit->clear();
-    for(i=0;i<messages.size();i++) {
-        ui->plainTextEdit->moveCursor(QTextCursor::End);
-        ui->plainTextEdit->insertPlainText(messages.at(i));
-        ui->plainTextEdit->moveCursor(QTextCursor::End);
+    if(rawbuf) {
+        raw_histogram(rawbuf,rawlen,hist);
+        ui->histogram->setData(hist,&quant);
+        ui->waveform->setData(rawbuf,rawlen,&quant);
+        showBlocks(rawbuf,rawlen,&quant);
+        free(rawbuf);
     }
+    showMessages();
+    qApp->processEvents();
 //    ui->plainTextEdit->setPlainText(str);
-    ui->saveButton->setEnabled(true);
+    ui->saveButton->setEnabled(capture.GetRevolutions() > 0);
     ui->cancelButton->setEnabled(true);
     ui->pushButton->setEnabled(true);
+    ui->readsSpinBox->setEnabled(true);
+}
+
+//the capture file keeps everything needed to decode the disk again later, the .bin is just this decode
+void DiskReadDialog::on_saveButton_clicked()
+{
+    QString filename, filter;
+    bool ok;
+
+    filename = QFileDialog::getSaveFileName(this, tr("Save disk read"), "", tr("Disk captures (*.fdscap);;Disk bitstream (*.bin)"), &filter);
+    if(filename == "")
+        return;
+    if(filename.endsWith(".bin", Qt::CaseInsensitive)) {
+        FILE *f = fopen(filename.toLocal8Bit().constData(), "wb");
+
+        ok = f && binbuf && fwrite(binbuf, 1, binlen, f) == (size_t)binlen;
+        if(f)
+            fclose(f);
+    }
+    else {
+        ok = capture.Save(filename.toLocal8Bit().constData());
+    }
+    if(!ok) {
+        QMessageBox::information(NULL,"Error","Cannot save disk read.");
+        return;
+    }
+    this->close();
 }
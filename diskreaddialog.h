@@ -2,6 +2,9 @@
 #define DISKREADDIALOG_H
 
 #include <QDialog>
+#include <QStringList>
+#include <stdint.h>
+#include "fdsemu-lib/CaptureFile.h"
 
 namespace Ui {
 class DiskReadDialog;
@@ -15,14 +18,26 @@ public:
     explicit DiskReadDialog(QWidget *parent = 0);
     ~DiskReadDialog();
     void readdisk();
+    void showMessages();
+    void showCapture(uint8_t *raw, int size);
 
 private slots:
     void on_cancelButton_clicked();
 
     void on_pushButton_clicked();
 
+    void on_saveButton_clicked();
+
 private:
     Ui::DiskReadDialog *ui;
+    QStringList messages;
+    int shown;          //messages already in the text box
+    int captureShown;   //bytes of the revolution being read already in the waveform
+    CCaptureWriter capture;     //every revolution of the last read
+    uint8_t *binbuf;            //decoded disk side
+    int binlen;
+
+    void showBlocks(uint8_t *raw, int size, TQuantizer *quant);
 };
 
 #endif // DISKREADDIALOG_H
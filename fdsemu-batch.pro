@@ -0,0 +1,31 @@
+#-------------------------------------------------
+#
+# Batch re-decoder for saved captures, links the codec library (build fdsemu-codec.pro first)
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = fdsemu-batch
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+SOURCES += batchdecode.cpp \
+    ../fdsemu-lib/System.cpp
+
+HEADERS  += ../fdsemu-lib/CaptureFile.h \
+    ../fdsemu-lib/Codec.h \
+    ../fdsemu-lib/Hypothesis.h \
+    ../fdsemu-lib/MultiRead.h \
+    ../fdsemu-lib/Parallel.h \
+    ../fdsemu-lib/System.h
+
+LIBS += -L$$OUT_PWD -lfdsemu-codec
+
+unix:!macx {
+	LIBS += -lpthread
+}
+macx {
+	LIBS += -liconv
+}
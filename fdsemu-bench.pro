@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# Codec benchmark, links the codec library (build fdsemu-codec.pro first)
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = fdsemu-bench
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+SOURCES += codecbench.cpp \
+    ../fdsemu-lib/System.cpp
+
+HEADERS  += ../fdsemu-lib/Codec.h \
+    ../fdsemu-lib/System.h
+
+LIBS += -L$$OUT_PWD -lfdsemu-codec
+
+unix:!macx {
+	LIBS += -lpthread
+}
+macx {
+	LIBS += -liconv
+}
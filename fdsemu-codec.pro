@@ -0,0 +1,29 @@
+#-------------------------------------------------
+#
+# Disk image codec as a static library, no Qt
+#
+#-------------------------------------------------
+
+QT       -= core gui
+
+TARGET = fdsemu-codec
+TEMPLATE = lib
+CONFIG += staticlib c++11
+
+SOURCES += ../fdsemu-lib/CaptureFile.cpp \
+    ../fdsemu-lib/Codec.cpp \
+    ../fdsemu-lib/GapIndex.cpp \
+    ../fdsemu-lib/Hypothesis.cpp \
+    ../fdsemu-lib/MultiRead.cpp \
+    ../fdsemu-lib/Parallel.cpp \
+    ../fdsemu-lib/StreamDecoder.cpp \
+    ../fdsemu-lib/WavePyramid.cpp
+
+HEADERS  += ../fdsemu-lib/CaptureFile.h \
+    ../fdsemu-lib/Codec.h \
+    ../fdsemu-lib/GapIndex.h \
+    ../fdsemu-lib/Hypothesis.h \
+    ../fdsemu-lib/MultiRead.h \
+    ../fdsemu-lib/Parallel.h \
+    ../fdsemu-lib/StreamDecoder.h \
+    ../fdsemu-lib/WavePyramid.h
@@ -0,0 +1,172 @@
+#include <stdio.h>
+#include <string.h>
+#include "Capture.h"
+#include "System.h"
+
+CPacketRing::CPacketRing(int count, bool lock)
+{
+	for (size = 1; size < count; size <<= 1);
+	packets = new TCapturePacket[size];
+
+	//touch every page now so the capture thread never takes a page fault
+	memset(packets, 0, size * sizeof(TCapturePacket));
+	locked = lock && mem_lock(packets, size * sizeof(TCapturePacket));
+	head = 0;
+	tail = 0;
+}
+
+CPacketRing::~CPacketRing()
+{
+	if (locked)
+		mem_unlock(packets, size * sizeof(TCapturePacket));
+	delete[] packets;
+}
+
+TCapturePacket *CPacketRing::Claim()
+{
+	uint32_t h = head.load(std::memory_order_relaxed);
+
+	if (h - tail.load(std::memory_order_acquire) >= (uint32_t)size)
+		return(0);
+	return(&packets[h & (size - 1)]);
+}
+
+void CPacketRing::Commit()
+{
+	head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+TCapturePacket *CPacketRing::Peek()
+{
+	uint32_t t = tail.load(std::memory_order_relaxed);
+
+	if (t == head.load(std::memory_order_acquire))
+		return(0);
+	return(&packets[t & (size - 1)]);
+}
+
+void CPacketRing::Release()
+{
+	tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+CCapture::CCapture(CDevice *d)
+{
+	dev = d;
+	ring = 0;
+	thread = 0;
+	maxBytes = 0;
+	realtime = false;
+	stop = false;
+	done = false;
+	failed = false;
+	elevated = false;
+	Packets = 0;
+	Bytes = 0;
+	LatePolls = 0;
+	SequenceGaps = 0;
+	Overruns = 0;
+	MaxPollGap = 0;
+}
+
+CCapture::~CCapture()
+{
+	Stop();
+	delete ring;
+}
+
+bool CCapture::Start(int maxSize, bool rt)
+{
+	Stop();
+	delete ring;
+	ring = new CPacketRing(RINGSIZE, rt);
+	maxBytes = maxSize;
+	realtime = rt;
+	stop = false;
+	done = false;
+	failed = false;
+	elevated = false;
+	Packets = 0;
+	Bytes = 0;
+	LatePolls = 0;
+	SequenceGaps = 0;
+	Overruns = 0;
+	MaxPollGap = 0;
+
+	if (!dev->DiskReadStart()) {
+		return(false);
+	}
+	if ((thread = thread_start(ThreadEntry, this)) == 0) {
+		return(false);
+	}
+	return(true);
+}
+
+void CCapture::Stop()
+{
+	if (thread) {
+		stop = true;
+		thread_join(thread);
+		thread = 0;
+	}
+}
+
+void CCapture::ThreadEntry(void *arg)
+{
+	((CCapture*)arg)->Run();
+}
+
+void CCapture::Run()
+{
+	TCapturePacket scratch;
+	TCapturePacket *p;
+	uint64_t start, last, now;
+	uint8_t expect = 1;		//DiskReadStart restarts the sequence at 1
+	int result, gap;
+
+	if (realtime)
+		elevated = thread_realtime();
+
+	start = last = getMicros();
+	while (!stop && Bytes < maxBytes - DISK_READMAX) {
+
+		//how long since the last poll returned
+		now = getMicros();
+		gap = (int)(now - last);
+		if (Packets && gap > LATE_POLL)
+			LatePolls++;
+		if (gap > MaxPollGap)
+			MaxPollGap = gap;
+
+		//keep polling if the consumer falls behind, the lost packet shows up as a sequence gap
+		if ((p = ring->Claim()) == 0) {
+			p = &scratch;
+		}
+		result = dev->DiskReadPacket(p->data, &p->seq);
+		last = getMicros();
+		p->micros = (uint32_t)(last - start);
+		if (result < 0) {
+			failed = true;
+			break;
+		}
+		p->len = result;
+		if (result > 0) {
+			if (p->seq != expect)
+				SequenceGaps++;
+			expect = p->seq + 1;
+		}
+		if (p == &scratch) {
+			Overruns++;
+		}
+		else {
+			Packets++;
+			Bytes += result;
+			ring->Commit();
+		}
+
+		//adapter sends incomplete/empty packets when it's out of data (end of disk)
+		if (result != DISK_READMAX)
+			break;
+	}
+	done = true;
+}
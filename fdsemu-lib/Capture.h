@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include "Device.h"
+
+//one ID_DISK_READ report
+typedef struct SCapturePacket {
+	uint8_t seq;					//sequence number from the adapter
+	int len;						//data bytes, 0 = end of disk
+	uint32_t micros;				//arrival, from Start()
+	uint8_t data[DISK_READMAX];
+} TCapturePacket;
+
+//Lock-free ring of packets, one producer thread and one consumer thread.
+class CPacketRing
+{
+protected:
+	TCapturePacket *packets;
+	int size;						//power of two
+	bool locked;
+	std::atomic<uint32_t> head;		//next slot written (producer)
+	std::atomic<uint32_t> tail;		//next slot read (consumer)
+
+public:
+	CPacketRing(int count, bool lock);
+	virtual ~CPacketRing();
+
+	//producer: slot to fill, 0 if full.  Commit() makes it visible
+	TCapturePacket *Claim();
+	void Commit();
+
+	//consumer: oldest packet, 0 if empty.  Release() frees it
+	TCapturePacket *Peek();
+	void Release();
+
+	bool IsLocked() { return(locked); }
+};
+
+//Disk capture on its own thread, so GUI stalls can't make the adapter drop data.
+//The thread only polls the adapter and pushes packets into the ring.
+class CCapture
+{
+public:
+	enum {
+		RINGSIZE = 4096,			//packets, a whole disk is ~2300
+		LATE_POLL = 1000,			//microseconds between polls counted as late
+	};
+
+	//published by the capture thread, safe to read any time
+	std::atomic<int> Packets;
+	std::atomic<int> Bytes;
+	std::atomic<int> LatePolls;		//polls issued more than LATE_POLL after the previous one returned
+	std::atomic<int> SequenceGaps;	//packets that didn't follow the previous sequence number
+	std::atomic<int> Overruns;		//packets dropped because the ring was full
+	std::atomic<int> MaxPollGap;	//longest time between polls (microseconds)
+
+protected:
+	CDevice *dev;
+	CPacketRing *ring;
+	void *thread;
+	int maxBytes;
+	bool realtime;
+	std::atomic<bool> stop;
+	std::atomic<bool> done;
+	std::atomic<bool> failed;
+	std::atomic<bool> elevated;
+
+	static void ThreadEntry(void *arg);
+	void Run();
+
+public:
+	CCapture(CDevice *d);
+	virtual ~CCapture();
+
+	//start reading, stops at end of disk or after maxSize bytes.
+	//rt = try to run the capture thread at real-time priority (and lock the ring in memory)
+	bool Start(int maxSize, bool rt);
+
+	//ask the thread to stop and wait for it
+	void Stop();
+
+	//consumer side of the ring
+	TCapturePacket *Peek() { return(ring ? ring->Peek() : 0); }
+	void Release() { ring->Release(); }
+
+	bool IsDone() { return(done); }			//thread finished (the ring may still hold packets)
+	bool IsFailed() { return(failed); }		//a packet read failed.  a full ring isn't a failure, see Overruns
+	bool IsElevated() { return(elevated); }
+	bool IsLocked() { return(ring ? ring->IsLocked() : false); }
+};
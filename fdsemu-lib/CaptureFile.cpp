@@ -0,0 +1,314 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "CaptureFile.h"
+#include "System.h"
+
+static const char capMagic[8] = { 'F', 'D', 'S', 'C', 'A', 'P', 0x1a, 0 };
+
+static uint64_t align8(uint64_t n) {
+	return (n + 7) & ~(uint64_t)7;
+}
+
+//zero fill up to the start of the next section
+static bool pad_to(FILE *fp, uint64_t offset) {
+	static const uint8_t zero[8] = { 0 };
+	long pos = ftell(fp);
+
+	if (pos < 0 || (uint64_t)pos > offset)
+		return(false);
+	return(fwrite(zero, 1, (size_t)(offset - pos), fp) == offset - pos);
+}
+
+CCaptureWriter::CCaptureWriter()
+{
+	quantizer_default(&quant);
+}
+
+CCaptureWriter::~CCaptureWriter()
+{
+}
+
+void CCaptureWriter::Clear()
+{
+	revolutions.clear();
+	packets.clear();
+	raw.clear();
+	quantizer_default(&quant);
+}
+
+void CCaptureWriter::AddRevolution(uint8_t *data, int size, TCapPacket *p, int count, uint32_t flags)
+{
+	TCapRevolution rev;
+
+	rev.rawOffset = raw.size();
+	rev.rawSize = size;
+	rev.firstPacket = (uint32_t)packets.size();
+	rev.packetCount = count;
+	rev.flags = flags;
+	revolutions.push_back(rev);
+	raw.insert(raw.end(), data, data + size);
+	packets.insert(packets.end(), p, p + count);
+}
+
+void CCaptureWriter::AddMerged(uint8_t *data, int size, TRawRange *lost, int lostCount)
+{
+	enum { MAXLEN = 0xFFFF };		//TCapPacket::len is 16 bits
+	std::vector<TCapPacket> filler;
+	TCapPacket p;
+	int i, pos;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = CAPPACKET_FILLER;
+	for (i = 0; i < lostCount; i++) {
+		for (pos = lost[i].start; pos < lost[i].end; pos += p.len) {
+			p.rawOffset = pos;
+			p.len = (uint16_t)((lost[i].end - pos) < MAXLEN ? (lost[i].end - pos) : MAXLEN);
+			filler.push_back(p);
+		}
+	}
+	AddRevolution(data, size, filler.size() ? &filler[0] : 0, (int)filler.size(), CAPREV_MERGED);
+}
+
+void CCaptureWriter::SetQuantizer(TQuantizer *q)
+{
+	quant = *q;
+}
+
+//decode every revolution the way it was read, and number the files
+void CCaptureWriter::BuildIndex(std::vector<TCapBlock> *index)
+{
+	enum { MAXBLOCKS = 512 };
+	std::vector<TBlockInfo> blocks(MAXBLOCKS);
+	std::vector<uint8_t> raw03;
+	TDecoderContext ctx;
+	TCapBlock b;
+	uint8_t *bin;
+	int binSize, r, i, count, file;
+
+	for (r = 0; r < (int)revolutions.size(); r++) {
+		TCapRevolution *rev = &revolutions[r];
+
+		raw03.assign(raw.begin() + (size_t)rev->rawOffset, raw.begin() + (size_t)rev->rawOffset + rev->rawSize);
+		if (raw03.empty())
+			continue;
+		raw_to_raw03_q(&quant, &raw03[0], rev->rawSize);
+		decoder_init(&ctx, 0, 0);
+		ctx.blocks = &blocks[0];
+		ctx.maxBlocks = MAXBLOCKS;
+		raw03_to_bin(&ctx, &raw03[0], rev->rawSize, &bin, &binSize);
+		free(bin);
+
+		count = ctx.blockCount < MAXBLOCKS ? ctx.blockCount : MAXBLOCKS;
+		for (file = -1, i = 0; i < count; i++) {
+			if (blocks[i].type == 3)
+				file++;
+			b.revolution = r;
+			b.rawStart = blocks[i].rawStart;
+			b.rawEnd = blocks[i].rawEnd;
+			b.binStart = blocks[i].start;
+			b.len = blocks[i].len;
+			b.file = (blocks[i].type == 3 || blocks[i].type == 4) ? file : -1;
+			b.type = blocks[i].type;
+			b.crcOk = blocks[i].crcOk;
+			b.suspect = blocks[i].suspect;
+			b.corrected = blocks[i].corrected;
+			index->push_back(b);
+		}
+	}
+}
+
+bool CCaptureWriter::Save(const char *filename)
+{
+	std::vector<TCapBlock> blocks;
+	TCapHeader h;
+	FILE *fp;
+	bool ok;
+
+	BuildIndex(&blocks);
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, capMagic, sizeof(h.magic));
+	h.version = CAPFILE_VERSION;
+	h.headerSize = sizeof(TCapHeader);
+	h.clock = CAPFILE_CLOCK;
+	h.revolutions = (uint32_t)revolutions.size();
+	h.packets = (uint32_t)packets.size();
+	h.blocks = (uint32_t)blocks.size();
+	h.revolutionOffset = align8(sizeof(TCapHeader));
+	h.packetOffset = align8(h.revolutionOffset + h.revolutions * sizeof(TCapRevolution));
+	h.blockOffset = align8(h.packetOffset + h.packets * sizeof(TCapPacket));
+	h.rawOffset = align8(h.blockOffset + h.blocks * sizeof(TCapBlock));
+	h.rawSize = raw.size();
+	memcpy(h.center, quant.center, sizeof(h.center));
+	memcpy(h.limit, quant.limit, sizeof(h.limit));
+	h.track = quant.track;
+
+	if ((fp = fopen(filename, "wb")) == 0) {
+		printf("Can't create %s\n", filename);
+		return(false);
+	}
+
+	//sections in file order, each padded up to its offset
+	ok = fwrite(&h, sizeof(h), 1, fp) == 1;
+	ok = ok && pad_to(fp, h.revolutionOffset);
+	if (h.revolutions)
+		ok = ok && fwrite(&revolutions[0], sizeof(TCapRevolution), h.revolutions, fp) == h.revolutions;
+	ok = ok && pad_to(fp, h.packetOffset);
+	if (h.packets)
+		ok = ok && fwrite(&packets[0], sizeof(TCapPacket), h.packets, fp) == h.packets;
+	ok = ok && pad_to(fp, h.blockOffset);
+	if (h.blocks)
+		ok = ok && fwrite(&blocks[0], sizeof(TCapBlock), h.blocks, fp) == h.blocks;
+	ok = ok && pad_to(fp, h.rawOffset);
+	if (raw.size())
+		ok = ok && fwrite(&raw[0], 1, raw.size(), fp) == raw.size();
+	fclose(fp);
+	if (!ok)
+		printf("Error writing %s\n", filename);
+	return(ok);
+}
+
+CCaptureFile::CCaptureFile()
+{
+	data = 0;
+	size = 0;
+	header = 0;
+	revolutions = 0;
+	packets = 0;
+	blocks = 0;
+	raw = 0;
+}
+
+CCaptureFile::~CCaptureFile()
+{
+	Close();
+}
+
+//does [offset, offset + count * recordSize) fit in the file
+static bool in_file(uint64_t offset, uint64_t count, uint64_t recordSize, size_t fileSize) {
+	return(offset <= fileSize && count <= (fileSize - offset) / recordSize);
+}
+
+bool CCaptureFile::Open(const char *filename)
+{
+	uint32_t i;
+
+	Close();
+	if ((data = (uint8_t*)file_map(filename, &size)) == 0) {
+		printf("Can't open %s\n", filename);
+		return(false);
+	}
+	header = (TCapHeader*)data;
+	if (size < sizeof(TCapHeader) || memcmp(header->magic, capMagic, sizeof(capMagic)) != 0) {
+		printf("%s is not a capture file\n", filename);
+		Close();
+		return(false);
+	}
+	if (header->version > CAPFILE_VERSION || header->headerSize < sizeof(TCapHeader)) {
+		printf("%s: capture file version %d not supported\n", filename, header->version);
+		Close();
+		return(false);
+	}
+	if (!in_file(header->revolutionOffset, header->revolutions, sizeof(TCapRevolution), size) ||
+		!in_file(header->packetOffset, header->packets, sizeof(TCapPacket), size) ||
+		!in_file(header->blockOffset, header->blocks, sizeof(TCapBlock), size) ||
+		!in_file(header->rawOffset, header->rawSize, 1, size)) {
+		printf("%s is truncated\n", filename);
+		Close();
+		return(false);
+	}
+	revolutions = (TCapRevolution*)(data + header->revolutionOffset);
+	packets = (TCapPacket*)(data + header->packetOffset);
+	blocks = (TCapBlock*)(data + header->blockOffset);
+	raw = data + header->rawOffset;
+
+	//tables point into each other, check them once here so the getters don't have to
+	for (i = 0; i < header->revolutions; i++) {
+		TCapRevolution *rev = &revolutions[i];
+
+		if (rev->rawOffset > header->rawSize || rev->rawSize > header->rawSize - rev->rawOffset ||
+			rev->firstPacket > header->packets || rev->packetCount > header->packets - rev->firstPacket) {
+			printf("%s: revolution %d is damaged\n", filename, i);
+			Close();
+			return(false);
+		}
+	}
+	return(true);
+}
+
+void CCaptureFile::Close()
+{
+	if (data)
+		file_unmap(data, size);
+	data = 0;
+	size = 0;
+	header = 0;
+	revolutions = 0;
+	packets = 0;
+	blocks = 0;
+	raw = 0;
+}
+
+uint8_t *CCaptureFile::GetRaw(int rev, int *rawSize)
+{
+	*rawSize = revolutions[rev].rawSize;
+	return(raw + revolutions[rev].rawOffset);
+}
+
+TCapPacket *CCaptureFile::GetPackets(int rev, int *count)
+{
+	*count = revolutions[rev].packetCount;
+	return(packets + revolutions[rev].firstPacket);
+}
+
+void CCaptureFile::GetLost(int rev, std::vector<TRawRange> *lost)
+{
+	TCapPacket *p;
+	TRawRange range;
+	int i, count;
+
+	lost->clear();
+	p = GetPackets(rev, &count);
+	for (i = 0; i < count; i++) {
+		if ((p[i].flags & CAPPACKET_FILLER) == 0)
+			continue;
+		range.start = p[i].rawOffset;
+		range.end = p[i].rawOffset + p[i].len;
+		if (range.end > (int)revolutions[rev].rawSize)
+			range.end = (int)revolutions[rev].rawSize;
+
+		//AddMerged splits long ranges, join them back
+		if (lost->size() && lost->back().end == range.start)
+			lost->back().end = range.end;
+		else if (range.start < range.end)
+			lost->push_back(range);
+	}
+}
+
+TCapBlock *CCaptureFile::GetBlocks(int *count)
+{
+	*count = header ? header->blocks : 0;
+	return(blocks);
+}
+
+void CCaptureFile::GetQuantizer(TQuantizer *q)
+{
+	quantizer_default(q);
+	if (header == 0)
+		return;
+	memcpy(q->center, header->center, sizeof(q->center));
+	memcpy(q->limit, header->limit, sizeof(q->limit));
+	q->track = header->track != 0;
+}
+
+int CCaptureFile::FindFile(int rev, int file)
+{
+	uint32_t i;
+
+	for (i = 0; header && i < header->blocks; i++) {
+		if ((int)blocks[i].revolution == rev && blocks[i].file == file)
+			return((int)i);
+	}
+	return(-1);
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "Codec.h"
+
+//Raw capture container (.fdscap).  Little endian, every section starts 8 byte aligned and all records are
+//fixed size, so a mapped file is used in place:
+//	header				TCapHeader
+//	revolution table	TCapRevolution[revolutions]
+//	packet table		TCapPacket[packets]
+//	block index			TCapBlock[blocks]
+//	raw data			adapter bytes of all revolutions, back to back
+//Newer versions only add fields at the end of the header (headerSize) and new sections.
+enum {
+	CAPFILE_VERSION = 1,
+	CAPFILE_CLOCK = 6000000,		//adapter timer, Hz
+};
+
+//TCapRevolution::flags
+enum {
+	CAPREV_MERGED = 1,				//built from other revolutions by capture_merge, packets are only the ranges still lost
+};
+
+//TCapPacket::flags
+enum {
+	CAPPACKET_FILLER = 1,			//lost in transfer, raw data is filler
+};
+
+typedef struct SCapHeader {
+	char magic[8];					//"FDSCAP\x1a\0"
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t clock;					//timer frequency of the raw data
+	uint32_t revolutions;
+	uint32_t packets;
+	uint32_t blocks;
+	uint64_t revolutionOffset;		//file offsets of the sections
+	uint64_t packetOffset;
+	uint64_t blockOffset;
+	uint64_t rawOffset;
+	uint64_t rawSize;
+	uint8_t center[3];				//TQuantizer the capture was decoded with
+	uint8_t limit[4];
+	uint8_t track;
+} TCapHeader;
+
+typedef struct SCapRevolution {
+	uint64_t rawOffset;				//from the start of the raw data
+	uint32_t rawSize;
+	uint32_t firstPacket;
+	uint32_t packetCount;
+	uint32_t flags;					//CAPREV_xxx
+} TCapRevolution;
+
+//one adapter packet (or a run of lost ones)
+typedef struct SCapPacket {
+	uint32_t rawOffset;				//within the revolution
+	uint32_t micros;				//arrival, from the start of the revolution's capture
+	uint16_t len;
+	uint8_t seq;					//adapter sequence number
+	uint8_t flags;					//CAPPACKET_xxx
+} TCapPacket;
+
+//block found decoding a revolution
+typedef struct SCapBlock {
+	uint32_t revolution;
+	uint32_t rawStart;				//raw offsets within the revolution (one raw byte per pulse)
+	uint32_t rawEnd;
+	uint32_t binStart;				//offset in the decoded bitstream
+	uint32_t len;					//excluding CRC
+	int32_t file;					//file number for file header/data blocks, -1 for the disk info blocks
+	uint8_t type;
+	uint8_t crcOk;
+	uint8_t suspect;
+	uint8_t corrected;
+} TCapBlock;
+
+//Collects revolutions while reading a disk, Save() writes the container.
+//Nothing is written during the capture, the consumer thread only appends to memory.
+class CCaptureWriter
+{
+protected:
+	std::vector<TCapRevolution> revolutions;
+	std::vector<TCapPacket> packets;
+	std::vector<uint8_t> raw;
+	TQuantizer quant;
+
+	void BuildIndex(std::vector<TCapBlock> *blocks);
+
+public:
+	CCaptureWriter();
+	virtual ~CCaptureWriter();
+
+	void Clear();
+
+	//copy one revolution of adapter data and its packets
+	void AddRevolution(uint8_t *data, int size, TCapPacket *p, int count, uint32_t flags = 0);
+	//capture_merge result, the ranges it couldn't recover are kept as filler packets
+	void AddMerged(uint8_t *data, int size, TRawRange *lost, int lostCount);
+	void SetQuantizer(TQuantizer *q);
+	int GetRevolutions() { return((int)revolutions.size()); }
+
+	//decode each revolution for the block index and write the file
+	bool Save(const char *filename);
+};
+
+//A capture file mapped read-only.  Pointers returned stay valid until Close().
+class CCaptureFile
+{
+protected:
+	uint8_t *data;
+	size_t size;
+	TCapHeader *header;
+	TCapRevolution *revolutions;
+	TCapPacket *packets;
+	TCapBlock *blocks;
+	uint8_t *raw;
+
+public:
+	CCaptureFile();
+	virtual ~CCaptureFile();
+
+	bool Open(const char *filename);
+	void Close();
+
+	int GetRevolutions() { return(header ? (int)header->revolutions : 0); }
+	TCapRevolution *GetRevolution(int rev) { return(&revolutions[rev]); }
+	uint8_t *GetRaw(int rev, int *rawSize);
+	TCapPacket *GetPackets(int rev, int *count);
+	//raw ranges of revolution rev that were lost in transfer (filler packets), for TDecoderContext::lost
+	void GetLost(int rev, std::vector<TRawRange> *lost);
+	TCapBlock *GetBlocks(int *count);
+	void GetQuantizer(TQuantizer *q);
+
+	//index of the first block of a file in revolution rev (file -1 = disk info block), -1 if not there
+	int FindFile(int rev, int file);
+};
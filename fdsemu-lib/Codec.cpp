@@ -0,0 +1,1035 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <vector>
+#include "Codec.h"
+#include "GapIndex.h"
+
+void decoder_init(TDecoderContext *ctx, TDecoderMessage message, void *user) {
+	memset(ctx, 0, sizeof(TDecoderContext));
+	ctx->message = message;
+	ctx->user = user;
+	ctx->crcFix = CRC_FIX_SINGLE;
+}
+
+//start of a new capture, block numbering starts over
+void decoder_reset(TDecoderContext *ctx) {
+	ctx->lastBlock = 0;
+	ctx->lastBlockLen = 0;
+	ctx->blockCount = 0;
+	ctx->suspectBlocks = 0;
+	ctx->correctedBlocks = 0;
+	ctx->badBlocks = 0;
+}
+
+void decoder_message(TDecoderContext *ctx, const char *fmt, ...) {
+	char str[256];
+	va_list args;
+
+	if (ctx == 0 || ctx->message == 0)
+		return;
+	va_start(args, fmt);
+	vsnprintf(str, sizeof(str), fmt, args);
+	va_end(args);
+	ctx->message(ctx->user, str);
+}
+
+static uint8_t raw_to_raw03_byte(uint8_t raw)
+{
+	if (raw < 0x48)
+		return(3);
+	else if (raw < 0x70)
+		return(0);
+	else if (raw < 0xA0)
+		return(1);
+	else if (raw < 0xD0)
+		return(2);
+	return(3);
+}
+
+//Turn raw data from adapter to pulse widths (0..3)
+//Input capture clock is 6MHz.  At 96.4kHz (FDS bitrate), 1 bit ~= 62 clocks
+//Fixed thresholds, see raw_to_raw03_q for drives that are off speed
+void raw_to_raw03(uint8_t *raw, int rawSize) {
+	for (int i = 0; i<rawSize; ++i) {
+		raw[i] = raw_to_raw03_byte(raw[i]);
+	}
+}
+
+void quantizer_default(TQuantizer *q) {
+	static const TQuantizer nominal = { { 0x5C, 0x88, 0xB8 }, { 0x48, 0x70, 0xA0, 0xD0 }, false };
+
+	*q = nominal;
+}
+
+void raw_histogram(uint8_t *raw, int rawSize, uint32_t *hist) {
+	memset(hist, 0, 256 * sizeof(uint32_t));
+	for (int i = 0; i < rawSize; i++) {
+		hist[raw[i]]++;
+	}
+}
+
+//A few rounds of 1-D k-means starting from the nominal widths.  Limits go halfway between the cluster
+//centers, the outer ones half a spacing beyond the first and last cluster.
+bool quantizer_from_histogram(TQuantizer *q, uint32_t *hist) {
+	enum {
+		ROUNDS = 8,
+		MIN_PULSES = 1000,	//per cluster, a disk side has ~100 times that
+		MIN_SPACING = 8,
+	};
+	int c[3], lim[4];
+	int round, n, v, s0, s1;
+	uint64_t count, sum;
+
+	quantizer_default(q);
+	for (n = 0; n < 3; n++)
+		c[n] = q->center[n];
+	for (round = 0; round < ROUNDS; round++) {
+		lim[0] = c[0] - (c[1] - c[0]) / 2;
+		lim[1] = (c[0] + c[1]) / 2;
+		lim[2] = (c[1] + c[2]) / 2;
+		lim[3] = c[2] + (c[2] - c[1]) / 2;
+		if (lim[0] < 1)
+			lim[0] = 1;
+		if (lim[3] > 255)
+			lim[3] = 255;
+		for (n = 0; n < 3; n++) {
+			count = sum = 0;
+			for (v = lim[n]; v < lim[n + 1]; v++) {
+				count += hist[v];
+				sum += (uint64_t)hist[v] * v;
+			}
+			if (count < MIN_PULSES)
+				return(false);
+			c[n] = (int)((sum + count / 2) / count);
+		}
+	}
+
+	//pulses are 2:3:4 half cells.  Speed drift during the capture smears the clusters together and pulls the
+	//centers off that ratio, raw_to_raw03_q's tracking does better from the nominal widths then
+	s0 = c[1] - c[0];
+	s1 = c[2] - c[1];
+	if (s0 < MIN_SPACING || s1 < MIN_SPACING || s0 * 2 > s1 * 3 || s1 * 2 > s0 * 3)
+		return(false);
+	if (abs(c[1] * 2 - c[0] * 3) > c[0] / 4 || abs(c[2] - c[0] * 2) > c[0] / 4)
+		return(false);
+	for (n = 0; n < 3; n++)
+		q->center[n] = c[n];
+	for (n = 0; n < 4; n++)
+		q->limit[n] = lim[n];
+	return(true);
+}
+
+//With tracking, widths are scaled by a gain (1.0 = 4096) that is nudged toward center/width after every
+//good pulse, a slow first order loop that follows the spindle speed but not single pulse jitter.
+void raw_to_raw03_q(TQuantizer *q, uint8_t *raw, int rawSize) {
+	enum {
+		ONE = 4096,
+		TRACK_SHIFT = 8,	//loop time constant, in pulses (2^n)
+		MIN_GAIN = ONE * 4 / 5,
+		MAX_GAIN = ONE * 5 / 4,
+	};
+	uint8_t lut[256];
+	int v, i, gain = ONE;
+	uint8_t sym;
+
+	for (v = 0; v < 256; v++) {
+		if (v < q->limit[0] || v >= q->limit[3])
+			lut[v] = 3;
+		else if (v < q->limit[1])
+			lut[v] = 0;
+		else if (v < q->limit[2])
+			lut[v] = 1;
+		else
+			lut[v] = 2;
+	}
+	if (!q->track) {
+		for (i = 0; i < rawSize; i++)
+			raw[i] = lut[raw[i]];
+		return;
+	}
+	for (i = 0; i < rawSize; i++) {
+		if (raw[i] == 0) {
+			raw[i] = 3;
+			continue;
+		}
+		v = (raw[i] * gain) >> 12;
+		sym = lut[v > 255 ? 255 : v];
+		if (sym != 3) {
+			gain += (((int)q->center[sym] << 12) / raw[i] - gain) >> TRACK_SHIFT;
+			if (gain < MIN_GAIN)
+				gain = MIN_GAIN;
+			if (gain > MAX_GAIN)
+				gain = MAX_GAIN;
+		}
+		raw[i] = sym;
+	}
+}
+
+//don't include gap end
+uint16_t calc_crc(uint8_t *buf, int size) {
+	uint32_t crc = 0x8000;
+	int i;
+	while (size--) {
+		crc |= (*buf++) << 16;
+		for (i = 0; i<8; i++) {
+			if (crc & 1) crc ^= 0x10810;
+			crc >>= 1;
+		}
+	}
+	return crc;
+}
+
+//The CRC is linear, so for a block that should check out to 0 the value calc_crc returns (the syndrome) only
+//depends on which bits are wrong.  A single bit d bits from the end of the block gives the register state
+//1<<16 run d steps forward; the register repeats every CRC_PERIOD steps, so within a period every single bit
+//and every pair of neighbouring bits has its own syndrome (odd and even parity, they never collide).
+enum { CRC_PERIOD = 32767 };
+
+typedef struct SSyndromeTables {
+	uint16_t single[0x10000];	//syndrome -> d of a single bit error, 0 = none
+	uint16_t pair[0x10000];		//syndrome -> d of the later bit of two neighbouring bits, 0 = none
+
+	SSyndromeTables() {
+		uint32_t s = 1 << 16, prev;
+		int d;
+
+		memset(single, 0, sizeof(single));
+		memset(pair, 0, sizeof(pair));
+		for (d = 1; d <= CRC_PERIOD; d++) {
+			prev = s;
+			if (s & 1) s ^= 0x10810;
+			s >>= 1;
+			single[s] = d;
+			if (d > 1)
+				pair[s ^ prev] = d - 1;
+		}
+	}
+} TSyndromeTables;
+
+//built on first use, the tables are constant afterwards so decoders on other threads can share them
+static const TSyndromeTables *syndrome_tables() {
+	static const TSyndromeTables tables;
+	return &tables;
+}
+
+int crc_correct(uint8_t *buf, int size, bool adjacent, int *bits) {
+	const TSyndromeTables *t = syndrome_tables();
+	uint16_t syndrome = calc_crc(buf, size);
+	int total = size * 8;
+	int d, n, pos, i;
+
+	*bits = 0;
+	if (syndrome == 0 || size > CRC_FIX_MAXSIZE)
+		return -1;
+	if ((d = t->single[syndrome]) != 0)
+		n = 1;
+	else if (adjacent && (d = t->pair[syndrome]) != 0)
+		n = 2;
+	else
+		return -1;
+
+	//every CRC_PERIOD bits the same syndrome comes around again, more than one place in the block = can't tell
+	if (d + n - 1 > total || d + CRC_PERIOD + n - 1 <= total)
+		return -1;
+
+	//d counts back from the end of the block, the first bit of each byte is bit 0
+	pos = total - d - (n - 1);
+	for (i = 0; i < n; i++) {
+		buf[(pos + i) / 8] ^= 1 << ((pos + i) & 7);
+	}
+	if (calc_crc(buf, size) != 0) {
+		for (i = 0; i < n; i++) {
+			buf[(pos + i) / 8] ^= 1 << ((pos + i) & 7);
+		}
+		return -1;
+	}
+	*bits = n;
+	return(pos);
+}
+
+void copy_block(uint8_t *dst, uint8_t *src, int size) {
+	dst[0] = 0x80;
+	memcpy(dst + 1, src, size);
+	uint32_t crc = calc_crc(dst + 1, size + 2);
+	dst[size + 1] = crc;
+	dst[size + 2] = crc >> 8;
+}
+
+//Adds GAP + GAP end (0x80) + CRCs to .FDS image
+//Returns size (0=error)
+int fds_to_bin(uint8_t *dst, uint8_t *src, int dstSize, TDecoderContext *ctx) {
+	int i = 0, o = 0;
+
+	//check *NINTENDO-HVC* header
+	if (src[0] != 0x01 || src[1] != 0x2a || src[2] != 0x4e) {
+		decoder_message(ctx, "Not an FDS file.\n");
+		return 0;
+	}
+	memset(dst, 0, dstSize);
+
+	//block type 1
+	copy_block(dst + o, src + i, 0x38);
+	i += 0x38;
+	o += 0x38 + 3 + GAP;
+
+	//block type 2
+	copy_block(dst + o, src + i, 2);
+	i += 2;
+	o += 2 + 3 + GAP;
+
+	//block type 3+4...
+	while (src[i] == 3) {
+		int size = (src[i + 13] | (src[i + 14] << 8)) + 1;
+		if (o + 16 + 3 + GAP + size + 3 > dstSize) {    //end + block3 + crc + gap + end + block4 + crc
+			decoder_message(ctx, "Out of space (%d bytes short), adjust GAP size?\n", (o + 16 + 3 + GAP + size + 3) - dstSize);
+			return 0;
+		}
+		copy_block(dst + o, src + i, 16);
+		i += 16;
+		o += 16 + 3 + GAP;
+
+		copy_block(dst + o, src + i, size);
+		i += size;
+		o += size + 3 + GAP;
+	}
+	return o;
+}
+
+//bit-parallel shift-and matcher, one step per symbol so it's linear in the window no matter how noisy the lead-in is.
+//tolerance = number of mismatched symbols allowed (single-symbol glitches)
+static int find_block1(uint8_t *raw, int window, int tolerance) {
+	static const uint8_t dat[] = { 1,0,1,0,0,0,0,0, 0,1,2,2,1,0,1,0, 0,1,1,2,1,1,1,1, 1,1,0,0,1,1,1,0 };
+	static const int LEN = (int)sizeof(dat);
+	static const uint32_t HIT = 1u << (LEN - 1);
+	uint32_t mask[4] = { 0, 0, 0, 0 };
+	uint32_t state[FIRSTBLOCK_MAXTOLERANCE + 1];
+	uint32_t prev, next;
+	int i, k;
+
+	//bit n of mask[sym] is set if the pattern has sym at position n
+	for (i = 0; i < LEN; i++) {
+		mask[dat[i]] |= 1u << i;
+	}
+	memset(state, 0, sizeof(state));
+
+	//state[k] bit n = pattern[0..n] matches the symbols ending here with at most k mismatches
+	for (i = 0; i < window; i++) {
+		uint32_t m = (raw[i] < 4) ? mask[raw[i]] : 0;
+
+		prev = state[0];
+		state[0] = ((state[0] << 1) | 1) & m;
+		for (k = 1; k <= tolerance; k++) {
+			next = state[k];
+			state[k] = (((state[k] << 1) | 1) & m) | ((prev << 1) | 1);
+			prev = next;
+		}
+		if (state[tolerance] & HIT)
+			return i - (LEN - 1);
+	}
+	return -1;
+}
+
+//look for pattern of bits matching block 1
+//window = number of symbols to search.  an exact match is looked for first, then one with 1, 2.. up to
+//tolerance mismatched symbols, so a glitch in block 1 doesn't lose the whole side
+int findFirstBlock(uint8_t *raw, int rawSize, int window, int tolerance) {
+	int pos = -1, k;
+
+	if (tolerance > FIRSTBLOCK_MAXTOLERANCE)
+		tolerance = FIRSTBLOCK_MAXTOLERANCE;
+	if (window > rawSize)
+		window = rawSize;
+	for (k = 0; k <= tolerance && pos < 0; k++) {
+		pos = find_block1(raw, window, k);
+	}
+	return pos;
+}
+
+bool block_decode(TDecoderContext *ctx, uint8_t *dst, uint8_t *src, int *inP, int *outP, int srcSize, int dstSize, int blockSize, char blockType) {
+	if (*outP + blockSize + 2 > dstSize) {
+		decoder_message(ctx, "Out of space\n");
+		return false;
+	}
+
+	int in = *inP;
+	int outEnd = (*outP + blockSize + 2) * 8;
+	int out = (*outP) * 8;
+	int start;
+
+	//scan for gap end
+	for (int zeros = 0; src[in] != 1 || zeros<MIN_GAP_SIZE; in++) {
+		if (src[in] == 0) {
+			zeros++;
+		}
+		else {
+			zeros = 0;
+		}
+		if (in >= srcSize - 2)
+			return false;
+	}
+	start = in;
+
+	char bitval = 1;
+	in++;
+	do {
+		if (in >= srcSize) {   //not necessarily an error, probably garbage at end of disk
+									  //printf("Disk end\n");
+			return false;
+		}
+		switch (src[in] | (bitval << 4)) {
+		case 0x11:
+			out++;
+			//fall through
+		case 0x00:
+			out++;
+			bitval = 0;
+			break;
+		case 0x12:
+			out++;
+			//fall through
+		case 0x01:
+		case 0x10:
+			dst[out / 8] |= 1 << (out & 7);
+			out++;
+			bitval = 1;
+			break;
+		default: //Unexpected value.  Keep going, we'll probably get a CRC warning
+					//printf("glitch(%d) @ %X(%X.%d)\n", src[in], in, out/8, out%8);
+			out++;
+			bitval = 0;
+			break;
+		}
+		in++;
+	} while (out<outEnd);
+	if (dst[*outP] != blockType) {
+		decoder_message(ctx, "Wrong block type %X(%X)-%X(%X) (found %d, expected %d)\n", start, *outP, in, out - 1, dst[*outP], blockType);
+		return false;
+	}
+	out = out / 8 - 2;
+
+	//printf("Out%d %X(%X)-%X(%X)\n", blockType, start, *outP, in, out-1);
+
+	int pos, bits;
+	if (calc_crc(dst + *outP, blockSize + 2) && ctx->crcFix != CRC_FIX_NONE && (pos = crc_correct(dst + *outP, blockSize + 2, false, &bits)) >= 0) {
+		ctx->correctedBlocks++;
+		decoder_message(ctx, "CRC fixed (bit %X.%d)\n", *outP + pos / 8, pos & 7);
+	}
+	if (calc_crc(dst + *outP, blockSize + 2)) {
+		uint16_t crc1 = (dst[out + 1] << 8) | dst[out];
+		dst[out] = 0;
+		dst[out + 1] = 0;
+		uint16_t crc2 = calc_crc(dst + *outP, blockSize + 2);
+		decoder_message(ctx, "Bad CRC (%04X!=%04X)\n", crc1, crc2);
+	}
+
+	dst[out] = 0;     //clear CRC
+	dst[out + 1] = 0;
+	dst[out + 2] = 0;   //+spare bit
+	*inP = in;
+	*outP = out;
+	return true;
+}
+
+//Simplified disk decoding.  This assumes disk will follow standard FDS file structure
+bool raw03_to_fds(TDecoderContext *ctx, uint8_t *raw, uint8_t *fds, int rawsize) {
+	int in, out;
+
+	memset(fds, 0, FDSSIZE);
+
+	//lead-in can vary a lot depending on drive, scan for first block to get our bearings
+	in = findFirstBlock(raw, rawsize) - MIN_GAP_SIZE;
+	if (in<0)
+		return false;
+
+	out = 0;
+	if (!block_decode(ctx, fds, raw, &in, &out, rawsize, FDSSIZE + 2, 0x38, 1))
+		return false;
+	if (!block_decode(ctx, fds, raw, &in, &out, rawsize, FDSSIZE + 2, 2, 2))
+		return false;
+	do {
+		if (!block_decode(ctx, fds, raw, &in, &out, rawsize, FDSSIZE + 2, 16, 3))
+			return true;
+		if (!block_decode(ctx, fds, raw, &in, &out, rawsize, FDSSIZE + 2, 1 + (fds[out - 16 + 13] | (fds[out - 16 + 14] << 8)), 4))
+			return true;
+	} while (in<rawsize);
+	return true;
+}
+
+//make raw0-3 from flash image (sans header)
+void bin_to_raw03(uint8_t *bin, uint8_t *raw, int binSize, int rawSize) {
+	int in, out;
+	uint8_t bit, data = 0;
+
+	memset(raw, 0xff, rawSize);
+	for (bit = 1, out = 0, in = 0; in<binSize * 8; in++) {
+		if ((in & 7) == 0) {
+			data = *bin;
+			bin++;
+		}
+		bit = (bit << 7) | (1 & (data >> (in & 7)));   //LSB first
+																	  //     bit = (bit<<7) | (1 & (bin[in/8]>>(in%8)));   //LSB first
+		switch (bit) {
+		case 0x00:  //10 10
+			out++;
+			raw[out]++;
+			break;
+		case 0x01:  //10 01
+		case 0x81:  //01 01
+			raw[out]++;
+			out++;
+			break;
+		case 0x80:  //01 10
+			raw[out] += 2;
+			break;
+		}
+	}
+	memset(raw + out, 3, rawSize - out);  //fill remainder with (undefined)
+}
+
+//check for gap at EOF
+static bool looks_like_file_end(CGapIndex *index, int start, int rawSize) {
+	enum {
+		MIN_GAP = 976 - 100,
+		MAX_GAP = 976 + 100,
+	};
+	int end = index->NextGapEnd(start, MIN_GAP + 1);
+
+	if (end >= 0 && end < start + MAX_GAP)
+		return true;
+	return start + MAX_GAP >= rawSize;  //end of disk = end of file!
+}
+
+//detect EOF by looking for good CRC.  in=start of file
+//returns 0 if nothing found
+int crc_detect(CGapIndex *index, uint8_t *raw, int in, int rawSize) {
+	//local function ;)
+	struct {
+		uint32_t crc;
+		uint8_t bitval;
+		int out;
+		bool match;
+
+		void shift(uint8_t bit) {
+			crc |= bit << 16;
+			if (crc & 1) crc ^= 0x10810;
+			crc >>= 1;
+			bitval = bit;
+			out++;
+			if (crc == 0 && !(out & 7))  //on a byte bounary and CRC is valid
+				match = true;
+		}
+	} f;
+
+	int mark = index->NextMark(in);
+	uint8_t sym;
+
+	f.crc = 0x8000;
+	f.bitval = 1;
+	f.out = 0;
+	do {
+		f.match = false;
+		sym = raw[in];
+		if (in == mark) {       //glitch marked by the decoder
+			sym = 3;
+			mark = index->NextMark(in + 1);
+		}
+		switch (sym | (f.bitval << 4)) {
+		case 0x11:
+			f.shift(0);
+			//fall through
+		case 0x00:
+			f.shift(0);
+			break;
+		case 0x12:
+			f.shift(0);
+			//fall through
+		case 0x01:
+		case 0x10:
+			f.shift(1);
+			break;
+		default:    //garbage / bad encoding
+			return 0;
+		}
+		in++;
+	} while (in<rawSize && !(f.match && looks_like_file_end(index, in, rawSize)));
+	return f.match ? in : 0;
+}
+
+//gap end is known, backtrack and mark the start.  !! this assumes junk data exists between EOF and gap start
+static void mark_gap_start(TDecoderContext *ctx, CGapIndex *index, int gapEnd) {
+	int start = index->RunStart(gapEnd);
+
+	index->Mark(start);
+	decoder_message(ctx, "mark gap %X-%X\n", start, gapEnd);
+}
+
+//raw offsets of a decoded block, this is all that's kept of the bin -> raw mapping
+typedef struct SBlockMap {
+	int start;          //offset of the block in bin
+	int len;            //expected length from the block type, -1 until the type byte is known
+	int rawStart;       //raw offset of the block's first byte
+	int rawEnd;         //raw offset of byte start+len, -1 until output gets there
+} TBlockMap;
+
+//checked block waiting for the raw offset of its end, the end of a block can be past the next block mark.
+//reported in order once it's known
+typedef struct SBlockReport {
+	TBlockMap map;
+	int number;         //block number in the messages, from 1
+	uint8_t type;
+	bool crcOk;
+	bool corrected;
+	char notes[128];    //rest of the message, except the lost data note
+} TBlockReport;
+
+//expected length of the block at bin[start], 0 if the block type is unknown
+static int block_length(TDecoderContext *ctx, uint8_t *bin, int start) {
+	switch (bin[start]) {
+	case 1:
+		return 0x38;
+	case 2:
+		return 2;
+	case 3:
+		return 16;
+	case 4:
+		return 1 + (bin[ctx->lastBlock + 13] | (bin[ctx->lastBlock + 14] << 8));
+	}
+	return 0;
+}
+
+//For information only for now.  This checks for standard file format.  The CRC is checked here, at the
+//block's mark, the message and the block info wait in pending for the raw offset of the block's end.
+static void verify_block(TDecoderContext *ctx, uint8_t *bin, TBlockMap *block, std::vector<TBlockReport> *pending) {
+	enum { MAX_GAP = (976 + 100) / 8, MIN_GAP = (976 - 100) / 8 };
+	static const uint8_t next[] = { 0,2,3,4,3 };
+
+	int start = block->start;
+	int len = block_length(ctx, bin, start);
+	int last = ctx->lastBlock;
+	TBlockReport r;
+	char fixed[32] = "";
+	int pos, bits;
+
+	r.map = *block;
+	r.map.len = len;
+	r.number = ++ctx->blockCount;
+	r.type = bin[start];
+	r.crcOk = len && calc_crc(bin + start, len + 2) == 0;
+	r.corrected = false;
+
+	//a bit or two wrong can be put right from the CRC alone, the type byte was already right or len would be off
+	if (len && !r.crcOk && ctx->crcFix != CRC_FIX_NONE) {
+		pos = crc_correct(bin + start, len + 2, ctx->crcFix == CRC_FIX_ADJACENT, &bits);
+		if (pos >= 0) {
+			r.crcOk = true;
+			r.corrected = true;
+			ctx->correctedBlocks++;
+			snprintf(fixed, sizeof(fixed), ", CRC fixed (%d bit%s at %X.%d)", bits, bits > 1 ? "s" : "", start + pos / 8, pos & 7);
+		}
+	}
+
+	if (len && !r.crcOk)
+		ctx->badBlocks++;
+
+	if (len == 0) {
+		r.map.rawEnd = r.map.rawStart;
+		r.notes[0] = 0;
+	}
+	else {
+		//if(type==3 && ...)    //check other fields in file header?
+		snprintf(r.notes, sizeof(r.notes), "%s%s%s%s%s",
+			((!last && r.type != 1) || (last && r.type != next[bin[last]])) ? ", wrong filetype" : "",
+			!r.crcOk ? ", bad CRC" : "", fixed,
+			(last && (last + ctx->lastBlockLen + MAX_GAP)<start) ? ", lost block?" : "",
+			(last + ctx->lastBlockLen + MIN_GAP>start) ? ", block overlap?" : "");
+		ctx->lastBlock = start;
+		ctx->lastBlockLen = len;
+	}
+	pending->push_back(r);
+}
+
+//report the pending blocks whose ends are known, in order.  end >= 0 = output is done, blocks still
+//waiting end there
+static void report_blocks(TDecoderContext *ctx, std::vector<TBlockReport> *pending, int end = -1) {
+	int i, n;
+
+	for (n = 0; n < (int)pending->size(); n++) {
+		TBlockReport *r = &(*pending)[n];
+		TBlockMap *m = &r->map;
+		bool suspect = false;
+
+		if (m->rawEnd < 0 && end < 0)
+			break;
+		if (m->rawEnd < 0)
+			m->rawEnd = end;
+
+		//blocks touching data lost during the capture can't be trusted even with a good CRC
+		for (i = 0; i < ctx->lostCount; i++) {
+			if (ctx->lost[i].start < (m->rawEnd > m->rawStart ? m->rawEnd : m->rawStart + 1) && ctx->lost[i].end > m->rawStart)
+				suspect = true;
+		}
+		if (suspect)
+			ctx->suspectBlocks++;
+
+		if (ctx->blocks && r->number <= ctx->maxBlocks) {
+			TBlockInfo *info = &ctx->blocks[r->number - 1];
+
+			info->start = m->start;
+			info->len = m->len;
+			info->rawStart = m->rawStart;
+			info->rawEnd = m->rawEnd;
+			info->type = r->type;
+			info->crcOk = r->crcOk;
+			info->suspect = suspect;
+			info->corrected = r->corrected;
+		}
+
+		if (m->len == 0)
+			decoder_message(ctx, "%d:%X bad block (%X)\n", r->number, r->type, m->start);
+		else
+			decoder_message(ctx, "%d:%X %X-%X / %X-%X(%X)%s%s\n", r->number, r->type, m->rawStart, m->rawEnd,
+				m->start, m->start + m->len, m->len, r->notes, suspect ? ", suspect (data lost)" : "");
+	}
+	pending->erase(pending->begin(), pending->begin() + n);
+}
+
+//find gap + gap end.  returns bit following gap end, >=rawSize if not found.
+static int nextGapEnd(CGapIndex *index, int in, int rawSize) {
+	enum { MIN_GAP = 976 - 100, };
+	int end = index->NextGapEnd(in, MIN_GAP);
+
+	return (end < 0 ? rawSize : end) + 1;
+}
+
+//decoder mark applied on top of the capture
+typedef struct SRawMark {
+	int pos;
+	uint8_t sym;        //3 = gap start (glitch), 0xff = block start
+} TRawMark;
+
+/*
+Try to create byte-for-byte, unadulterated representation of disk.  Use hints from the disk structure, given
+that it's probably a standard FDS game image but this should still make a best attempt regardless of the disk content.
+
+The capture isn't modified.  Gap/block marks live in the gap index and are merged in while the bits are output,
+and only the raw offsets of each block's start and end are kept (no per-byte reverse map).
+
+_bin and _binSize are updated on exit.  alloc'd buffer is returned in _bin, caller is responsible for freeing it.
+Diagnostics go to ctx's message callback, block numbering restarts with each call.
+*/
+void raw03_to_bin(TDecoderContext *ctx, uint8_t *raw, int rawSize, uint8_t **_bin, int *_binSize) {
+	enum {
+		POST_GLITCH_GARBAGE = 16,
+		LONG_POST_GLITCH_GARBAGE = 64,
+		LONG_GAP = 900,   //976 typ.
+		SHORT_GAP = 16,
+		HISTORY = 32,     //recent bytes kept for block ends found late
+		MAXBLOCK = 0x10000 + 16,  //largest block verify_block can look at past the end of the output
+	};
+	int in, out;
+	uint8_t *bin;
+	int binSize;
+	int glitch;
+	int first;
+	int i;
+	CGapIndex index;
+	std::vector<TRawMark> marks;
+
+	decoder_reset(ctx);
+
+	//one pass over the capture to find zero runs and glitches, the heuristics below work from the index
+	index.Build(raw, rawSize);
+
+	//--- assume any glitch is OOB, mark a run of zeros near a glitch as a gap start.
+	//    a run qualifies once it's longer than SHORT_GAP and the junk before it is close to a glitch
+	//    that hasn't been used yet.
+
+	for (i = 0, glitch = 0; i < (int)index.GetRuns().size(); i++) {
+		TZeroRun run = index.GetRuns()[i];
+		int junk = run.start - 1;
+		int last = index.LastGlitch(run.start);
+
+		if (run.end - run.start <= SHORT_GAP || junk <= 0 || (raw[junk] != 1 && raw[junk] != 2))
+			continue;
+		if (last > glitch && (junk - last) < POST_GLITCH_GARBAGE) {
+			decoder_message(ctx, "mark gap %X-%X\n", run.start, run.start + SHORT_GAP);
+			index.Mark(run.start);
+			glitch = run.start;
+		}
+	}
+
+	//--- Walk filesystem, mark blocks where something looks like a valid file
+
+	first = findFirstBlock(raw, rawSize);
+	if (first>0) {
+		decoder_message(ctx, "header at %X\n", first);
+		mark_gap_start(ctx, &index, first - 1);
+	}
+
+	//--- Identify files by CRC. If data looks like it's surrounded by gaps and it has a valid CRC where we
+	//    expect one to be, assume it's a file and mark its start/end.
+
+	in = first + 1;
+	if (in>0) do {
+		out = crc_detect(&index, raw, in, rawSize);
+		if (out) {
+			decoder_message(ctx, "crc found %X-%X\n", in, out);
+			index.Mark(out);     //mark glitch (gap start)
+		}
+		in = nextGapEnd(&index, out ? out : in, rawSize);
+	} while (in<rawSize);
+
+	//--- mark gap start/end using glitches to find gap start.  only long gaps ending in a 1 can qualify.
+	//    the marks made here are behind the scan so they don't count as glitches for later gaps.
+
+	const std::vector<int> &gapMarks = index.GetMarks();
+	std::vector<int>::const_iterator it = gapMarks.begin();
+	for (i = 0; i < (int)index.GetRuns().size(); i++) {
+		TZeroRun run = index.GetRuns()[i];
+
+		if (run.term != 1 || run.end - run.start <= LONG_GAP)
+			continue;
+		glitch = index.LastGlitch(run.end);
+		if (glitch < 0)
+			glitch = 0;
+		if ((run.start - LONG_POST_GLITCH_GARBAGE) < glitch) {
+			decoder_message(ctx, "mark gap %X-%X\n", run.start, run.end);
+
+			//merge with the earlier marks to keep the list sorted
+			for (; it != gapMarks.end() && *it < run.start; ++it) {
+				TRawMark m = { *it, 3 };
+				marks.push_back(m);
+			}
+			TRawMark head = { run.start, 3 };
+			TRawMark tail = { run.end, 0xff };
+			marks.push_back(head);
+			marks.push_back(tail);
+		}
+	}
+	for (; it != gapMarks.end(); ++it) {
+		TRawMark m = { *it, 3 };
+		marks.push_back(m);
+	}
+	TRawMark sentinel = { rawSize, 0 };
+	marks.push_back(sentinel);
+
+	//--- output
+
+	//two bits per symbol at most, a byte per block start for alignment and room for verify_block to
+	//look at a whole block past the end
+	binSize = (rawSize * 2 + marks.size() * 8) / 8 + MAXBLOCK;
+	bin = (uint8_t*)malloc(binSize);
+	memset(bin, 0, binSize);
+
+	int history[HISTORY];
+	TBlockMap block = { 0, -1, 0, -1 };
+	std::vector<TBlockReport> pending;
+	std::vector<TRawMark>::iterator mark = marks.begin();
+	char bitval = 0;
+	int lastBlockStart = 0;
+	int cur = 0;
+	uint8_t sym;
+	bool marked;
+
+	//called when output moves past byte b, rawPos is the last symbol that went into it
+	struct {
+		TDecoderContext *ctx;
+		int *history;
+		TBlockMap *block;
+		std::vector<TBlockReport> *pending;
+		uint8_t *bin;
+		void done(int b, int rawPos) {
+			history[b % HISTORY] = rawPos;
+			if (b == block->start)
+				block->rawStart = rawPos;
+			if (block->len < 0 && b >= block->start && (bin[block->start] != 4 || ctx->lastBlock + 14 <= b)) {
+				//block type is complete (and block 3's length, for block 4)
+				int end = block->start + (block->len = block_length(ctx, bin, block->start));
+				if (end <= b && b - end < HISTORY)
+					block->rawEnd = history[end % HISTORY];
+			}
+			else if (block->len >= 0 && b == block->start + block->len) {
+				block->rawEnd = rawPos;
+			}
+
+			//blocks already checked that run on past their mark
+			if (pending->size()) {
+				for (size_t i = 0; i < pending->size(); i++) {
+					TBlockMap *m = &(*pending)[i].map;
+
+					if (m->rawEnd < 0 && b == m->start + m->len)
+						m->rawEnd = rawPos;
+				}
+				report_blocks(ctx, pending);
+			}
+		}
+	} map = { ctx, history, &block, &pending, bin };
+
+	for (in = 0, out = 0; in<rawSize; in++) {
+		sym = raw[in];
+		marked = false;
+		if (in == mark->pos) {
+			sym = mark->sym;
+			marked = true;
+			++mark;
+		}
+		switch (sym | (bitval << 4)) {
+		case 0x11:
+			out++;
+			//fall through
+		case 0x00:
+			out++;
+			bitval = 0;
+			break;
+		case 0x12:
+			out++;
+			//fall through
+		case 0x01:
+		case 0x10:
+			bin[out / 8] |= 1 << (out & 7);
+			out++;
+			bitval = 1;
+			break;
+		case 0xff:  //block end, 0xff | (bitval << 4) is still 0xff
+			map.done(cur, in - 1);
+			if (lastBlockStart) {
+				verify_block(ctx, bin, &block, &pending);
+				report_blocks(ctx, &pending);
+			}
+			bin[out / 8] = 0x80;
+			out = (out | 7) + 1;      //byte-align for readability
+			lastBlockStart = cur = out / 8;
+			block.start = lastBlockStart;
+			block.len = -1;
+			block.rawStart = 0;
+			block.rawEnd = -1;
+			bitval = 1;
+			break;
+		case 0x02:
+			//printf("Encoding error @ %X(%X)\n",in,out/8);
+		default: //anything else (glitch).  gap start marks always end in a 0
+			if (marked || ctx->glitch == GLITCH_ZERO) {
+				out++;
+				bitval = 0;
+			}
+			else if (ctx->glitch == GLITCH_ONE) {
+				bin[out / 8] |= 1 << (out & 7);
+				out++;
+				bitval = 1;
+			}
+			break;
+		}
+		if ((out >> 3) != cur) {
+			map.done(cur, in - 1);
+			cur = out >> 3;
+		}
+	}
+	//last block, blocks that run past the end of the capture end there
+	map.done(cur, in - 1);
+	verify_block(ctx, bin, &block, &pending);
+	report_blocks(ctx, &pending, in - 1);
+
+	*_bin = bin;
+	*_binSize = out / 8 + 1;
+}
+
+//position in b where b[pos-len..pos) best matches ref[0..len), searching pos in [lo,hi].  score = matching symbols
+static int best_match(uint8_t *ref, int len, uint8_t *b, int bSize, int lo, int hi, int *score) {
+	int pos, i, n, best = -1;
+
+	*score = -1;
+	if (lo < len)
+		lo = len;
+	if (hi > bSize)
+		hi = bSize;
+	for (pos = lo; pos <= hi; pos++) {
+		for (n = 0, i = 0; i < len; i++) {
+			n += (ref[i] == b[pos - len + i]);
+		}
+		if (n > *score) {
+			*score = n;
+			best = pos;
+		}
+	}
+	return best;
+}
+
+static bool overlaps(TRawRange *ranges, int count, int start, int end) {
+	for (int i = 0; i < count; i++) {
+		if (ranges[i].start < end && ranges[i].end > start)
+			return true;
+	}
+	return false;
+}
+
+int capture_merge(uint8_t *a, int aSize, TRawRange *aLost, int aLostCount, uint8_t *b, int bSize, TRawRange *bLost, int bLostCount,
+	uint8_t **out, int *outSize, TRawRange *outLost) {
+	enum {
+		ANCHOR = 512,				//symbols matched on each side of a lost range
+		SEARCH = 0x8000,			//how far the second capture may be shifted
+		DRIFT = 0x400,				//speed difference across one lost range
+		MINSCORE = ANCHOR * 9 / 10,
+	};
+	uint8_t *a03 = (uint8_t*)malloc(aSize);
+	uint8_t *b03 = (uint8_t*)malloc(bSize);
+	uint8_t *o = (uint8_t*)malloc(aSize + bSize);
+	int i, cursor, outPos, remaining;
+	int len, pre, post, score, start, end;
+
+	//match on pulse classes, not the exact timer values
+	memcpy(a03, a, aSize);
+	raw_to_raw03(a03, aSize);
+	memcpy(b03, b, bSize);
+	raw_to_raw03(b03, bSize);
+
+	for (i = 0, cursor = 0, outPos = 0, remaining = 0; i < aLostCount; i++) {
+		TRawRange *r = &aLost[i];
+
+		//anchors must be real data in a
+		pre = r->start - (i ? aLost[i - 1].end : 0);
+		post = (i + 1 < aLostCount ? aLost[i + 1].start : aSize) - r->end;
+		if (pre > ANCHOR)
+			pre = ANCHOR;
+		if (post > ANCHOR)
+			post = ANCHOR;
+
+		start = end = -1;
+		if (pre >= ANCHOR / 4) {
+			start = best_match(a03 + r->start - pre, pre, b03, bSize, r->start - SEARCH, r->start + SEARCH, &score);
+			if (score < pre * MINSCORE / ANCHOR)
+				start = -1;
+		}
+		if (start >= 0 && post >= ANCHOR / 4) {
+			len = r->end - r->start;
+			end = best_match(a03 + r->end, post, b03, bSize, start + len - DRIFT + post, start + len + DRIFT + post, &score) - post;
+			if (score < post * MINSCORE / ANCHOR)
+				end = -1;
+		}
+
+		memcpy(o + outPos, a + cursor, r->start - cursor);
+		outPos += r->start - cursor;
+		if (start >= 0 && end > start && !overlaps(bLost, bLostCount, start, end)) {
+			memcpy(o + outPos, b + start, end - start);
+			outPos += end - start;
+		}
+		else {
+			//not recovered, keep the filler
+			outLost[remaining].start = outPos;
+			memcpy(o + outPos, a + r->start, r->end - r->start);
+			outPos += r->end - r->start;
+			outLost[remaining++].end = outPos;
+		}
+		cursor = r->end;
+	}
+	memcpy(o + outPos, a + cursor, aSize - cursor);
+	outPos += aSize - cursor;
+
+	free(b03);
+	free(a03);
+	*out = o;
+	*outSize = outPos;
+	return remaining;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <stdint.h>
+
+//FDS disk format
+enum {
+	DEFAULT_LEAD_IN = 28300,      //#bits (~25620 min)
+	GAP = 976 / 8 - 1,                //(~750 min)
+	MIN_GAP_SIZE = 0x300,         //bits
+	FDSSIZE = 65500,              //size of .fds disk side, excluding header
+};
+
+//bad CRC repair done by the decoder (TDecoderContext::crcFix)
+enum {
+	CRC_FIX_NONE = 0,
+	CRC_FIX_SINGLE,				//one flipped bit
+	CRC_FIX_ADJACENT,			//one flipped bit or two neighbouring bits
+	CRC_FIX_MAXSIZE = 0x40,		//largest block crc_correct repairs (type byte through CRC): disk, file count and file headers
+};
+
+//what raw03_to_bin makes of a pulse that can't be decoded (TDecoderContext::glitch)
+enum {
+	GLITCH_ZERO = 0,			//a 0 bit, the default
+	GLITCH_ONE,					//a 1 bit
+	GLITCH_SKIP,				//nothing, as if the pulse wasn't there
+};
+
+enum {
+	FIRSTBLOCK_WINDOW = 0x2000 * 8,     //symbols searched for block 1 (lead-in + slack)
+	FIRSTBLOCK_MAXTOLERANCE = 3,        //mismatched symbols findFirstBlock allows when there's no exact match
+};
+
+//Disk image codec: adapter capture (raw) -> pulse widths (raw03) -> disk bitstream (bin) / .fds and back.
+//No Qt and no device access, so it can be used headless.
+
+//Pulse width (adapter clocks) -> raw03 symbol.  Symbols 0..2 are pulses 2, 3 and 4 half bit cells long,
+//anything below limit[0] or from limit[3] up is 3 (glitch).
+typedef struct SQuantizer {
+	uint8_t center[3];			//typical width of symbols 0..2
+	uint8_t limit[4];			//symbol n starts at limit[n], limit[3] is the end of symbol 2
+	bool track;					//follow slow drive speed drift along the capture
+} TQuantizer;
+
+//range of capture offsets [start, end)
+typedef struct SRawRange {
+	int start;
+	int end;
+} TRawRange;
+
+//block found by raw03_to_bin
+typedef struct SBlockInfo {
+	int start;					//bin offset of the block type byte
+	int len;					//block length excluding CRC, 0 if the type is unknown
+	int rawStart;				//raw03 offsets of the block
+	int rawEnd;
+	uint8_t type;
+	bool crcOk;
+	bool suspect;				//touches data lost in transfer
+	bool corrected;				//CRC was only good after crc_correct
+} TBlockInfo;
+
+//decoder diagnostics, called once per message
+typedef void (*TDecoderMessage)(void *user, const char *msg);
+
+//Everything the raw03 -> bin decoder carries from one step to the next.  The codec has no global state,
+//so captures can be decoded concurrently as long as each one has its own context.
+typedef struct SDecoderContext {
+	TDecoderMessage message;	//0 = discard messages
+	void *user;					//passed to message()
+	int lastBlock;				//bin offset of the previous block verified, 0 if none yet
+	int lastBlockLen;
+	int blockCount;
+	TRawRange *lost;			//capture ranges lost in transfer (sorted), blocks touching them are suspect
+	int lostCount;
+	int suspectBlocks;			//blocks touching a lost range in the last decode
+	int crcFix;					//CRC_FIX_xxx, CRC_FIX_SINGLE after decoder_init
+	int glitch;					//GLITCH_xxx
+	int correctedBlocks;		//blocks repaired by crc_correct in the last decode
+	int badBlocks;				//blocks left with a bad CRC in the last decode
+	TBlockInfo *blocks;			//if set, blocks found are stored here (up to maxBlocks, blockCount counts them all)
+	int maxBlocks;
+} TDecoderContext;
+
+class CGapIndex;
+
+void decoder_init(TDecoderContext *ctx, TDecoderMessage message, void *user);
+
+//start of a new capture, block numbering starts over
+void decoder_reset(TDecoderContext *ctx);
+
+//printf-style message to ctx's callback, ctx may be 0 (discarded).  the codec never prints to stdout itself
+void decoder_message(TDecoderContext *ctx, const char *fmt, ...);
+
+//Turn raw data from adapter to pulse widths (0..3), in place
+void raw_to_raw03(uint8_t *raw, int rawSize);
+
+//the fixed thresholds raw_to_raw03 uses, for a drive at nominal speed
+void quantizer_default(TQuantizer *q);
+
+//count pulse widths in adapter data, hist has 256 entries
+void raw_histogram(uint8_t *raw, int rawSize, uint32_t *hist);
+
+//Find the three pulse width clusters in a histogram and put the limits between them.
+//Returns false (and the default thresholds) if the histogram doesn't look like a disk
+bool quantizer_from_histogram(TQuantizer *q, uint32_t *hist);
+
+//raw_to_raw03 with the given thresholds
+void raw_to_raw03_q(TQuantizer *q, uint8_t *raw, int rawSize);
+
+//FDS CRC, don't include gap end
+uint16_t calc_crc(uint8_t *buf, int size);
+
+//Repair a block with a bad CRC (buf = block type byte through CRC) if one bit, or with adjacent two neighbouring
+//bits, explain it.  Only blocks up to CRC_FIX_MAXSIZE bytes are tried: in a big block nearly every syndrome
+//matches some bit position, so a worse error would be "fixed" into wrong data.
+//Returns the bit offset fixed (bit 0 of buf[0] = 0) and the number of bits in *bits, -1 if nothing was fixed
+int crc_correct(uint8_t *buf, int size, bool adjacent, int *bits);
+
+//copy block with gap end and CRC
+void copy_block(uint8_t *dst, uint8_t *src, int size);
+
+//Adds GAP + GAP end (0x80) + CRCs to .FDS image, why it failed goes to ctx
+//Returns size (0=error)
+int fds_to_bin(uint8_t *dst, uint8_t *src, int dstSize, TDecoderContext *ctx = 0);
+
+//make raw0-3 from flash image (sans header)
+void bin_to_raw03(uint8_t *bin, uint8_t *raw, int binSize, int rawSize);
+
+//look for pattern of bits matching block 1, returns raw03 offset or -1.  an exact match wins, then the
+//first with the fewest mismatched symbols (up to tolerance)
+int findFirstBlock(uint8_t *raw, int rawSize, int window = FIRSTBLOCK_WINDOW, int tolerance = FIRSTBLOCK_MAXTOLERANCE);
+
+//decode one block of a standard disk layout, diagnostics go to ctx
+bool block_decode(TDecoderContext *ctx, uint8_t *dst, uint8_t *src, int *inP, int *outP, int srcSize, int dstSize, int blockSize, char blockType);
+
+//Simplified disk decoding.  This assumes disk will follow standard FDS file structure
+bool raw03_to_fds(TDecoderContext *ctx, uint8_t *raw, uint8_t *fds, int rawsize);
+
+//detect EOF by looking for good CRC.  in=start of file
+//returns 0 if nothing found
+int crc_detect(CGapIndex *index, uint8_t *raw, int in, int rawSize);
+
+//best effort byte-for-byte disk image, alloc'd buffer is returned in _bin, caller is responsible for freeing it
+void raw03_to_bin(TDecoderContext *ctx, uint8_t *raw, int rawSize, uint8_t **_bin, int *_binSize);
+
+//Fill the lost ranges of capture a (adapter data) from a second capture b of the same disk.
+//Each lost range is located in b by matching the data on both sides of it.  The merged capture is returned in
+//a malloc'd *out, ranges that couldn't be recovered are written to outLost (room for aLostCount) and counted
+//in the return value.
+int capture_merge(uint8_t *a, int aSize, TRawRange *aLost, int aLostCount, uint8_t *b, int bSize, TRawRange *bLost, int bLostCount,
+	uint8_t **out, int *outSize, TRawRange *outLost);
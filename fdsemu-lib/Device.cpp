@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "Device.h"
+#include "FlashImage.h"
 
 #define VID 0x0416
 #define PID 0xBEEF
@@ -8,6 +10,10 @@
 
 CDevice::CDevice()
 {
+	handle = 0;
+	Sram = 0;
+	Flash = 0;
+	FlashUtil = 0;
 }
 
 
@@ -73,6 +79,31 @@ bool CDevice::Open()
 	return !!this->handle;
 }
 
+bool CDevice::OpenImage(const char *filename, bool create, uint32_t size)
+{
+	CFlashImage *image;
+
+	//what's open stays open if the image can't be
+	image = new CFlashImage(this);
+	if (image->Open(filename, create, size) == false) {
+		delete image;
+		return(false);
+	}
+	Close();
+	strncpy(DeviceName, filename, sizeof(DeviceName) - 1);
+	DeviceName[sizeof(DeviceName) - 1] = 0;
+	VendorID = ProductID = 0;
+	Version = 0;
+	FlashID = 0;
+	FlashSize = image->GetSize();
+	Slots = FlashSize / 65536;
+	Flash = image;
+	FlashUtil = new CFlashUtil(this);
+	if (create)
+		image->ChipErase();
+	return(true);
+}
+
 void CDevice::Close()
 {
 	if (this->Flash) {
@@ -81,9 +112,13 @@ void CDevice::Close()
 	if (this->FlashUtil) {
 		delete this->FlashUtil;
 	}
+	if (this->Sram) {
+		delete this->Sram;
+	}
 	if (this->handle) {
 		hid_close(this->handle);
 	}
+	this->Sram = 0;
 	this->Flash = 0;
 	this->FlashUtil = 0;
 	this->handle = NULL;
@@ -232,7 +267,7 @@ bool CDevice::DiskReadStart()
 	return hid_send_feature_report(handle, hidbuf, 2) >= 0;
 }
 
-int CDevice::DiskRead(uint8_t *buf)
+int CDevice::DiskReadPacket(uint8_t *buf, uint8_t *seq)
 {
 	int result;
 
@@ -246,22 +281,39 @@ int CDevice::DiskRead(uint8_t *buf)
 
 	//read time out
 	if (result < 2) {
+		return(-1);
+	}
+	*seq = hidbuf[1];
+	if (result > 2) {
+		memcpy(buf, hidbuf + 2, result - 2);
+	}
+	return(result - 2);
+}
+
+int CDevice::DiskRead(uint8_t *buf)
+{
+	int result;
+	uint8_t seq;
+
+	result = DiskReadPacket(buf, &seq);
+
+	//read time out
+	if (result < 0) {
 		printf("\nDisk read timed out\n");
 		return(-1);
 	}
 
 	//adapter will send incomplete/empty packets when it's out of data (end of disk)
-	else if (result > 2) {
-		memcpy(buf, hidbuf + 2, result - 2);
+	else if (result > 0) {
 
 		//sequence out of order (data lost)
-		if (hidbuf[1] != sequence++) {
-			printf("\nDisk read sequence out of order (got %d, wanted %d)\n",hidbuf[1],sequence-1);
+		if (seq != sequence++) {
+			printf("\nDisk read sequence out of order (got %d, wanted %d)\n",seq,sequence-1);
 			return(-1);
 		}
 		else {
-//			printf("read %d bytes\n", result - 2);
-			return(result - 2);
+//			printf("read %d bytes\n", result);
+			return(result);
 		}
 	}
 
@@ -270,4 +322,3 @@ int CDevice::DiskRead(uint8_t *buf)
 		return(0);
 	}
 }
-
@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 #include "hidapi/hidapi.h"
+#include "Codec.h"
 
 enum {
 	SPI_WRITEMAX = 64 - 4,
@@ -37,10 +38,6 @@ enum {
 };
 
 enum {
-	DEFAULT_LEAD_IN = 28300,      //#bits (~25620 min)
-	GAP = 976 / 8 - 1,                //(~750 min)
-	MIN_GAP_SIZE = 0x300,         //bits
-	FDSSIZE = 65500,              //size of .fds disk side, excluding header
 	FLASHHEADERSIZE = 0x100,
 	SLOTSIZE = 65536,
 };
@@ -85,6 +82,11 @@ public:
     bool Open();
 	void Close();
 
+	//use a flash image file (CFlashImage) instead of a device, create = make a new erased one.  only the
+	//flash can be used then, there's no sram or disk drive
+	bool OpenImage(const char *filename, bool create, uint32_t size = 0x1000000);
+	bool IsImage() { return(handle == 0 && Flash != 0); }
+
 	//misc device commands
 	void Reset();
 	void Test();
@@ -104,6 +106,9 @@ public:
 	bool DiskReadStart();
 	int DiskRead(uint8_t *buf);
 
+	//one ID_DISK_READ report without the sequence check, returns data size (0 = end of disk) or -1 on time out
+	int DiskReadPacket(uint8_t *buf, uint8_t *seq);
+
 };
 
 #include "Sram.h"
@@ -1,10 +1,13 @@
 #include <stdio.h>
+#include <string.h>
 #include "Flash.h"
 #include "System.h"
 
 CFlash::CFlash(CDevice *d)
 {
 	dev = d;
+	retries = 0;
+	errors = 0;
 }
 
 
@@ -12,7 +15,22 @@ CFlash::~CFlash()
 {
 }
 
-bool CFlash::Read(uint8_t *buf, uint32_t addr, int size)
+//wait a little longer after each failure, then make sure the chip is idle again.  CS is released first,
+//a transfer that failed halfway may have left it held
+bool CFlash::Recover(int attempt, const char *what, uint32_t addr)
+{
+	if (attempt >= MAXRETRIES) {
+		printf("CFlash::%s: failed at %06X after %d retries\n", what, addr, MAXRETRIES);
+		errors++;
+		return(false);
+	}
+	retries++;
+	sleep_ms(BACKOFF_MS << attempt);
+	dev->FlashWrite(0, 0, 0, 0);
+	return(true);
+}
+
+bool CFlash::ReadOnce(uint8_t *buf, uint32_t addr, int size, int *done)
 {
 	uint8_t cmd[4] = { CMD_READDATA, 0, 0, 0 };
 
@@ -25,22 +43,50 @@ bool CFlash::Read(uint8_t *buf, uint32_t addr, int size)
 		if (!dev->FlashRead(buf, size>SPI_READMAX ? SPI_READMAX : size, size>SPI_READMAX))
 			return false;
 		buf += SPI_READMAX;
+		*done += size>SPI_READMAX ? SPI_READMAX : size;
 	}
 	return true;
 }
 
-bool CFlash::Write(uint8_t *buf, uint32_t addr, int size, TCallback cb, void *user)
+//a failed read carries on from the last report that arrived
+bool CFlash::Read(uint8_t *buf, uint32_t addr, int size)
 {
-	int i;
+	int done = 0, last = 0, attempt = 0;
 
+	while (ReadOnce(buf + done, addr + done, size - done, &done) == false) {
+		if (done > last) {
+			last = done;
+			attempt = 0;
+		}
+		if (Recover(attempt++, "Read", addr + done) == false)
+			return(false);
+	}
+	return(true);
+}
+
+bool CFlash::Write(uint8_t *buf, uint32_t addr, int size, TCallback cb, void *user)
+{
 	if (size % SECTORSIZE) {
 		printf("CFlash::Write:  cannot write data, size must be a multiple of %d\n", SECTORSIZE);
 		return(false);
 	}
 
-	if (Erase(addr, size) == false) {
+	//slots still blank from an earlier erase are programmed straight away
+	if (IsBlank(addr, size) == false && Erase(addr, size) == false) {
 		return(false);
 	}
+	return(Program(buf, addr, size, cb, user));
+}
+
+bool CFlash::Program(uint8_t *buf, uint32_t addr, int size, TCallback cb, void *user)
+{
+	int i;
+
+	if (size % PAGESIZE) {
+		printf("CFlash::Program:  cannot write data, size must be a multiple of %d\n", PAGESIZE);
+		return(false);
+	}
+	MarkSlots(addr, size, false);
 
 	//write pages
 	for (i = 0; i < size; i += PAGESIZE) {
@@ -72,6 +118,42 @@ bool CFlash::Erase(uint32_t addr, int size)
 			return(false);
 		}
 	}
+	MarkSlots(addr, size, true);
+	return(true);
+}
+
+bool CFlash::Update(uint8_t *buf, uint32_t addr, int size)
+{
+	uint8_t old[SECTORSIZE], data[SECTORSIZE], blankPage[PAGESIZE];
+	uint32_t sector, start, end;
+	int i, page;
+	bool erase;
+
+	memset(blankPage, 0xFF, PAGESIZE);
+	for (sector = addr & ~(SECTORSIZE - 1); sector < addr + size; sector += SECTORSIZE) {
+		if (Read(old, sector, SECTORSIZE) == false) {
+			return(false);
+		}
+		start = sector > addr ? sector : addr;
+		end = sector + SECTORSIZE < addr + size ? sector + SECTORSIZE : addr + size;
+		memcpy(data, old, SECTORSIZE);
+		memcpy(data + (start - sector), buf + (start - addr), end - start);
+
+		//programming can only clear bits
+		for (erase = false, i = 0; i < SECTORSIZE && !erase; i++) {
+			erase = (old[i] & data[i]) != data[i];
+		}
+		if (erase && EraseSector(sector) == false) {
+			return(false);
+		}
+		for (page = 0; page < SECTORSIZE; page += PAGESIZE) {
+			if (memcmp(data + page, erase ? blankPage : old + page, PAGESIZE) == 0)
+				continue;
+			if (Program(data + page, sector + page, PAGESIZE) == false) {
+				return(false);
+			}
+		}
+	}
 	return(true);
 }
 
@@ -98,15 +180,31 @@ bool CFlash::WaitBusy(uint32_t timeout) {
 	return !(status & 1);
 }
 
+//programming a page twice with the same data leaves the same bits, so a page whose transfer failed is just sent again
 bool CFlash::PageProgram(uint32_t addr, uint8_t *buf)
 {
-	uint8_t cmd[PAGESIZE + 4];
-	int size = PAGESIZE;
+	int attempt = 0;
 
-	if (((addr&(PAGESIZE - 1)) + size)>PAGESIZE)
+	if (((addr&(PAGESIZE - 1)) + PAGESIZE)>PAGESIZE)
 	{
 		printf("Page write overflow.\n"); return false;
 	}
+
+	//the status register is read before the page goes again, the chip may still be busy with it
+	while (PageProgramOnce(addr, buf) == false) {
+		do {
+			if (Recover(attempt++, "PageProgram", addr) == false)
+				return(false);
+		} while (WaitBusy(100) == false);
+	}
+	return(true);
+}
+
+bool CFlash::PageProgramOnce(uint32_t addr, uint8_t *buf)
+{
+	uint8_t cmd[PAGESIZE + 4];
+	int size = PAGESIZE;
+
 	if (!WriteEnable()) {
 		printf("Write enable failed.\n");
 		return false;
@@ -128,6 +226,19 @@ bool CFlash::PageProgram(uint32_t addr, uint8_t *buf)
 }
 
 bool CFlash::EraseSector(uint32_t addr)
+{
+	int attempt = 0;
+
+	while (EraseSectorOnce(addr) == false) {
+		do {
+			if (Recover(attempt++, "EraseSector", addr) == false)
+				return(false);
+		} while (WaitBusy(1600) == false);
+	}
+	return(true);
+}
+
+bool CFlash::EraseSectorOnce(uint32_t addr)
 {
 	uint8_t cmd[] = { CMD_SECTORERASE,0,0,0 };
 
@@ -149,6 +260,7 @@ bool CFlash::EraseSlot(int slot)
 			return(false);
 		}
 	}
+	SetBlank(slot);
 	return(true);
 }
 
@@ -156,3 +268,33 @@ bool CFlash::ChipErase()
 {
 	return(false);
 }
+
+void CFlash::MarkSlots(uint32_t addr, int size, bool isBlank)
+{
+	uint32_t slot, end = addr + size;
+
+	if (blank.size() != dev->Slots)
+		blank.assign(dev->Slots, false);
+	for (slot = addr / SLOTSIZE; slot < blank.size() && slot * SLOTSIZE < end; slot++) {
+		if (!isBlank || (slot * SLOTSIZE >= addr && (slot + 1) * SLOTSIZE <= end))
+			blank[slot] = isBlank;
+	}
+}
+
+bool CFlash::IsBlank(uint32_t addr, int size)
+{
+	uint32_t slot, end = addr + size;
+
+	if (blank.size() != dev->Slots || size <= 0)
+		return(false);
+	for (slot = addr / SLOTSIZE; slot * SLOTSIZE < end; slot++) {
+		if (slot >= blank.size() || !blank[slot])
+			return(false);
+	}
+	return(true);
+}
+
+void CFlash::SetBlank(int slot)
+{
+	MarkSlots(slot * SLOTSIZE, SLOTSIZE, true);
+}
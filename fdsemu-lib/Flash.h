@@ -1,4 +1,5 @@
 #pragma once
+#include <vector>
 #include "Device.h"
 
 enum {
@@ -25,8 +26,30 @@ typedef void(*TCallback)(void*, uint32_t);
 
 class CFlash
 {
+public:
+	//a failed SPI transfer is tried again after BACKOFF_MS, doubled each time, up to MAXRETRIES times
+	enum {
+		MAXRETRIES = 5,
+		BACKOFF_MS = 2,
+	};
+
 protected:
 	CDevice *dev;
+	std::vector<bool> blank;		//slots known to be erased since they were last programmed
+	uint32_t retries;				//transfers tried again
+	uint32_t errors;				//operations that failed after all retries
+
+	//one try of each, the public calls retry them
+	bool ReadOnce(uint8_t *buf, uint32_t addr, int size, int *done);
+	bool PageProgramOnce(uint32_t addr, uint8_t *buf);
+	bool EraseSectorOnce(uint32_t addr);
+
+	//before the next try, false if it's the last one
+	bool Recover(int attempt, const char *what, uint32_t addr);
+
+	//remember slots in the range as blank (only the ones covered whole) or not
+	void MarkSlots(uint32_t addr, int size, bool isBlank);
+
 public:
 	CFlash(CDevice *d);
 	virtual ~CFlash();
@@ -42,6 +65,14 @@ public:
 	virtual bool Write(uint8_t *buf, uint32_t addr, int size, TCallback cb = 0, void *user = 0);
 	virtual bool Erase(uint32_t addr, int size);
 
+	//program without erasing, the range must be blank (or hold data the new data only clears bits of)
+	virtual bool Program(uint8_t *buf, uint32_t addr, int size, TCallback cb = 0, void *user = 0);
+
+	//change any range in place: each 4kb sector it touches is read, and only the pages that differ are
+	//programmed.  the sector is erased first only if some bit has to go from 0 to 1, the rest of it is
+	//programmed back from memory then
+	virtual bool Update(uint8_t *buf, uint32_t addr, int size);
+
 	//write one 256 byte page
 	virtual bool PageProgram(uint32_t addr, uint8_t *buf);
 
@@ -53,4 +84,13 @@ public:
 
 	//erase entire chip
 	virtual bool ChipErase();
+
+	//true if every slot the range touches is known to be blank, Write skips the erase then.  only erases
+	//done here (or SetBlank after checking a slot) count, nothing is known about the flash when it's opened
+	bool IsBlank(uint32_t addr, int size);
+	void SetBlank(int slot);
+
+	//transfer retries and failed operations since the device was opened
+	uint32_t GetRetries() { return(retries); }
+	uint32_t GetErrors() { return(errors); }
 };
@@ -0,0 +1,359 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "FlashDefrag.h"
+
+CFlashDefrag::CFlashDefrag(CDevice *d)
+{
+	dev = d;
+	freeStart = 0;
+	freeLen = 0;
+}
+
+CFlashDefrag::~CFlashDefrag()
+{
+}
+
+//holes = empty slots outside the free window, ascending.  every mover gets exactly its sides
+bool CFlashDefrag::Pack(std::vector<TDefragMove> &list, std::vector<int> &holes, bool split)
+{
+	typedef struct { int start, len; } TRun;
+	std::vector<TRun> runs;
+	std::vector<int> order;
+	int i, n, r, best;
+	bool fits = true;
+
+	for (i = 0; i < (int)holes.size(); i++) {
+		if (runs.size() && runs.back().start + runs.back().len == holes[i]) {
+			runs.back().len++;
+		}
+		else {
+			TRun run = { holes[i], 1 };
+
+			runs.push_back(run);
+		}
+	}
+	for (i = 0; i < (int)list.size(); i++) {
+		list[i].to.clear();
+		list[i].split = false;
+		order.push_back(i);
+	}
+	for (i = 1; i < (int)order.size(); i++) {
+		for (n = i; n > 0 && list[order[n]].from.size() > list[order[n - 1]].from.size(); n--)
+			std::swap(order[n], order[n - 1]);
+	}
+	for (i = 0; i < (int)order.size(); i++) {
+		TDefragMove *m = &list[order[i]];
+		int sides = (int)m->from.size();
+
+		for (best = -1, r = 0; r < (int)runs.size(); r++) {
+			if (runs[r].len >= sides && (best == -1 || runs[r].len < runs[best].len))
+				best = r;
+		}
+		if (best == -1) {
+			fits = false;
+			continue;
+		}
+		for (n = 0; n < sides; n++)
+			m->to.push_back(runs[best].start + n);
+		runs[best].start += sides;
+		runs[best].len -= sides;
+	}
+	if (fits || !split)
+		return(fits);
+
+	//the rest go into whatever is left, smallest runs first
+	for (i = 1; i < (int)runs.size(); i++) {
+		for (n = i; n > 0 && runs[n].len < runs[n - 1].len; n--)
+			std::swap(runs[n], runs[n - 1]);
+	}
+	for (i = 0, r = 0; i < (int)order.size(); i++) {
+		TDefragMove *m = &list[order[i]];
+
+		if (m->to.size())
+			continue;
+		for (; m->to.size() < m->from.size(); runs[r].start++, runs[r].len--) {
+			while (runs[r].len == 0)
+				r++;
+			m->to.push_back(runs[r].start);
+		}
+		std::sort(m->to.begin(), m->to.end());
+		m->split = true;
+	}
+	return(true);
+}
+
+bool CFlashDefrag::Plan(bool split)
+{
+	TFlashHeader *headers;
+	std::vector<TDefragMove> images, list, bestList;
+	std::vector<int> owner, sides, holes;
+	int n = (int)dev->Slots;
+	int i, j, w, slots, cost, bestCost = -1, bestStart = 0;
+	bool valid;
+
+	moves.clear();
+	clear.clear();
+	freeStart = freeLen = 0;
+	if (dev->FlashUtil->ReadHeaders() == false || (headers = dev->FlashUtil->GetHeaders()) == 0)
+		return(false);
+
+	//which image owns each slot, -1 for empty slots and leftovers of broken images (both count as free)
+	owner.assign(n, -1);
+	for (i = 1; i < n; i++) {
+		if (dev->FlashUtil->GetSides(i, &sides) == 0)
+			continue;
+		TDefragMove image;
+
+		image.name.assign((char*)headers[i].filename, strnlen((char*)headers[i].filename, 240));
+		image.from = sides;
+		image.state = DEFRAG_WAITING;
+		for (j = 0; j < (int)sides.size(); j++)
+			owner[sides[j]] = (int)images.size();
+		images.push_back(image);
+	}
+	for (slots = 0, i = 1; i < n; i++) {
+		if (owner[i] == -1)
+			slots++;
+	}
+	if (slots == 0)
+		return(true);
+
+	//the loader stays in slot 0
+	for (w = 1; w + slots <= n; w++) {
+		std::vector<bool> inside(images.size(), false);
+
+		list.clear();
+		holes.clear();
+		for (i = w; i < w + slots; i++) {
+			if (owner[i] != -1 && !inside[owner[i]]) {
+				inside[owner[i]] = true;
+				list.push_back(images[owner[i]]);
+			}
+		}
+		for (valid = true, cost = 0, i = 0; i < (int)list.size() && valid; i++) {
+			for (j = 0; j < (int)list[i].from.size(); j++) {
+				if (list[i].from[j] < w || list[i].from[j] >= w + slots)
+					valid = false;
+			}
+			cost += (int)list[i].from.size();
+		}
+		if (!valid || (bestCost != -1 && cost > bestCost))
+			continue;
+		for (i = 1; i < n; i++) {
+			if ((i < w || i >= w + slots) && owner[i] == -1)
+				holes.push_back(i);
+		}
+		if (Pack(list, holes, split) == false)
+			continue;
+
+		//ties go to the later window, free space usually ends up at the end
+		bestCost = cost;
+		bestStart = w;
+		bestList = list;
+	}
+	if (bestCost == -1) {
+		printf("CFlashDefrag::Plan: no way to make the %d empty slots one run%s\n", slots, split ? "" : " without splitting images");
+		return(false);
+	}
+	moves = bestList;
+	freeStart = bestStart;
+	freeLen = slots;
+	for (i = bestStart; i < bestStart + slots; i++) {
+		if (owner[i] == -1 && headers[i].filename[0] != 0xFF)
+			clear.push_back(i);
+	}
+	return(true);
+}
+
+int CFlashDefrag::GetCopies()
+{
+	int i, count = 0;
+
+	for (i = 0; i < (int)moves.size(); i++) {
+		count += (int)moves[i].from.size();
+	}
+	return(count);
+}
+
+int CFlashDefrag::GetEstimate()
+{
+	int copies = GetCopies();
+
+	return((copies * (READ_MS + ERASE_MS + PROGRAM_MS) + (copies + (int)clear.size()) * ERASE_MS + 999) / 1000);
+}
+
+bool CFlashDefrag::DoMove(int i, CFlashJournal *journal)
+{
+	TDefragMove *m = &moves[i];
+	int sides = (int)m->from.size();
+	std::vector<uint8_t> buf((size_t)sides * SLOTSIZE);
+	uint16_t next;
+	int side;
+
+	if (m->state == DEFRAG_WAITING) {
+		for (side = 0; side < sides; side++) {
+			if (dev->Flash->Read(&buf[side * SLOTSIZE], m->from[side] * SLOTSIZE, SLOTSIZE) == false)
+				return(false);
+			next = m->split ? (side + 1 < sides ? m->to[side + 1] : NEXTSLOT_END) : 0;
+			buf[side * SLOTSIZE + 246] = (uint8_t)(next >> 0);
+			buf[side * SLOTSIZE + 247] = (uint8_t)(next >> 8);
+		}
+
+		//first side last, until it's written the new copy has no name and isn't listed
+		for (side = sides - 1; side >= 0; side--) {
+			if (dev->Flash->Write(&buf[side * SLOTSIZE], m->to[side] * SLOTSIZE, SLOTSIZE) == false)
+				return(false);
+		}
+		m->state = DEFRAG_COPIED;
+		journal->Add("copied %d", i);
+	}
+
+	//first side first, so the old copy drops out of the list at once
+	for (side = 0; side < sides; side++) {
+		if (dev->Flash->EraseSlot(m->from[side]) == false)
+			return(false);
+	}
+	m->state = DEFRAG_DONE;
+	journal->Add("done %d", i);
+	return(true);
+}
+
+bool CFlashDefrag::Execute(const char *filename, TDefragCallback cb, void *user)
+{
+	CFlashJournal journal;
+	int i, step = 0, steps = GetCopies() + (int)clear.size();
+
+	//the whole plan goes first so a resume knows everything, then progress
+	if (journal.Create(filename) == false)
+		return(false);
+	journal.Add("defrag %d %d %d", (int)moves.size(), freeStart, freeLen);
+	for (i = 0; i < (int)moves.size(); i++) {
+		journal.Add("move %d %s %s %d %s", i, CFlashJournal::SlotList(moves[i].from).c_str(), CFlashJournal::SlotList(moves[i].to).c_str(),
+			moves[i].split ? 1 : 0, moves[i].name.c_str());
+	}
+	journal.Add("clear %s", clear.size() ? CFlashJournal::SlotList(clear).c_str() : "-");
+	for (i = 0; i < (int)moves.size(); i++) {
+		if (moves[i].state != DEFRAG_WAITING)
+			journal.Add("copied %d", i);
+		if (moves[i].state == DEFRAG_DONE)
+			journal.Add("done %d", i);
+	}
+
+	for (i = 0; i < (int)moves.size(); i++) {
+		if (cb)
+			cb(user, i, step, steps);
+		if (moves[i].state != DEFRAG_DONE && DoMove(i, &journal) == false) {
+			printf("CFlashDefrag: moving %s failed\n", moves[i].name.c_str());
+			journal.Close(false);
+			return(false);
+		}
+		step += (int)moves[i].from.size();
+	}
+	for (i = 0; i < (int)clear.size(); i++) {
+		if (cb)
+			cb(user, -1, step++, steps);
+		if (dev->Flash->EraseSlot(clear[i]) == false) {
+			journal.Close(false);
+			return(false);
+		}
+	}
+	journal.Add("end");
+	journal.Close(true);
+	dev->FlashUtil->ReadHeaders();
+	return(true);
+}
+
+bool CFlashDefrag::Run(const char *journal, TDefragCallback cb, void *user)
+{
+	return(Execute(journal, cb, user));
+}
+
+bool CFlashDefrag::Pending(const char *journal)
+{
+	std::vector<std::string> lines;
+
+	return(CFlashJournal::Load(journal, &lines) && lines.size() && lines[0].compare(0, 7, "defrag ") == 0);
+}
+
+bool CFlashDefrag::Load(const char *journal)
+{
+	std::vector<std::string> lines;
+	char from[1024], to[1024];
+	int i, k, count, split, pos;
+
+	moves.clear();
+	clear.clear();
+	if (CFlashJournal::Load(journal, &lines) == false || lines.empty() || sscanf(lines[0].c_str(), "defrag %d %d %d", &count, &freeStart, &freeLen) != 3)
+		return(false);
+	for (i = 1; i < (int)lines.size(); i++) {
+		const char *line = lines[i].c_str();
+
+		if (sscanf(line, "move %d %1023s %1023s %d %n", &k, from, to, &split, &pos) == 4 && k == (int)moves.size()) {
+			TDefragMove m;
+
+			CFlashJournal::ParseSlots(from, &m.from);
+			CFlashJournal::ParseSlots(to, &m.to);
+			m.split = split != 0;
+			m.name = line + pos;
+			m.state = DEFRAG_WAITING;
+			moves.push_back(m);
+		}
+		else if (sscanf(line, "clear %1023s", from) == 1) {
+			CFlashJournal::ParseSlots(from, &clear);
+		}
+		else if (sscanf(line, "copied %d", &k) == 1 && k < (int)moves.size()) {
+			moves[k].state = DEFRAG_COPIED;
+		}
+		else if (sscanf(line, "done %d", &k) == 1 && k < (int)moves.size()) {
+			moves[k].state = DEFRAG_DONE;
+		}
+	}
+	return((int)moves.size() == count);
+}
+
+bool CFlashDefrag::Resume(const char *journal, TDefragCallback cb, void *user)
+{
+	TFlashHeader *headers;
+	int i;
+
+	if (Load(journal) == false)
+		return(false);
+
+	//a move not known to be copied must still have its old copy, or the flash was changed since
+	if (dev->FlashUtil->ReadHeaders() == false || (headers = dev->FlashUtil->GetHeaders()) == 0)
+		return(false);
+	for (i = 0; i < (int)moves.size(); i++) {
+		if (moves[i].state == DEFRAG_WAITING && strncmp((char*)headers[moves[i].from[0]].filename, moves[i].name.c_str(), 240) != 0) {
+			printf("CFlashDefrag::Resume: %s isn't in slot %d any more\n", moves[i].name.c_str(), moves[i].from[0]);
+			return(false);
+		}
+	}
+	return(Execute(journal, cb, user));
+}
+
+bool CFlashDefrag::Discard(const char *journal)
+{
+	TFlashHeader *headers;
+	int i, side, slot;
+	bool result = true;
+
+	if (Load(journal) == false || dev->FlashUtil->ReadHeaders() == false || (headers = dev->FlashUtil->GetHeaders()) == 0)
+		return(false);
+
+	//the new slots are outside the free area, no other move's old copy is there
+	for (i = 0; i < (int)moves.size(); i++) {
+		if (moves[i].state != DEFRAG_WAITING)
+			continue;
+		for (side = (int)moves[i].to.size() - 1; side >= 0; side--) {
+			slot = moves[i].to[side];
+			if (headers[slot].filename[0] != 0xFF && dev->Flash->EraseSector(slot * SLOTSIZE) == false) {
+				printf("CFlashDefrag::Discard: erasing the header of slot %d failed\n", slot);
+				result = false;
+			}
+		}
+	}
+	dev->FlashUtil->ReadHeaders();
+	return(result);
+}
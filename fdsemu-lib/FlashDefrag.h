@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include "Device.h"
+#include "FlashJournal.h"
+
+typedef struct SDefragMove {
+	std::string name;
+	std::vector<int> from;		//slots of the image's sides now
+	std::vector<int> to;		//and after the move
+	bool split;					//new slots aren't one run, sides chained with nextslot
+	int state;					//DEFRAG_xxx
+} TDefragMove;
+
+enum {
+	DEFRAG_WAITING = 0,
+	DEFRAG_COPIED,				//new copy complete, old slots not erased yet
+	DEFRAG_DONE,
+};
+
+//progress of CFlashDefrag::Run: move being done and slots copied or erased so far in the whole run
+typedef void (*TDefragCallback)(void *user, int move, int step, int steps);
+
+//Moves images around so all empty slots end up as one run.
+//Every window of slots as long as the number of empty slots is tried as the free area.  Images inside
+//it have to move, into the empty slots outside it, and must fit there (best fit, largest first, or split
+//with nextslot if allowed).  The window needing the fewest sides copied wins, so an image that is already
+//where it ends up is never touched.  An image can't be partly inside the window, so a new copy never
+//overlaps its old slots: each side is read into memory, written to its new slot (one erase per slot,
+//first side last so a half copy has no name), then the old slots are erased.  Progress is journaled, an
+//interrupted run is finished by Resume.
+class CFlashDefrag
+{
+public:
+	//rough time per slot over USB, for the estimate
+	enum {
+		READ_MS = 1100,
+		ERASE_MS = 800,
+		PROGRAM_MS = 1200,
+	};
+
+protected:
+	CDevice *dev;
+	std::vector<TDefragMove> moves;
+	std::vector<int> clear;		//slots in the free area that aren't empty (left from broken images)
+	int freeStart;
+	int freeLen;
+
+	bool Pack(std::vector<TDefragMove> &list, std::vector<int> &holes, bool split);
+	bool DoMove(int i, CFlashJournal *journal);
+	bool Execute(const char *journal, TDefragCallback cb, void *user);
+
+	//moves of a journal and how far they got
+	bool Load(const char *journal);
+
+public:
+	CFlashDefrag(CDevice *d);
+	virtual ~CFlashDefrag();
+
+	//work out the moves, false if the empty slots can't be made one run (try again with split)
+	bool Plan(bool split = false);
+
+	//do the moves, journaled to the file
+	bool Run(const char *journal, TDefragCallback cb = 0, void *user = 0);
+
+	//finish a run left in the journal, false if the flash doesn't match it any more
+	bool Resume(const char *journal, TDefragCallback cb = 0, void *user = 0);
+
+	//drop a run left in the journal instead: the headers of half made copies are erased, images copied
+	//but not yet erased from their old slots stay listed twice.  the journal is left for the caller to remove
+	bool Discard(const char *journal);
+
+	//true if a run was interrupted
+	static bool Pending(const char *journal);
+
+	int GetMoves() { return((int)moves.size()); }
+	TDefragMove *GetMove(int i) { return(&moves[i]); }
+
+	//sides copied by the plan
+	int GetCopies();
+
+	//empty run after the moves
+	int GetFreeStart() { return(freeStart); }
+	int GetFreeLength() { return(freeLen); }
+
+	//estimated time of the plan in seconds
+	int GetEstimate();
+};
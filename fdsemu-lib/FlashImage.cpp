@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "FlashImage.h"
+#include "FlashUtil.h"
+#include "System.h"
+
+CFlashImage::CFlashImage(CDevice *d) : CFlash(d)
+{
+	data = 0;
+	size = 0;
+	pushed = 0;
+}
+
+CFlashImage::~CFlashImage()
+{
+	Close();
+}
+
+bool CFlashImage::Open(const char *filename, bool create, uint32_t newsize)
+{
+	Close();
+	size = newsize;
+	if ((data = (uint8_t*)file_map_rw(filename, &size, create)) == 0) {
+		printf("CFlashImage::Open: can't map %s\n", filename);
+		size = 0;
+		return(false);
+	}
+	if (size % SLOTSIZE) {
+		printf("CFlashImage::Open: %s isn't a flash image (%u bytes)\n", filename, (uint32_t)size);
+		Close();
+		return(false);
+	}
+	if (create)
+		memset(data, 0xFF, size);
+	return(true);
+}
+
+void CFlashImage::Close()
+{
+	if (data) {
+		file_map_sync(data, size);
+		file_unmap(data, size);
+	}
+	data = 0;
+	size = 0;
+}
+
+bool CFlashImage::WriteEnable()
+{
+	return(data != 0);
+}
+
+bool CFlashImage::WaitBusy(uint32_t timeout)
+{
+	(void)timeout;
+	return(data != 0);
+}
+
+bool CFlashImage::Read(uint8_t *buf, uint32_t addr, int size)
+{
+	if (data == 0 || addr + size > this->size)
+		return(false);
+	memcpy(buf, data + addr, size);
+	return(true);
+}
+
+bool CFlashImage::PageProgram(uint32_t addr, uint8_t *buf)
+{
+	int i;
+
+	if (data == 0 || (addr & (PAGESIZE - 1)) || addr + PAGESIZE > size)
+		return(false);
+	for (i = 0; i < PAGESIZE; i++)
+		data[addr + i] &= buf[i];
+	return(true);
+}
+
+bool CFlashImage::EraseSector(uint32_t addr)
+{
+	addr &= ~(SECTORSIZE - 1);
+	if (data == 0 || addr + SECTORSIZE > size)
+		return(false);
+	memset(data + addr, 0xFF, SECTORSIZE);
+	return(true);
+}
+
+bool CFlashImage::ChipErase()
+{
+	if (data == 0)
+		return(false);
+	memset(data, 0xFF, size);
+	MarkSlots(0, (int)size, true);
+	return(true);
+}
+
+uint8_t *CFlashImage::MapMirror(const char *filename, CDevice *target, size_t *mirrorSize)
+{
+	uint8_t *mirror;
+
+	*mirrorSize = 0;
+	mirror = (uint8_t*)file_map_rw(filename, mirrorSize, false);
+	if (mirror && *mirrorSize == size + size / SECTORSIZE && CheckMirror(mirror, target))
+		return(mirror);
+	if (mirror)
+		file_unmap(mirror, *mirrorSize);
+
+	//nothing is known, every sector is compared with the device
+	*mirrorSize = size + size / SECTORSIZE;
+	if ((mirror = (uint8_t*)file_map_rw(filename, mirrorSize, true)) == 0) {
+		printf("CFlashImage::Push: can't map %s\n", filename);
+		return(0);
+	}
+	memset(mirror + size, 1, size / SECTORSIZE);
+	return(mirror);
+}
+
+//a header that differs means the slot was changed on the device (every change there writes one), the
+//slot is compared whole.  a sample that differs means the mirror is of another card
+bool CFlashImage::CheckMirror(uint8_t *mirror, CDevice *target)
+{
+	uint8_t *state = mirror + size, buf[SECTORSIZE];
+	TFlashHeader *headers;
+	std::vector<uint32_t> known;
+	uint32_t slot, sector, slots = (uint32_t)(size / SLOTSIZE);
+	int i, n;
+
+	if (target->FlashUtil->ReadHeaders() == false || (headers = target->FlashUtil->GetHeaders()) == 0)
+		return(false);
+	for (slot = 1; slot < slots; slot++) {
+		if (memcmp(&headers[slot], mirror + slot * SLOTSIZE, sizeof(TFlashHeader)) == 0)
+			continue;
+		for (sector = slot * SLOTSIZE / SECTORSIZE; sector < (slot + 1) * SLOTSIZE / SECTORSIZE; sector++)
+			state[sector] = 1;
+	}
+	for (sector = SLOTSIZE / SECTORSIZE; sector < size / SECTORSIZE; sector++) {
+		if (state[sector] == 0)
+			known.push_back(sector);
+	}
+	for (i = 0; i < SAMPLES && known.size(); i++) {
+		n = rand() % known.size();
+		sector = known[n];
+		known.erase(known.begin() + n);
+		if (target->Flash->Read(buf, sector * SECTORSIZE, SECTORSIZE) == false)
+			return(false);
+		if (memcmp(buf, mirror + sector * SECTORSIZE, SECTORSIZE)) {
+			printf("CFlashImage::Push: mirror doesn't match the device at sector %u\n", sector);
+			return(false);
+		}
+	}
+	return(true);
+}
+
+bool CFlashImage::Push(CDevice *target, const char *filename, TCallback cb, void *user)
+{
+	uint8_t *mirror, *state;
+	size_t mirrorSize;
+	std::vector<uint32_t> sectors;
+	uint32_t slot, sector, i, first, slots = (uint32_t)(size / SLOTSIZE);
+	bool ok = true;
+
+	pushed = 0;
+	if (data == 0 || target->FlashSize != size) {
+		printf("CFlashImage::Push: the image is %u bytes, the device has %u\n", (uint32_t)size, target->FlashSize);
+		return(false);
+	}
+	if ((mirror = MapMirror(filename, target, &mirrorSize)) == 0)
+		return(false);
+	state = mirror + size;
+
+	//a slot's header sector goes last, so an image cut off halfway has no header yet (or its old one)
+	for (slot = 1; slot < slots; slot++) {
+		first = slot * SLOTSIZE / SECTORSIZE;
+		for (i = 1; i <= SLOTSIZE / SECTORSIZE; i++) {
+			sector = first + (i % (SLOTSIZE / SECTORSIZE));
+			if (state[sector] || memcmp(data + sector * SECTORSIZE, mirror + sector * SECTORSIZE, SECTORSIZE))
+				sectors.push_back(sector);
+		}
+	}
+
+	//they're unknown until they're done, in case this is cut off
+	for (i = 0; i < sectors.size(); i++)
+		state[sectors[i]] = 1;
+	file_map_sync(mirror, mirrorSize);
+	pushed = (uint32_t)sectors.size();
+	for (i = 0; i < sectors.size() && ok; i++) {
+		sector = sectors[i];
+		ok = target->Flash->Update(data + sector * SECTORSIZE, sector * SECTORSIZE, SECTORSIZE);
+		if (ok) {
+			memcpy(mirror + sector * SECTORSIZE, data + sector * SECTORSIZE, SECTORSIZE);
+			state[sector] = 0;
+		}
+		if (cb)
+			cb(user, i + 1);
+	}
+	file_map_sync(mirror, mirrorSize);
+	file_unmap(mirror, mirrorSize);
+	target->FlashUtil->ReadHeaders();
+	printf("CFlashImage::Push: %u sectors changed, %s\n", pushed, ok ? "done" : "failed");
+	return(ok);
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include "Device.h"
+
+//A whole flash chip in a memory mapped file, same slot and header layout as the device.  It stands in for
+//CFlash (see CDevice::OpenImage) so CFlashUtil, CFlashPlan, CFlashDefrag and CFlashSync edit it the same
+//way, without a device.  Programming clears bits and erasing sets them like the chip does, so what's
+//written here is exactly what Push makes the device hold.
+class CFlashImage : public CFlash
+{
+public:
+	enum {
+		DEFAULT_SIZE = 0x1000000,	//16mb, 256 slots
+		SAMPLES = 16,				//sectors read back to check that a mirror still matches the device
+	};
+
+protected:
+	uint8_t *data;
+	size_t size;
+	uint32_t pushed;			//sectors the last Push sent to the device
+
+	//mirror of what the device holds: the flash data, then one byte per sector, nonzero if it isn't known.
+	//false if it doesn't match the device, some of it is trusted only after CheckMirror
+	uint8_t *MapMirror(const char *filename, CDevice *target, size_t *mirrorSize);
+	bool CheckMirror(uint8_t *mirror, CDevice *target);
+
+public:
+	CFlashImage(CDevice *d);
+	virtual ~CFlashImage();
+
+	//open an image file, create = make a new one of 'newsize' bytes, erased.  false if it can't be mapped
+	//or isn't a whole number of slots.  changes are written to the file when it's closed
+	bool Open(const char *filename, bool create, uint32_t newsize = DEFAULT_SIZE);
+	void Close();
+	uint32_t GetSize() { return((uint32_t)size); }
+
+	//the image as memory, SLOTSIZE bytes per slot
+	uint8_t *GetData() { return(data); }
+
+	virtual bool WriteEnable();
+	virtual bool WaitBusy(uint32_t timeout);
+	virtual bool Read(uint8_t *buf, uint32_t addr, int size);
+	virtual bool PageProgram(uint32_t addr, uint8_t *buf);
+	virtual bool EraseSector(uint32_t addr);
+	virtual bool ChipErase();
+
+	//make the device's flash (same size) match the image, slot 0 (the loader) is left alone.  only sectors
+	//that differ from the mirror, a file kept with what the device held after the last push, are changed
+	//with CFlash::Update, which programs only the pages that differ.  the mirror is checked against the
+	//device's headers and SAMPLES sectors first, slots whose headers changed on the device are compared
+	//whole, and without a mirror every sector is.  cb gets the sectors done so far
+	bool Push(CDevice *target, const char *mirror, TCallback cb = 0, void *user = 0);
+	uint32_t GetPushed() { return(pushed); }
+};
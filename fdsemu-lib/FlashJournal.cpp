@@ -0,0 +1,99 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "FlashJournal.h"
+#include "System.h"
+
+CFlashJournal::CFlashJournal()
+{
+	fp = 0;
+}
+
+CFlashJournal::~CFlashJournal()
+{
+	Close(false);
+}
+
+bool CFlashJournal::Create(const char *filename)
+{
+	Close(false);
+	path = filename;
+	if ((fp = fopen(filename, "w")) == 0) {
+		printf("Can't create journal %s\n", filename);
+		return(false);
+	}
+	return(true);
+}
+
+bool CFlashJournal::Add(const char *fmt, ...)
+{
+	va_list args;
+
+	if (fp == 0)
+		return(false);
+	va_start(args, fmt);
+	vfprintf(fp, fmt, args);
+	va_end(args);
+	fputc('\n', fp);
+	if (file_sync(fp) == false) {
+		printf("Journal write failed\n");
+		return(false);
+	}
+	return(true);
+}
+
+void CFlashJournal::Close(bool finished)
+{
+	if (fp == 0)
+		return;
+	fclose(fp);
+	fp = 0;
+	if (finished)
+		remove(path.c_str());
+}
+
+bool CFlashJournal::Load(const char *filename, std::vector<std::string> *lines)
+{
+	FILE *f;
+	std::string line;
+	int c;
+
+	lines->clear();
+	if ((f = fopen(filename, "r")) == 0)
+		return(false);
+	while ((c = fgetc(f)) != EOF) {
+		if (c == '\n') {
+			lines->push_back(line);
+			line.clear();
+		}
+		else {
+			line += (char)c;
+		}
+	}
+	fclose(f);
+	return(true);
+}
+
+std::string CFlashJournal::SlotList(const std::vector<int> &slots)
+{
+	std::string str;
+	char num[16];
+	int i;
+
+	for (i = 0; i < (int)slots.size(); i++) {
+		snprintf(num, sizeof(num), i ? ",%d" : "%d", slots[i]);
+		str += num;
+	}
+	return(str);
+}
+
+void CFlashJournal::ParseSlots(const char *str, std::vector<int> *slots)
+{
+	char *end;
+
+	slots->clear();
+	while (*str >= '0' && *str <= '9') {
+		slots->push_back((int)strtol(str, &end, 10));
+		str = *end == ',' ? end + 1 : end;
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+
+//Host-side journal of a long flash operation, so it can be finished after a crash or a pulled cable.
+//One line per record, each on the disk before Add returns.  A line cut short by a crash is dropped when
+//the journal is read back.  The file is removed once the operation is finished.
+class CFlashJournal
+{
+protected:
+	FILE *fp;
+	std::string path;
+
+public:
+	CFlashJournal();
+	virtual ~CFlashJournal();
+
+	//start a new journal, replacing any old one
+	bool Create(const char *filename);
+
+	//printf-style record, a newline is added
+	bool Add(const char *fmt, ...);
+
+	//close, finished = the operation completed and the journal is deleted
+	void Close(bool finished);
+
+	//complete lines of a journal left behind, false if there is none
+	static bool Load(const char *filename, std::vector<std::string> *lines);
+
+	//slot lists in records, "1,2,3"
+	static std::string SlotList(const std::vector<int> &slots);
+	static void ParseSlots(const char *str, std::vector<int> *slots);
+};
@@ -0,0 +1,657 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "FlashPlan.h"
+#include "System.h"
+
+CFlashPlan::CFlashPlan(CDevice *d)
+{
+	dev = d;
+	freeSlots = 0;
+	largestRun = 0;
+}
+
+CFlashPlan::~CFlashPlan()
+{
+}
+
+bool CFlashPlan::ReadCatalog()
+{
+	TFlashHeader *h;
+	std::vector<TRun> runs;
+	int i;
+
+	if (dev->FlashUtil->ReadHeaders() == false || (h = dev->FlashUtil->GetHeaders()) == 0) {
+		return(false);
+	}
+	headers.assign(h, h + dev->Slots);
+
+	FindRuns(runs);
+	freeSlots = largestRun = 0;
+	for (i = 0; i < (int)runs.size(); i++) {
+		freeSlots += runs[i].len;
+		if (runs[i].len > largestRun)
+			largestRun = runs[i].len;
+	}
+	return(true);
+}
+
+//slot 0 holds the loader.  deleted images and orphans count as free, writing them just needs the erase IdleStep hasn't done yet
+void CFlashPlan::FindRuns(std::vector<TRun> &runs)
+{
+	int i;
+
+	runs.clear();
+	for (i = 1; i < (int)headers.size(); i++) {
+		if (dev->FlashUtil->IsFree(i) == false)
+			continue;
+		if (runs.size() && runs.back().start + runs.back().len == i) {
+			runs.back().len++;
+		}
+		else {
+			TRun run = { i, 1 };
+
+			runs.push_back(run);
+		}
+	}
+}
+
+bool CFlashPlan::IsBlank(const TRun &run, int len)
+{
+	return(dev->Flash->IsBlank(run.start * SLOTSIZE, len * SLOTSIZE));
+}
+
+bool CFlashPlan::RunBefore(const TRun &a, const TRun &b)
+{
+	if (a.len != b.len)
+		return(a.len < b.len);
+	return(a.len && IsBlank(a, a.len) && !IsBlank(b, b.len));
+}
+
+int CFlashPlan::CountName(const std::string &name)
+{
+	int i, count = 0;
+
+	for (i = 1; i < (int)headers.size(); i++) {
+		if (strncmp(name.c_str(), (char*)headers[i].filename, 240) == 0)
+			count++;
+	}
+	return(count);
+}
+
+const char *short_name(const char *filename)
+{
+	const char *shortName;
+
+	shortName = strrchr(filename, '/');      // ...dir/file.fds
+#ifdef _WIN32
+	if (!shortName)
+		shortName = strrchr(filename, '\\');        // ...dir\file.fds
+	if (!shortName)
+		shortName = strchr(filename, ':');         // C:file.fds
+#endif
+	return(shortName ? shortName + 1 : filename);
+}
+
+int load_sides(const char *filename, std::vector<uint8_t> &data)
+{
+	FILE *fp;
+	long size;
+	int pos = 0, sides;
+
+	data.clear();
+	if ((fp = fopen(filename, "rb")) == 0) {
+		printf("Can't read %s\n", filename);
+		return(0);
+	}
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	data.resize(size > 0 ? size : 0);
+	size = size > 0 ? (long)fread(&data[0], 1, size, fp) : 0;
+	fclose(fp);
+
+	if (size > 0 && data[0] == 'F')
+		pos = 16;      //skip fwNES header
+	size -= (size - pos) % FDSSIZE;  //truncate down to whole disks
+	if (size <= pos) {
+		data.clear();
+		return(0);
+	}
+	data.erase(data.begin() + size, data.end());
+	data.erase(data.begin(), data.begin() + pos);
+	for (sides = 0; sides * FDSSIZE < (int)data.size() && data[sides * FDSSIZE] == 0x01; sides++);
+	data.resize(sides * FDSSIZE);
+	return(sides);
+}
+
+int CFlashPlan::AddFile(const char *filename)
+{
+	TPlanItem item;
+	std::vector<uint8_t> data;
+	std::vector<uint8_t> bin(SLOTSIZE);
+	const char *shortName;
+	int i;
+
+	if ((item.sides = load_sides(filename, data)) == 0) {
+		printf("%s is not a disk image\n", filename);
+		return(-1);
+	}
+
+	//every side has to encode, so a bad one doesn't stop the batch later.  the data isn't kept, Execute
+	//loads it again when it's needed so a big batch isn't held in memory
+	for (i = 0; i < item.sides; i++) {
+		if (fds_to_bin(&bin[0], &data[i * FDSSIZE], SLOTSIZE - FLASHHEADERSIZE) == 0) {
+			printf("%s: side %d can't be stored\n", filename, i + 1);
+			return(-1);
+		}
+	}
+
+	shortName = short_name(filename);
+
+	//another copy of a name already stored gets a number, same as writing the files one at a time would
+	item.filename = filename;
+	item.duplicate = CountName(shortName);
+	for (i = 0; i < (int)items.size(); i++) {
+		if (items[i].state != PLAN_SKIPPED && strcmp(short_name(items[i].filename.c_str()), shortName) == 0)
+			item.duplicate++;
+	}
+	item.name = shortName;
+	if (item.duplicate) {
+		char str[16];
+
+		snprintf(str, sizeof(str), " (%d)", item.duplicate);
+		item.name += str;
+	}
+	item.state = PLAN_WAITING;
+	item.split = false;
+	items.push_back(item);
+	return((int)items.size() - 1);
+}
+
+void CFlashPlan::Skip(int item)
+{
+	items[item].state = PLAN_SKIPPED;
+	items[item].slots.clear();
+}
+
+int CFlashPlan::GetNeededSlots()
+{
+	int i, count = 0;
+
+	for (i = 0; i < (int)items.size(); i++) {
+		if (items[i].state != PLAN_SKIPPED)
+			count += items[i].sides;
+	}
+	return(count);
+}
+
+bool CFlashPlan::Plan(bool split)
+{
+	std::vector<TRun> runs;
+	std::vector<int> order;
+	bool fits = true;
+	int i, r, best, n;
+
+	FindRuns(runs);
+	for (i = 0; i < (int)items.size(); i++) {
+		if (items[i].state == PLAN_SKIPPED)
+			continue;
+		items[i].slots.clear();
+		items[i].split = false;
+		items[i].sectors.assign(items[i].sides, 0);
+		order.push_back(i);
+	}
+
+	//largest first, ties keep the order they were added in
+	for (i = 1; i < (int)order.size(); i++) {
+		for (n = i; n > 0 && items[order[n]].sides > items[order[n - 1]].sides; n--)
+			std::swap(order[n], order[n - 1]);
+	}
+
+	for (i = 0; i < (int)order.size(); i++) {
+		TPlanItem *item = &items[order[i]];
+		bool blank = false, b;
+
+		for (best = -1, r = 0; r < (int)runs.size(); r++) {
+			if (runs[r].len < item->sides)
+				continue;
+			b = IsBlank(runs[r], item->sides);
+			if (best == -1 || runs[r].len < runs[best].len || (runs[r].len == runs[best].len && b && !blank)) {
+				best = r;
+				blank = b;
+			}
+		}
+		if (best == -1) {
+			item->state = PLAN_NOROOM;
+			fits = false;
+			continue;
+		}
+		for (n = 0; n < item->sides; n++)
+			item->slots.push_back(runs[best].start + n);
+		item->state = PLAN_WAITING;
+		runs[best].start += item->sides;
+		runs[best].len -= item->sides;
+	}
+	if (fits || !split)
+		return(fits);
+
+	//what's left goes into the leftover slots, taken from the smallest runs so the big ones stay whole
+	for (i = 1; i < (int)runs.size(); i++) {
+		for (n = i; n > 0 && RunBefore(runs[n], runs[n - 1]); n--)
+			std::swap(runs[n], runs[n - 1]);
+	}
+	fits = true;
+	for (i = 0; i < (int)order.size(); i++) {
+		TPlanItem *item = &items[order[i]];
+		int left = 0;
+
+		if (item->state != PLAN_NOROOM)
+			continue;
+		for (r = 0; r < (int)runs.size(); r++)
+			left += runs[r].len;
+		if (left < item->sides) {
+			fits = false;
+			continue;
+		}
+		for (r = 0; (int)item->slots.size() < item->sides; r++) {
+			for (; runs[r].len && (int)item->slots.size() < item->sides; runs[r].start++, runs[r].len--)
+				item->slots.push_back(runs[r].start);
+		}
+		std::sort(item->slots.begin(), item->slots.end());
+		item->split = true;
+		item->state = PLAN_WAITING;
+	}
+	return(fits);
+}
+
+//Execute's pipeline: workers load and encode whole items into a ring of slot images, ordered by write
+//sequence, and the calling thread takes them in order and only erases and programs.  workers stay at most
+//DEPTH images ahead of the writes.
+typedef struct SPipeline {
+	enum {
+		DEPTH = 8,
+		MAXWORKERS = 4,
+	};
+
+	CFlashPlan *plan;
+	std::vector<int> order;			//items in write order
+	std::vector<int> firstSeq;		//sequence number of each item's first side (in order)
+	std::atomic<int> nextItem;		//next index into order for a worker
+	std::mutex lock;
+	std::condition_variable ready;	//an image was finished
+	std::condition_variable room;	//an image was written
+	int written;					//images written so far = lowest sequence number still in the ring
+	bool abort;
+	uint8_t image[DEPTH][SLOTSIZE];
+	int seq[DEPTH];					//sequence number held by each image, -1 if none
+	bool ok[DEPTH];
+} TPipeline;
+
+//slot image of one side of a loaded item
+static bool encode_side(TPlanItem *item, std::vector<uint8_t> &data, int side, uint8_t *image)
+{
+	return(flash_encode_side(image, &data[side * FDSSIZE], side == 0 ? item->name.c_str() : 0,
+		item->split ? (side + 1 < item->sides ? item->slots[side + 1] : NEXTSLOT_END) : 0));
+}
+
+static void pipeline_worker(void *arg)
+{
+	TPipeline *p = (TPipeline*)arg;
+	std::vector<uint8_t> data;
+	int i, side, s, n;
+
+	while ((i = p->nextItem++) < (int)p->order.size()) {
+		TPlanItem *item = p->plan->GetItem(p->order[i]);
+		bool loaded = load_sides(item->filename.c_str(), data) >= item->sides;
+
+		for (side = 0; side < item->sides; side++) {
+			s = p->firstSeq[i] + side;
+			n = s % TPipeline::DEPTH;
+			{
+				std::unique_lock<std::mutex> hold(p->lock);
+
+				while (!p->abort && s >= p->written + TPipeline::DEPTH)
+					p->room.wait(hold);
+				if (p->abort)
+					return;
+			}
+
+			//the ring entry is this worker's until seq is set
+			p->ok[n] = loaded && encode_side(item, data, side, p->image[n]);
+			{
+				std::lock_guard<std::mutex> hold(p->lock);
+
+				p->seq[n] = s;
+			}
+			p->ready.notify_all();
+		}
+	}
+}
+
+enum {
+	SECTORS = SLOTSIZE / SECTORSIZE,
+};
+
+bool CFlashPlan::WriteSector(int i, int side, int sector, uint8_t *data, CFlashJournal *journal, TPlanCallback cb, void *user)
+{
+	TPlanItem *item = &items[i];
+	int n, done;
+
+	if (item->sectors[side] & (1 << sector))
+		return(true);
+	if (dev->Flash->Program(data, item->slots[side] * SLOTSIZE + sector * SECTORSIZE, SECTORSIZE) == false)
+		return(false);
+	item->sectors[side] |= 1 << sector;
+	if (journal)
+		journal->Add("sector %d %d %d", i, side, sector);
+	if (cb) {
+		for (done = 0, n = 0; n < SECTORS; n++)
+			done += (item->sectors[side] >> n) & 1;
+		cb(user, i, side, done * SECTORSIZE);
+	}
+	return(true);
+}
+
+bool CFlashPlan::WriteSide(int i, int side, uint8_t *image, CFlashJournal *journal, TPlanCallback cb, void *user)
+{
+	TPlanItem *item = &items[i];
+	int sector;
+
+	if (item->sectors[side] == 0 && !dev->Flash->IsBlank(item->slots[side] * SLOTSIZE, SLOTSIZE) &&
+		dev->Flash->EraseSlot(item->slots[side]) == false)
+		return(false);
+	for (sector = 1; sector < SECTORS; sector++) {
+		if (WriteSector(i, side, sector, image + sector * SECTORSIZE, journal, cb, user) == false)
+			return(false);
+	}
+	return(true);
+}
+
+bool CFlashPlan::Execute(TPlanCallback cb, void *user, const char *journalFile)
+{
+	TPipeline *p = new TPipeline;
+	CFlashJournal log, *journal = 0;
+	std::vector<uint8_t> header;
+	std::vector<void*> handles;
+	uint64_t waited = 0, t;
+	bool result = true;
+	int i, n, side, total = 0, workers;
+
+	p->plan = this;
+	for (i = 0; i < (int)items.size(); i++) {
+		if (items[i].state == PLAN_WAITING && items[i].slots.size())
+			p->order.push_back(i);
+	}
+	for (i = 1; i < (int)p->order.size(); i++) {
+		for (n = i; n > 0 && items[p->order[n]].slots[0] < items[p->order[n - 1]].slots[0]; n--)
+			std::swap(p->order[n], p->order[n - 1]);
+	}
+	for (i = 0; i < (int)p->order.size(); i++) {
+		p->firstSeq.push_back(total);
+		total += items[p->order[i]].sides;
+	}
+
+	//the whole batch goes in first, with what's already done if this is a resume
+	if (journalFile) {
+		if (log.Create(journalFile) == false) {
+			delete p;
+			return(false);
+		}
+		journal = &log;
+		journal->Add("write %d", (int)p->order.size());
+		for (i = 0; i < (int)p->order.size(); i++) {
+			TPlanItem *item = &items[p->order[i]];
+
+			journal->Add("item %d %d %s %s", p->order[i], item->split ? 1 : 0, CFlashJournal::SlotList(item->slots).c_str(), item->filename.c_str());
+			journal->Add("name %d %s", p->order[i], item->name.c_str());
+			for (side = 0; side < item->sides; side++) {
+				for (n = 0; n < SECTORS; n++) {
+					if (item->sectors[side] & (1 << n))
+						journal->Add("sector %d %d %d", p->order[i], side, n);
+				}
+			}
+		}
+	}
+	p->nextItem = 0;
+	p->written = 0;
+	p->abort = false;
+	for (i = 0; i < TPipeline::DEPTH; i++)
+		p->seq[i] = -1;
+
+	workers = cpu_count() < TPipeline::MAXWORKERS ? cpu_count() : TPipeline::MAXWORKERS;
+	for (i = 0; i < workers && i < (int)p->order.size(); i++) {
+		void *h = thread_start(pipeline_worker, p);
+
+		if (h)
+			handles.push_back(h);
+	}
+	if (handles.size() == 0 && p->order.size()) {
+		printf("CFlashPlan::Execute: can't start encoder threads\n");
+		delete p;
+		return(false);
+	}
+
+	for (i = 0; i < (int)p->order.size() && result; i++) {
+		TPlanItem *item = &items[p->order[i]];
+
+		item->state = PLAN_WRITING;
+		for (side = 0; side < item->sides; side++) {
+			int s = p->firstSeq[i] + side;
+
+			n = s % TPipeline::DEPTH;
+			t = getMicros();
+			{
+				std::unique_lock<std::mutex> hold(p->lock);
+
+				while (p->seq[n] != s)
+					p->ready.wait(hold);
+			}
+			waited += getMicros() - t;
+
+			if (cb)
+				cb(user, p->order[i], side, 0);
+			header.resize((side + 1) * SECTORSIZE);
+			memcpy(&header[side * SECTORSIZE], p->image[n], SECTORSIZE);
+			if (p->ok[n] == false || WriteSide(p->order[i], side, p->image[n], journal, cb, user) == false) {
+				printf("%s: writing side %d to slot %d failed\n", item->filename.c_str(), side + 1, item->slots[side]);
+				item->state = PLAN_FAILED;
+				result = false;
+				break;
+			}
+			{
+				std::lock_guard<std::mutex> hold(p->lock);
+
+				p->written++;
+			}
+			p->room.notify_all();
+		}
+		//the headers once all the data is in, the first side's (with the name) last.  a second side's header
+		//without the first would be taken as part of the image before it
+		for (side = 1; side <= item->sides && result; side++) {
+			n = side % item->sides;
+			if (WriteSector(p->order[i], n, 0, &header[n * SECTORSIZE], journal, cb, user) == false) {
+				printf("%s: writing the header to slot %d failed\n", item->filename.c_str(), item->slots[n]);
+				item->state = PLAN_FAILED;
+				result = false;
+			}
+		}
+		if (result) {
+			item->state = PLAN_DONE;
+			if (journal)
+				journal->Add("done %d", p->order[i]);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> hold(p->lock);
+
+		p->abort = true;
+	}
+	p->room.notify_all();
+	for (i = 0; i < (int)handles.size(); i++) {
+		thread_join(handles[i]);
+	}
+	printf("CFlashPlan::Execute: %d sides, %d encoder threads, writes waited %d ms for data\n", total, (int)handles.size(), (int)(waited / 1000));
+	delete p;
+	if (journal) {
+		if (result)
+			journal->Add("end");
+		journal->Close(result);
+	}
+	return(result);
+}
+
+bool CFlashPlan::Pending(const char *journal)
+{
+	std::vector<std::string> lines;
+
+	return(CFlashJournal::Load(journal, &lines) && lines.size() && lines[0].compare(0, 6, "write ") == 0);
+}
+
+bool CFlashPlan::CheckSide(int i, int side)
+{
+	TPlanItem *item = &items[i];
+	std::vector<uint8_t> data, want(SLOTSIZE), have(SLOTSIZE);
+	int sector, n;
+
+	if (load_sides(item->filename.c_str(), data) < item->sides || encode_side(item, data, side, &want[0]) == false) {
+		printf("CFlashPlan::Resume: can't load %s again\n", item->filename.c_str());
+		return(false);
+	}
+	if (dev->Flash->Read(&have[0], item->slots[side] * SLOTSIZE, SLOTSIZE) == false)
+		return(false);
+	for (sector = 0; sector < SECTORS; sector++) {
+		uint8_t *w = &want[sector * SECTORSIZE], *h = &have[sector * SECTORSIZE];
+		bool done = (item->sectors[side] & (1 << sector)) != 0;
+
+		//done sectors must match, the rest may only have been programmed part of the way
+		for (n = 0; n < SECTORSIZE; n++) {
+			if (done ? h[n] != w[n] : (h[n] & w[n]) != w[n])
+				break;
+		}
+		if (n < SECTORSIZE) {
+			printf("CFlashPlan::Resume: slot %d sector %d doesn't match the journal, writing the side again\n", item->slots[side], sector);
+			item->sectors[side] = 0;
+			break;
+		}
+	}
+	return(true);
+}
+
+bool CFlashPlan::Load(const char *journal)
+{
+	std::vector<std::string> lines;
+	char slots[1024];
+	int i, k, side, sector, split, pos, count, found = 0;
+
+	items.clear();
+	if (CFlashJournal::Load(journal, &lines) == false || lines.empty() || sscanf(lines[0].c_str(), "write %d", &count) != 1)
+		return(false);
+	for (i = 1; i < (int)lines.size(); i++) {
+		const char *line = lines[i].c_str();
+
+		if (sscanf(line, "item %d %d %1023s %n", &k, &split, slots, &pos) == 3 && k >= 0 && k < 4096) {
+			TPlanItem item;
+
+			found++;
+			item.duplicate = 0;
+			item.sides = 0;
+			item.state = PLAN_SKIPPED;		//placeholders for items that weren't in the batch
+			item.split = false;
+			while ((int)items.size() <= k)
+				items.push_back(item);
+			items[k].filename = line + pos;
+			items[k].split = split != 0;
+			items[k].state = PLAN_WAITING;
+			CFlashJournal::ParseSlots(slots, &items[k].slots);
+			items[k].sides = (int)items[k].slots.size();
+			items[k].sectors.assign(items[k].sides, 0);
+		}
+		else if (sscanf(line, "name %d %n", &k, &pos) == 1 && k < (int)items.size()) {
+			items[k].name = line + pos;
+		}
+		else if (sscanf(line, "sector %d %d %d", &k, &side, &sector) == 3 && k < (int)items.size() && side < items[k].sides && sector < SECTORS) {
+			items[k].sectors[side] |= 1 << sector;
+		}
+		else if (sscanf(line, "done %d", &k) == 1 && k < (int)items.size()) {
+			items[k].state = PLAN_DONE;
+		}
+	}
+
+	return(found == count && ReadCatalog());
+}
+
+bool CFlashPlan::IsNamed(int i)
+{
+	return(strncmp((char*)headers[items[i].slots[0]].filename, items[i].name.c_str(), 240) == 0);
+}
+
+bool CFlashPlan::IsWritten(int i)
+{
+	int side;
+
+	for (side = 0; IsNamed(i) && side < items[i].sides && dev->FlashUtil->CheckSlot(items[i].slots[side]); side++);
+	return(side == items[i].sides);
+}
+
+bool CFlashPlan::Resume(const char *journal, TPlanCallback cb, void *user)
+{
+	int i, side, slot;
+	bool named;
+
+	if (Load(journal) == false)
+		return(false);
+	for (i = 0; i < (int)items.size(); i++) {
+		TPlanItem *item = &items[i];
+
+		if (item->state != PLAN_WAITING)
+			continue;
+
+		//the name is written last, an image that has it is finished unless the header sector was cut off
+		named = IsNamed(i);
+		if (named && IsWritten(i)) {
+			item->state = PLAN_DONE;
+			continue;
+		}
+		for (side = 0; side < item->sides; side++) {
+			//a second side's header written before the cut is ours, even if it was taken as part of the image before it
+			slot = item->slots[side];
+			if (!named && dev->FlashUtil->IsFree(slot) == false && !(side > 0 && (item->sectors[side] & 1) && headers[slot].filename[0] == 0)) {
+				printf("CFlashPlan::Resume: slot %d is in use, the flash was changed since\n", slot);
+				return(false);
+			}
+			if ((item->sectors[side] || named) && CheckSide(i, side) == false)
+				return(false);
+		}
+	}
+	return(Execute(cb, user, journal));
+}
+
+bool CFlashPlan::Discard(const char *journal)
+{
+	int i, side, slot;
+	bool result = true;
+
+	if (Load(journal) == false)
+		return(false);
+	for (i = 0; i < (int)items.size(); i++) {
+		if (items[i].state != PLAN_WAITING || IsWritten(i))
+			continue;
+
+		//the name is there if only the rest of the first side's header sector was cut off
+		for (side = items[i].sides - 1; side >= 0; side--) {
+			slot = items[i].slots[side];
+			if ((side ? headers[slot].filename[0] == 0 : IsNamed(i)) && dev->Flash->EraseSector(slot * SLOTSIZE) == false) {
+				printf("CFlashPlan::Discard: erasing the header of slot %d failed\n", slot);
+				result = false;
+			}
+		}
+	}
+	dev->FlashUtil->ReadHeaders();
+	return(result);
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include "Device.h"
+#include "FlashJournal.h"
+
+//state of a batch item
+enum {
+	PLAN_WAITING = 0,			//slots assigned, not written yet
+	PLAN_NOROOM,				//doesn't fit in the empty slots
+	PLAN_SKIPPED,				//left out of the batch
+	PLAN_WRITING,
+	PLAN_DONE,
+	PLAN_FAILED,
+};
+
+typedef struct SPlanItem {
+	std::string filename;
+	std::string name;			//name for the header, " (n)" added if the name is already stored
+	int duplicate;				//images of the same name on flash or earlier in the batch
+	int sides;
+	int state;					//PLAN_xxx
+	std::vector<int> slots;		//slot of each side
+	bool split;					//slots aren't one run, the sides are chained with nextslot
+	std::vector<uint16_t> sectors;	//sectors of each side's slot programmed so far, bit n = sector n
+} TPlanItem;
+
+//filename without its path
+const char *short_name(const char *filename);
+
+//.fds sides of a file without the fwNES header, returns the number of sides (0 if it isn't a disk image)
+int load_sides(const char *filename, std::vector<uint8_t> &data);
+
+//progress of CFlashPlan::Execute: item and side being written, bytes of the side done
+typedef void (*TPlanCallback)(void *user, int item, int side, uint32_t bytes);
+
+//Writes a batch of disk images to flash.
+//The slot headers are read once and all files are loaded and checked before anything is placed.  Then the
+//whole batch is placed at once, largest images first, each into the smallest run of empty slots it fits in
+//(best fit), so a batch that fits doesn't run out of room halfway because of an early placement.  Of runs
+//that fit as well, one whose slots are already blank (CFlash::IsBlank) is taken, those need no erase.
+//Nothing is erased unless every image has its slots, and the writes go in flash address order.
+//If allowed, images left over are split across the empty slots that remain, smallest runs first, blank
+//ones before others of the same size.
+//While one side is erased and programmed, worker threads load and encode the next ones, so the device
+//doesn't wait for file reads or encoding between sides.
+//A slot is programmed one sector at a time and the header sectors wait until all of the image's data is in,
+//the first side's (with the name) last: an image cut off halfway has no name, and at most a few second
+//sides' headers, which the firmware would take as part of the image before them.  With a journal each
+//sector is recorded once it's programmed, and Resume carries on from there: at most one sector is written
+//again.  Discard erases those headers instead.
+class CFlashPlan
+{
+protected:
+	typedef struct SRun {
+		int start;
+		int len;
+	} TRun;
+
+	CDevice *dev;
+	std::vector<TFlashHeader> headers;
+	std::vector<TPlanItem> items;
+	int freeSlots;
+	int largestRun;
+
+	//empty slots grouped into runs of neighbouring slots
+	void FindRuns(std::vector<TRun> &runs);
+
+	//the first len slots of the run are known to be blank
+	bool IsBlank(const TRun &run, int len);
+
+	//order of the runs the split pass takes slots from: smaller first, blank first if the same size
+	bool RunBefore(const TRun &a, const TRun &b);
+
+	//how many stored images (first sides) have this name
+	int CountName(const std::string &name);
+
+	//erase the side's slot unless it's blank or partly written, then program the sectors not done yet.  the
+	//header sector (0) is left for the end of the image
+	bool WriteSide(int i, int side, uint8_t *image, CFlashJournal *journal, TPlanCallback cb, void *user);
+	bool WriteSector(int i, int side, int sector, uint8_t *data, CFlashJournal *journal, TPlanCallback cb, void *user);
+
+	//after a crash: sectors recorded in the journal must hold their data and the others must still be
+	//programmable, otherwise the side starts over
+	bool CheckSide(int i, int side);
+
+	//items of a journal and the slot headers as they are now
+	bool Load(const char *journal);
+
+	//the first side has the item's name, the last thing written
+	bool IsNamed(int i);
+
+	//named and every side matches its checksum
+	bool IsWritten(int i);
+
+public:
+	CFlashPlan(CDevice *d);
+	virtual ~CFlashPlan();
+
+	//read the slot headers, once per batch
+	bool ReadCatalog();
+
+	//load and check a .fds file, returns the item index or -1 if it can't be used
+	int AddFile(const char *filename);
+
+	//leave an item out of the batch
+	void Skip(int item);
+
+	//give every item that isn't skipped its slots, false if some don't fit (those are PLAN_NOROOM).
+	//split = images that don't fit in a run of empty slots may be spread over any empty slots, chained
+	//with nextslot.  only for firmware that follows nextslot
+	bool Plan(bool split = false);
+
+	//write the planned items, false if a write failed (items after it stay PLAN_WAITING).  journal = file
+	//to record progress in, removed when the batch is done
+	bool Execute(TPlanCallback cb = 0, void *user = 0, const char *journal = 0);
+
+	//finish a batch left in the journal, false if the flash doesn't match it any more
+	bool Resume(const char *journal, TPlanCallback cb = 0, void *user = 0);
+
+	//drop a batch left in the journal instead: the header sectors of unfinished images are erased, the rest
+	//of their slots is free and erased by IdleStep.  the journal is left for the caller to remove
+	bool Discard(const char *journal);
+
+	//true if a batch was cut off
+	static bool Pending(const char *journal);
+
+	int GetItems() { return((int)items.size()); }
+	TPlanItem *GetItem(int i) { return(&items[i]); }
+
+	//slots needed by the items not skipped
+	int GetNeededSlots();
+
+	//empty slots and the longest run of them, from the catalog
+	int GetFreeSlots() { return(freeSlots); }
+	int GetLargestRun() { return(largestRun); }
+};
@@ -0,0 +1,202 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "FlashSync.h"
+#include "FlashUtil.h"
+#include "Parallel.h"
+#include "System.h"
+
+CFlashSync::CFlashSync(CDevice *d)
+{
+	dev = d;
+	noRoom = false;
+}
+
+CFlashSync::~CFlashSync()
+{
+}
+
+typedef struct SDirScan {
+	std::vector<TSyncImage> *files;
+	std::string path;
+} TDirScan;
+
+static void add_file(void *arg, const char *name)
+{
+	TDirScan *scan = (TDirScan*)arg;
+	size_t len = strlen(name);
+	TSyncImage file;
+
+	if (len < 4 || name[len - 4] != '.' || tolower(name[len - 3]) != 'f' || tolower(name[len - 2]) != 'd' || tolower(name[len - 1]) != 's')
+		return;
+	file.name = name;
+	file.filename = scan->path + "/" + name;
+	file.slot = -1;
+	file.action = SYNC_ADD;
+	scan->files->push_back(file);
+}
+
+//checksums and hashes the sides would get in flash
+void CFlashSync::HashFile(void *arg, int i)
+{
+	TSyncImage *file = &((CFlashSync*)arg)->files[i];
+	std::vector<uint8_t> data, slot(SLOTSIZE);
+	int side, sides = load_sides(file->filename.c_str(), data);
+
+	for (side = 0; side < sides; side++) {
+		if (flash_encode_side(&slot[0], &data[side * FDSSIZE], 0) == false)
+			break;
+		file->checksums.push_back(((TFlashHeader*)&slot[0])->checksum);
+		file->hashes.push_back(hash_calc(&slot[FLASHHEADERSIZE], SLOTSIZE - FLASHHEADERSIZE));
+	}
+	if (sides == 0 || side < sides || file->name.size() >= sizeof(((TFlashHeader*)0)->filename)) {
+		printf("CFlashSync: %s can't be stored\n", file->filename.c_str());
+		file->action = SYNC_BAD;
+	}
+}
+
+bool CFlashSync::Match(TSyncImage *image, TSyncImage *file, bool *same, int *readBack)
+{
+	TFlashHeader *headers = dev->FlashUtil->GetHeaders();
+	std::vector<uint8_t> buf;
+	uint64_t hash;
+	int side;
+
+	*same = false;
+	if (image->name != file->name || image->checksums != file->checksums)
+		return(true);
+	for (side = 0; side < (int)image->slots.size(); side++) {
+		if (flash_get_hash(&headers[image->slots[side]], &hash) == false) {
+			buf.resize(SLOTSIZE - FLASHHEADERSIZE);
+			if (dev->Flash->Read(&buf[0], image->slots[side] * SLOTSIZE + FLASHHEADERSIZE, SLOTSIZE - FLASHHEADERSIZE) == false)
+				return(false);
+			hash = hash_calc(&buf[0], SLOTSIZE - FLASHHEADERSIZE);
+			(*readBack)++;
+		}
+		if (hash != file->hashes[side])
+			return(true);
+	}
+	*same = true;
+	return(true);
+}
+
+bool CFlashSync::Scan(const char *dir)
+{
+	TDirScan scan = { &files, dir };
+	TFlashHeader *headers;
+	std::vector<int> slots;
+	int i, n, side, readBack = 0;
+	bool same;
+	uint64_t t = getMicros();
+
+	files.clear();
+	stored.clear();
+	if (dir_list(dir, add_file, &scan) == false) {
+		printf("CFlashSync: can't read %s\n", dir);
+		return(false);
+	}
+	parallel_for((int)files.size(), HashFile, this);
+
+	if (dev->FlashUtil->ReadHeaders() == false || (headers = dev->FlashUtil->GetHeaders()) == 0)
+		return(false);
+	for (i = 1; i < (int)dev->Slots; i++) {
+		TSyncImage image;
+
+		if (dev->FlashUtil->GetSides(i, &slots) == 0)
+			continue;
+		image.name.assign((char*)headers[i].filename, strnlen((char*)headers[i].filename, sizeof(headers[i].filename)));
+		image.slot = i;
+		image.slots = slots;
+		image.action = SYNC_DELETE;
+		for (side = 0; side < (int)slots.size(); side++)
+			image.checksums.push_back(headers[slots[side]].checksum);
+		stored.push_back(image);
+	}
+
+	//each file keeps one matching image, extra copies go
+	for (n = 0; n < (int)files.size(); n++) {
+		for (i = 0; i < (int)stored.size() && files[n].action == SYNC_ADD; i++) {
+			if (stored[i].action != SYNC_DELETE)
+				continue;
+			if (Match(&stored[i], &files[n], &same, &readBack) == false)
+				return(false);
+			if (same) {
+				stored[i].action = SYNC_KEEP;
+				files[n].action = SYNC_KEEP;
+				files[n].slot = stored[i].slot;
+			}
+		}
+	}
+	printf("CFlashSync::Scan: %d files, %d stored images, %d kept, %d sides read back, %d ms\n", (int)files.size(), (int)stored.size(),
+		Count(SYNC_KEEP) / 2, readBack, (int)((getMicros() - t) / 1000));
+	return(true);
+}
+
+int CFlashSync::Count(int action)
+{
+	int i, count = 0;
+
+	for (i = 0; i < (int)files.size(); i++) {
+		if (files[i].action == action)
+			count++;
+	}
+	for (i = 0; i < (int)stored.size(); i++) {
+		if (stored[i].action == action)
+			count++;
+	}
+	return(count);
+}
+
+int CFlashSync::GetNeededSlots()
+{
+	int i, count = 0;
+
+	for (i = 0; i < (int)files.size(); i++) {
+		if (files[i].action == SYNC_ADD)
+			count += (int)files[i].checksums.size();
+	}
+	return(count);
+}
+
+int CFlashSync::GetFreeSlots()
+{
+	int i, count = 0;
+
+	for (i = 1; i < (int)dev->Slots; i++) {
+		if (dev->FlashUtil->IsFree(i))
+			count++;
+	}
+	for (i = 0; i < (int)stored.size(); i++) {
+		if (stored[i].action == SYNC_DELETE && dev->FlashUtil->IsFree(stored[i].slot) == false)
+			count += (int)stored[i].checksums.size();
+	}
+	return(count);
+}
+
+bool CFlashSync::Run(bool split, TPlanCallback cb, void *user, const char *journal)
+{
+	CFlashPlan plan(dev);
+	int i;
+
+	noRoom = false;
+	for (i = 0; i < (int)stored.size(); i++) {
+		if (stored[i].action != SYNC_DELETE || dev->FlashUtil->IsFree(stored[i].slot))
+			continue;
+		if (dev->FlashUtil->Delete(stored[i].slot) == false)
+			return(false);
+	}
+	if (Count(SYNC_ADD) == 0)
+		return(true);
+	if (plan.ReadCatalog() == false)
+		return(false);
+	for (i = 0; i < (int)files.size(); i++) {
+		if (files[i].action == SYNC_ADD && plan.AddFile(files[i].filename.c_str()) < 0)
+			return(false);
+	}
+	if (plan.Plan(split) == false) {
+		noRoom = true;
+		printf("CFlashSync::Run: the new images need %d slots, %d are empty\n", plan.GetNeededSlots(), plan.GetFreeSlots());
+		return(false);
+	}
+	return(plan.Execute(cb, user, journal));
+}
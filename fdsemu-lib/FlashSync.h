@@ -0,0 +1,71 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include "Device.h"
+#include "FlashPlan.h"
+
+//what CFlashSync does with an image
+enum {
+	SYNC_KEEP = 0,				//same name and content on both sides
+	SYNC_ADD,					//file to write
+	SYNC_DELETE,				//stored image with no matching file
+	SYNC_BAD,					//file that isn't a disk image, left alone
+};
+
+typedef struct SSyncImage {
+	std::string name;			//name in the slot header
+	std::string filename;		//local file, empty for stored images
+	int slot;					//first slot of a stored image, -1 for files
+	std::vector<int> slots;		//slot of each side of a stored image
+	std::vector<uint32_t> checksums;	//TFlashHeader::checksum of each side
+	std::vector<uint64_t> hashes;	//hash_calc of each side's disk data, files only
+	int action;					//SYNC_xxx
+} TSyncImage;
+
+//Makes the flash hold exactly the .fds files of a folder.
+//Files are loaded and encoded the way they'd be written, on all processors at once, and the hash each side
+//would get is compared with the headers already read: a stored image with the file's name, number of sides
+//and side hashes is kept.  Everything else stored is deleted (only the header sectors are erased) and the
+//files left are written as one CFlashPlan batch.  The firmware's checksum is too weak to go by (see
+//chksum_calc), so sides written without a hash in their header have their data read back and hashed when
+//everything else matches.  Syncing an unchanged folder written by this program costs a header scan and a
+//pass over the files.
+class CFlashSync
+{
+protected:
+	CDevice *dev;
+	std::vector<TSyncImage> files;
+	std::vector<TSyncImage> stored;
+	bool noRoom;
+
+	static void HashFile(void *arg, int i);
+
+	//stored image holds the file's data, reading back sides whose header has no hash.  false if reading failed
+	bool Match(TSyncImage *image, TSyncImage *file, bool *same, int *readBack);
+
+public:
+	CFlashSync(CDevice *d);
+	virtual ~CFlashSync();
+
+	//hash the folder's files, read the headers and decide what to do, false if either can't be read
+	bool Scan(const char *dir);
+
+	//delete and write.  split = images that don't fit in a run of empty slots may be split across slots.
+	//false if writing failed or didn't fit (deleting is done either way, running again only writes)
+	bool Run(bool split = false, TPlanCallback cb = 0, void *user = 0, const char *journal = 0);
+
+	//the last Run failed because the new images didn't fit
+	bool GetNoRoom() { return(noRoom); }
+
+	int GetFiles() { return((int)files.size()); }
+	TSyncImage *GetFile(int i) { return(&files[i]); }
+	int GetStored() { return((int)stored.size()); }
+	TSyncImage *GetStoredImage(int i) { return(&stored[i]); }
+
+	//images with this action, the slots the adds need and the slots free once the deletes are done
+	int Count(int action);
+	int GetNeededSlots();
+	int GetFreeSlots();
+};
@@ -1,10 +1,76 @@
 #include <stdio.h>
+#include <string.h>
 #include "FlashUtil.h"
 
+uint32_t chksum_calc(uint8_t *buf, int size)
+{
+	uint32_t ret = 0;
+	int i;
+
+	for (i = 0; i < size / 4; i++) {
+		ret ^= buf[i];
+	}
+	return(ret);
+}
+
+uint64_t hash_calc(uint8_t *buf, int size)
+{
+	uint64_t ret = 0xcbf29ce484222325ULL;
+	int i;
+
+	for (i = 0; i < size; i++) {
+		ret = (ret ^ buf[i]) * 0x100000001b3ULL;
+	}
+	return(ret);
+}
+
+bool flash_get_hash(TFlashHeader *h, uint64_t *hash)
+{
+	int i;
+
+	*hash = 0;
+	for (i = 7; i >= 0; i--) {
+		*hash = (*hash << 8) | h->hash[i];
+	}
+	return(*hash != 0 && *hash != 0xFFFFFFFFFFFFFFFFULL);
+}
+
+bool flash_encode_side(uint8_t *slot, uint8_t *fds, const char *name, uint16_t nextslot)
+{
+	uint32_t chksum;
+	uint64_t hash;
+	int i;
+
+	if (fds_to_bin(slot + FLASHHEADERSIZE, fds, SLOTSIZE - FLASHHEADERSIZE) == 0) {
+		return(false);
+	}
+	memset(slot, 0, FLASHHEADERSIZE);
+	chksum = chksum_calc(slot + FLASHHEADERSIZE, SLOTSIZE - FLASHHEADERSIZE);
+	slot[240] = (uint8_t)(chksum >> 0);
+	slot[241] = (uint8_t)(chksum >> 8);
+	slot[242] = (uint8_t)(chksum >> 16);
+	slot[243] = (uint8_t)(chksum >> 24);
+	slot[244] = DEFAULT_LEAD_IN & 0xff;
+	slot[245] = DEFAULT_LEAD_IN / 256;
+	slot[246] = (uint8_t)(nextslot >> 0);
+	slot[247] = (uint8_t)(nextslot >> 8);
+	hash = hash_calc(slot + FLASHHEADERSIZE, SLOTSIZE - FLASHHEADERSIZE);
+	for (i = 0; i < 8; i++) {
+		slot[248 + i] = (uint8_t)(hash >> (i * 8));
+	}
+	if (name) {
+		strncpy((char*)slot, name, 240);
+	}
+	return(true);
+}
+
 CFlashUtil::CFlashUtil(CDevice *d)
 {
 	dev = d;
 	headers = 0;
+	idleSlot = -1;
+	idleSector = 0;
+	idleErase = false;
 }
 
 CFlashUtil::~CFlashUtil()
@@ -15,6 +81,9 @@ bool CFlashUtil::ReadHeaders()
 {
 	uint32_t i;
 
+	//the headers may be read again because something was written, IdleStep has to look at its slot again
+	idleSlot = -1;
+
 	//if headers already has data, free it
 	if (headers) {
 		delete[] headers;
@@ -42,9 +111,255 @@ bool CFlashUtil::ReadHeaders()
 
 	}
 
+	FollowChains();
+	return(true);
+}
+
+//split images are followed first: one of their sides can be right after the last side of an image that
+//isn't split, and mustn't be taken as part of it
+void CFlashUtil::FollowChains()
+{
+	std::vector<bool> owned(dev->Slots, false);
+	int i, cur, nx, n = (int)dev->Slots;
+
+	next.assign(n, -1);
+	for (i = 0; i < n; i++) {
+		if (headers[i].filename[0] == 0 || headers[i].filename[0] == 0xFF || headers[i].nextslot == 0)
+			continue;
+		for (cur = i; headers[cur].nextslot != 0 && headers[cur].nextslot != NEXTSLOT_END; cur = nx) {
+			nx = headers[cur].nextslot;
+			if (nx >= n || owned[nx] || headers[nx].filename[0] != 0) {
+				printf("Slot %d: broken side chain to slot %d\n", cur, nx);
+				break;
+			}
+			next[cur] = nx;
+			owned[nx] = true;
+		}
+	}
+	for (i = 0; i < n; i++) {
+		if (headers[i].filename[0] == 0 || headers[i].filename[0] == 0xFF || headers[i].nextslot != 0)
+			continue;
+		for (cur = i; cur + 1 < n && headers[cur + 1].filename[0] == 0 && headers[cur + 1].nextslot == 0 &&
+			!owned[cur + 1]; cur++) {
+			next[cur] = cur + 1;
+			owned[cur + 1] = true;
+		}
+	}
+}
+
+int CFlashUtil::GetSides(int slot, std::vector<int> *slots)
+{
+	slots->clear();
+	if (GetHeaders() == 0 || slot < 0 || slot >= (int)dev->Slots) {
+		return(0);
+	}
+	if (headers[slot].filename[0] == 0 || headers[slot].filename[0] == 0xFF) {
+		return(0);
+	}
+	for (; slot != -1; slot = next[slot]) {
+		slots->push_back(slot);
+	}
+	return((int)slots->size());
+}
+
+bool CFlashUtil::IsOrphan(int slot)
+{
+	int i;
+
+	if (headers[slot].filename[0] != 0)
+		return(false);
+	for (i = 0; i < (int)next.size(); i++) {
+		if (next[i] == slot)
+			return(false);
+	}
+	return(true);
+}
+
+bool CFlashUtil::IsFree(int slot)
+{
+	if (GetHeaders() == 0 || slot <= 0 || slot >= (int)dev->Slots) {
+		return(false);
+	}
+	return(headers[slot].filename[0] == 0xFF || IsOrphan(slot));
+}
+
+bool CFlashUtil::SetHeader(int slot, TFlashHeader *h)
+{
+	if (dev->Flash->Update((uint8_t*)h, slot * SLOTSIZE, sizeof(TFlashHeader)) == false) {
+		printf("CFlashUtil: updating the header of slot %d failed\n", slot);
+		ReadHeaders();
+		return(false);
+	}
+	headers[slot] = *h;
+	return(true);
+}
+
+bool CFlashUtil::Delete(int slot)
+{
+	std::vector<int> slots;
+	int i;
+
+	if (GetSides(slot, &slots) == 0) {
+		printf("CFlashUtil::Delete: slot %d doesn't start a disk image\n", slot);
+		return(false);
+	}
+	for (i = (int)slots.size() - 1; i >= 0; i--) {
+		if (dev->Flash->EraseSector(slots[i] * SLOTSIZE) == false) {
+			printf("CFlashUtil::Delete: erasing the header of slot %d failed\n", slots[i]);
+			ReadHeaders();
+			return(false);
+		}
+		memset(&headers[slots[i]], 0xFF, sizeof(TFlashHeader));
+	}
+	FollowChains();
+	return(true);
+}
+
+bool CFlashUtil::Rename(int slot, const char *name)
+{
+	std::vector<int> slots;
+	TFlashHeader h;
+
+	if (GetSides(slot, &slots) == 0 || name[0] == 0 || (uint8_t)name[0] == 0xFF || strlen(name) >= sizeof(h.filename)) {
+		return(false);
+	}
+	h = headers[slot];
+	memset(h.filename, 0, sizeof(h.filename));
+	strncpy((char*)h.filename, name, sizeof(h.filename) - 1);
+	return(SetHeader(slot, &h));
+}
+
+bool CFlashUtil::SetLeadIn(int slot, uint16_t leadin)
+{
+	TFlashHeader h;
+
+	if (GetHeaders() == 0 || slot < 0 || slot >= (int)dev->Slots || IsFree(slot) || leadin == 0) {
+		return(false);
+	}
+	h = headers[slot];
+	h.leadin = leadin;
+	return(SetHeader(slot, &h));
+}
+
+bool CFlashUtil::SetNextSlot(int slot, uint16_t nextslot)
+{
+	TFlashHeader h;
+
+	if (GetHeaders() == 0 || slot < 0 || slot >= (int)dev->Slots || IsFree(slot)) {
+		return(false);
+	}
+	h = headers[slot];
+	h.nextslot = nextslot;
+	if (SetHeader(slot, &h) == false) {
+		return(false);
+	}
+	FollowChains();
 	return(true);
 }
 
+int CFlashUtil::GetIdleWork()
+{
+	int i, count = 0;
+
+	if (GetHeaders() == 0) {
+		return(0);
+	}
+	for (i = 1; i < (int)dev->Slots; i++) {
+		if (IsFree(i) && !dev->Flash->IsBlank(i * SLOTSIZE, SLOTSIZE))
+			count++;
+	}
+	return(count);
+}
+
+bool CFlashUtil::IdleStep()
+{
+	enum { SECTORS = SLOTSIZE / SECTORSIZE };
+
+	uint8_t buf[SECTORSIZE];
+	int i;
+
+	if (GetHeaders() == 0) {
+		return(false);
+	}
+
+	//orphans first, they need erasing anyway.  the header is read again before starting, the list may be old
+	if (idleSlot == -1) {
+		for (i = 1; i < (int)dev->Slots && idleSlot == -1; i++) {
+			if (headers[i].filename[0] != 0xFF && IsFree(i))
+				idleSlot = i;
+		}
+		for (i = 1; i < (int)dev->Slots && idleSlot == -1; i++) {
+			if (headers[i].filename[0] == 0xFF && !dev->Flash->IsBlank(i * SLOTSIZE, SLOTSIZE))
+				idleSlot = i;
+		}
+		if (idleSlot == -1) {
+			return(false);
+		}
+		i = headers[idleSlot].filename[0];
+		if (dev->Flash->Read((uint8_t*)&headers[idleSlot], idleSlot * SLOTSIZE, FLASHHEADERSIZE) == false) {
+			idleSlot = -1;
+			return(false);
+		}
+		if ((i == 0xFF) != (headers[idleSlot].filename[0] == 0xFF) || (i != 0xFF && headers[idleSlot].filename[0] != 0)) {
+			printf("CFlashUtil::IdleStep: slot %d was changed, reading headers again\n", idleSlot);
+			return(ReadHeaders());
+		}
+		idleErase = i != 0xFF;
+		idleSector = 0;
+	}
+
+	//header sector first, from then on the slot is empty and if this is cut off the check of empty slots
+	//finds the rest
+	if (idleErase) {
+		if (dev->Flash->EraseSector(idleSlot * SLOTSIZE + idleSector * SECTORSIZE) == false) {
+			printf("CFlashUtil::IdleStep: erasing slot %d failed\n", idleSlot);
+			idleSlot = -1;
+			return(false);
+		}
+		if (idleSector == 0) {
+			memset(&headers[idleSlot], 0xFF, sizeof(TFlashHeader));
+			FollowChains();
+		}
+		if (++idleSector < SECTORS) {
+			return(true);
+		}
+	}
+	else {
+		if (dev->Flash->Read(buf, idleSlot * SLOTSIZE + idleSector * SECTORSIZE, SECTORSIZE) == false) {
+			idleSlot = -1;
+			return(false);
+		}
+		for (i = 0; i < SECTORSIZE && buf[i] == 0xFF; i++);
+		//the sectors before this one were blank, erase from here
+		if (i < SECTORSIZE) {
+			printf("CFlashUtil::IdleStep: empty slot %d isn't blank, erasing it\n", idleSlot);
+			idleErase = true;
+			return(true);
+		}
+		if (++idleSector < SECTORS) {
+			return(true);
+		}
+	}
+	dev->Flash->SetBlank(idleSlot);
+	idleSlot = -1;
+	return(true);
+}
+
+bool CFlashUtil::CheckSlot(int slot)
+{
+	std::vector<uint8_t> buf(SLOTSIZE);
+	TFlashHeader *h = (TFlashHeader*)&buf[0];
+	uint64_t hash;
+
+	if (dev->Flash->Read(&buf[0], slot * SLOTSIZE, SLOTSIZE) == false) {
+		return(false);
+	}
+	if (h->checksum != chksum_calc(&buf[FLASHHEADERSIZE], SLOTSIZE - FLASHHEADERSIZE)) {
+		return(false);
+	}
+	return(flash_get_hash(h, &hash) == false || hash == hash_calc(&buf[FLASHHEADERSIZE], SLOTSIZE - FLASHHEADERSIZE));
+}
+
 TFlashHeader *CFlashUtil::GetHeaders()
 {
 	if (headers == 0 && ReadHeaders() == false) {
@@ -1,22 +1,55 @@
 #pragma once
 
 #include <stdint.h>
+#include <vector>
 #include "Device.h"
 
+//TFlashHeader::nextslot: 0 = the next side is in the next slot (images written as one run of slots),
+//NEXTSLOT_END = last side of an image split across slots, anything else is the slot of the next side
+enum {
+	NEXTSLOT_END = 0xFFFF,
+};
+
 typedef struct SFlashHeader {
 	uint8_t filename[240];		//filename of disk in flash (if first slot)
 	uint32_t checksum;			//xor checksum of disk data
 	uint16_t leadin;				//leadin size of disk
 	uint16_t nextslot;			//slot of next disk side of the disk image
-	uint8_t reserved[8];			//reserved for future expansion
+	uint8_t hash[8];				//hash_calc of disk data, little endian.  not used by the firmware, all 0 in images written without it
 } TFlashHeader;
 
+//xor checksum stored in TFlashHeader::checksum, the one the firmware uses.  it's only 8 bits over the first
+//quarter of the data, so it's no proof two sides are the same
+uint32_t chksum_calc(uint8_t *buf, int size);
+
+//64-bit FNV-1a of all the data, stored in TFlashHeader::hash
+uint64_t hash_calc(uint8_t *buf, int size);
+
+//TFlashHeader::hash, false if the header has none
+bool flash_get_hash(TFlashHeader *h, uint64_t *hash);
+
+//one .fds side -> slot image (header + disk data), name is stored in the header of a game's first side only (0 otherwise)
+bool flash_encode_side(uint8_t *slot, uint8_t *fds, const char *name, uint16_t nextslot = 0);
+
 class CFlashUtil
 {
 protected:
 	CDevice *dev;
 	TFlashHeader *headers;
 	int numslots;
+	std::vector<int> next;		//slot of the next side of the same image, -1 after the last side
+	int idleSlot;				//slot IdleStep is working on, -1 = none
+	int idleSector;
+	bool idleErase;				//erasing it, or checking that it's blank
+
+	//work out which slots belong together
+	void FollowChains();
+
+	//second side that no image leads to (left by an interrupted delete or write)
+	bool IsOrphan(int slot);
+
+	//change a header in place through CFlash::Update, the copy in memory too
+	bool SetHeader(int slot, TFlashHeader *h);
 
 public:
 	CFlashUtil(CDevice *d);
@@ -27,4 +60,36 @@ public:
 
 	//return array of flash headers
 	TFlashHeader *GetHeaders();
+
+	//slots holding the sides of the image whose first side is in slot, in side order.  returns the number
+	//of sides, 0 if slot doesn't start an image
+	int GetSides(int slot, std::vector<int> *slots);
+
+	//slot can take a new side: empty or an orphan.  an empty slot isn't necessarily blank (a deleted image
+	//only has its header sectors erased), the rest is erased when it's written or by IdleStep
+	bool IsFree(int slot);
+
+	//delete the image starting in slot.  only the header sector of each side is erased, last side first so
+	//what's left at any point is still the front of the image and never a second side without its first
+	//(which the firmware would take as part of the image before it).  the rest is left to IdleStep
+	bool Delete(int slot);
+
+	//header edits, only the header sector is rewritten.  Rename takes the first side of an image, the
+	//others any side that isn't free
+	bool Rename(int slot, const char *name);
+	bool SetLeadIn(int slot, uint16_t leadin);
+	bool SetNextSlot(int slot, uint16_t nextslot);
+
+	//one step of background work, for when nothing else uses the device: erase a sector of an orphan, or
+	//check a sector of an empty slot not known to be blank yet (erasing it if it isn't).  orphans lose their
+	//header sector first.  every finished slot is blank and writing it needs no erase.  false when there's
+	//nothing left to do
+	bool IdleStep();
+
+	//slots waiting for IdleStep
+	int GetIdleWork();
+
+	//true if the disk data in the slot matches the checksum and hash in its header.  a side that was cut off
+	//while being written (by a client that writes the header first) doesn't
+	bool CheckSlot(int slot);
 };
@@ -0,0 +1,253 @@
+#include <string.h>
+#include <limits.h>
+#include <algorithm>
+#include "GapIndex.h"
+
+//true if any byte in v is zero
+#define HASZERO(v) (((v) - 0x0101010101010101ULL) & ~(v) & 0x8080808080808080ULL)
+
+static bool startLess(const TZeroRun &a, const TZeroRun &b)
+{
+	return(a.start < b.start);
+}
+
+static bool endLess(const TZeroRun &a, const TZeroRun &b)
+{
+	return(a.end < b.end);
+}
+
+CGapIndex::CGapIndex()
+{
+	raw = 0;
+	rawSize = 0;
+	leaves = 0;
+}
+
+CGapIndex::~CGapIndex()
+{
+}
+
+void CGapIndex::Build(const uint8_t *buf, int size)
+{
+	int i, j, start, end;
+	uint64_t w;
+
+	raw = buf;
+	rawSize = size;
+	runs.clear();
+	cuts.clear();
+	glitches.clear();
+	marks.clear();
+
+	//a run of MINRUN (16) zeros always covers a whole 8 symbol word, so only zero words need a closer look.
+	//other words are only checked for glitches.
+	for (i = 0; i + 8 <= size;) {
+		memcpy(&w, raw + i, 8);
+		if (w != 0) {
+			if (HASZERO(w ^ 0x0303030303030303ULL)) {
+				for (j = i; j < i + 8; j++) {
+					if (raw[j] == 3)
+						glitches.push_back(j);
+				}
+			}
+			i += 8;
+			continue;
+		}
+
+		//find both ends of the run
+		for (start = i; start > 0 && raw[start - 1] == 0; start--);
+		for (end = i + 8; end + 8 <= size; end += 8) {
+			memcpy(&w, raw + end, 8);
+			if (w != 0)
+				break;
+		}
+		while (end < size && raw[end] == 0)
+			end++;
+		if (end - start >= MINRUN) {
+			TZeroRun run = { start, end, (uint8_t)(end < size ? raw[end] : 0) };
+			runs.push_back(run);
+		}
+		i = end;
+	}
+
+	//leftover symbols (too short to start a run)
+	for (; i < size; i++) {
+		if (raw[i] == 3)
+			glitches.push_back(i);
+	}
+	BuildTree();
+}
+
+int CGapIndex::GapLength(int i)
+{
+	return(runs[i].term == 1 ? runs[i].end - runs[i].start : 0);
+}
+
+void CGapIndex::BuildTree()
+{
+	int i;
+
+	for (leaves = 1; leaves < (int)runs.size(); leaves <<= 1);
+	tree.assign(leaves * 2, 0);
+	for (i = 0; i < (int)runs.size(); i++) {
+		tree[leaves + i] = GapLength(i);
+	}
+	for (i = leaves - 1; i > 0; i--) {
+		tree[i] = std::max(tree[i * 2], tree[i * 2 + 1]);
+	}
+}
+
+void CGapIndex::UpdateTree(int i)
+{
+	int node = leaves + i;
+
+	tree[node] = GapLength(i);
+	for (node >>= 1; node > 0; node >>= 1) {
+		tree[node] = std::max(tree[node * 2], tree[node * 2 + 1]);
+	}
+}
+
+//first leaf index >= from in [lo,hi) with a gap of at least minLen
+int CGapIndex::Descend(int node, int lo, int hi, int from, int minLen)
+{
+	int mid, ret;
+
+	if (hi <= from || tree[node] < minLen)
+		return(-1);
+	if (hi - lo == 1)
+		return(lo);
+	mid = (lo + hi) / 2;
+	ret = Descend(node * 2, lo, mid, from, minLen);
+	if (ret < 0)
+		ret = Descend(node * 2 + 1, mid, hi, from, minLen);
+	return(ret);
+}
+
+//first run starting after pos, the one before it is the only candidate
+static int find_run(std::vector<TZeroRun> &runs, int pos)
+{
+	TZeroRun key = { pos, pos, 0 };
+	std::vector<TZeroRun>::iterator it;
+
+	it = std::upper_bound(runs.begin(), runs.end(), key, startLess);
+	if (it == runs.begin())
+		return(-1);
+	--it;
+	return(pos < it->end ? (int)(it - runs.begin()) : -1);
+}
+
+int CGapIndex::FindRun(int pos)
+{
+	return(find_run(runs, pos));
+}
+
+int CGapIndex::FindCut(int pos)
+{
+	return(find_run(cuts, pos));
+}
+
+uint8_t CGapIndex::Symbol(int pos)
+{
+	return(std::binary_search(marks.begin(), marks.end(), pos) ? 3 : raw[pos]);
+}
+
+int CGapIndex::NextMark(int pos)
+{
+	std::vector<int>::iterator it = std::lower_bound(marks.begin(), marks.end(), pos);
+
+	return(it == marks.end() ? INT_MAX : *it);
+}
+
+int CGapIndex::RunStart(int end)
+{
+	int i = end - 1;
+	int r;
+
+	if (i < 0 || Symbol(i) != 0)
+		return(end);
+	if ((r = FindRun(i)) >= 0)
+		return(runs[r].start);
+	if ((r = FindCut(i)) >= 0)
+		return(cuts[r].start);
+
+	//not indexed, so it's shorter than MINRUN
+	while (i >= 0 && Symbol(i) == 0)
+		i--;
+	return(i + 1);
+}
+
+int CGapIndex::NextGapEnd(int pos, int minLen)
+{
+	TZeroRun key = { 0, pos, 0 };
+	std::vector<TZeroRun>::iterator it;
+	int i;
+
+	//first run ending at or after pos, it may be clipped by pos
+	it = std::lower_bound(runs.begin(), runs.end(), key, endLess);
+	if (it == runs.end())
+		return(-1);
+	if (it->term == 1 && it->end - std::max(it->start, pos) >= minLen)
+		return(it->end);
+
+	//later runs are whole
+	i = Descend(1, 0, leaves, (int)(it - runs.begin()) + 1, minLen);
+	return(i < 0 ? -1 : runs[i].end);
+}
+
+//marks count as glitches too
+int CGapIndex::LastGlitch(int pos)
+{
+	std::vector<int>::iterator it = std::lower_bound(glitches.begin(), glitches.end(), pos);
+	std::vector<int>::iterator mark = std::lower_bound(marks.begin(), marks.end(), pos);
+	int last = it == glitches.begin() ? -1 : *(it - 1);
+
+	if (mark != marks.begin() && *(mark - 1) > last)
+		last = *(mark - 1);
+	return(last);
+}
+
+//runs stay where they are, so the tree only needs the one leaf updated.  only the marks and the cuts (as
+//many as there are marks) are inserted into
+void CGapIndex::Mark(int pos)
+{
+	std::vector<int>::iterator it;
+	uint8_t old;
+	int r;
+
+	if (pos < 0 || pos >= rawSize || (old = Symbol(pos)) == 3)
+		return;
+	it = std::lower_bound(marks.begin(), marks.end(), pos);
+	marks.insert(it, pos);
+
+	//a run ending here now ends in a glitch
+	if (old != 0) {
+		if ((r = FindRun(pos - 1)) >= 0 && runs[r].end == pos) {
+			runs[r].term = 3;
+			UpdateTree(r);
+		}
+		return;
+	}
+
+	//the run keeps what's after the mark, what's before it is cut off
+	if ((r = FindRun(pos)) >= 0) {
+		if (pos > runs[r].start) {
+			TZeroRun head = { runs[r].start, pos, 3 };
+
+			cuts.insert(std::upper_bound(cuts.begin(), cuts.end(), head, startLess), head);
+		}
+		runs[r].start = pos + 1;
+		UpdateTree(r);
+		return;
+	}
+
+	//a mark in a cut splits it
+	if ((r = FindCut(pos)) >= 0) {
+		TZeroRun tail = { pos + 1, cuts[r].end, 3 };
+
+		cuts[r].end = pos;
+		if (cuts[r].start == cuts[r].end)
+			cuts[r] = tail;
+		else if (tail.start < tail.end)
+			cuts.insert(cuts.begin() + r + 1, tail);
+	}
+}
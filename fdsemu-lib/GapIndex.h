@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+//run of zero symbols in a raw03 capture
+typedef struct SZeroRun {
+	int start;				//first zero of the run
+	int end;				//one past the last zero
+	uint8_t term;			//symbol that ended the run (0 = end of capture)
+} TZeroRun;
+
+//Run-length index of a raw03 capture (zero runs, glitches, gap ends), built in one pass.
+//Only zero runs of at least MINRUN symbols are indexed, so length queries must ask for more than that.
+//The capture itself is never written, glitches marked by the decoder are kept here as an overlay.
+class CGapIndex
+{
+public:
+	enum {
+		MINRUN = 16,
+	};
+
+protected:
+	const uint8_t *raw;
+	int rawSize;
+	std::vector<TZeroRun> runs;		//sorted by start, never overlapping.  a mark only shortens them (they may end up empty)
+	std::vector<TZeroRun> cuts;		//the parts of runs before a mark, they end in it so they're never gaps.  sorted
+	std::vector<int> glitches;		//positions of '3' symbols in the capture, sorted
+	std::vector<int> marks;			//positions overwritten with a glitch, sorted
+	std::vector<int> tree;			//max-tree of gap lengths (runs ending with a 1)
+	int leaves;
+
+	int GapLength(int i);
+	void BuildTree();
+	void UpdateTree(int i);
+	int Descend(int node, int lo, int hi, int from, int minLen);
+
+	//index of the run (or cut) containing pos, -1 if it isn't in one
+	int FindRun(int pos);
+	int FindCut(int pos);
+
+public:
+	CGapIndex();
+	virtual ~CGapIndex();
+
+	//scan the capture and build the index
+	void Build(const uint8_t *buf, int size);
+
+	//symbol at pos with marks applied
+	uint8_t Symbol(int pos);
+
+	//first mark at or after pos, INT_MAX if none
+	int NextMark(int pos);
+
+	//start of the zero run ending just before 'end' (returns end if raw[end-1] isn't zero)
+	int RunStart(int end);
+
+	//first q >= pos where raw[q] == 1 follows at least minLen zeros counted from pos, -1 if none
+	int NextGapEnd(int pos, int minLen);
+
+	//last glitch before pos, -1 if none
+	int LastGlitch(int pos);
+
+	//mark pos as a glitch (3) and update the index to match, O(log n) in the runs
+	void Mark(int pos);
+
+	const std::vector<TZeroRun> &GetRuns() { return(runs); }
+	const std::vector<int> &GetMarks() { return(marks); }
+};
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Hypothesis.h"
+#include "Parallel.h"
+
+//a drive this far off nominal speed still decodes with scaled thresholds
+enum { SPEED_STEP = 5 };		//percent
+
+static void scale_quantizer(TQuantizer *q, int percent) {
+	int i;
+
+	for (i = 0; i < 3; i++)
+		q->center[i] = q->center[i] * percent / 100;
+	for (i = 0; i < 4; i++)
+		q->limit[i] = q->limit[i] * percent / 100 > 255 ? 255 : q->limit[i] * percent / 100;
+}
+
+void hypothesis_defaults(std::vector<THypothesis> *list, uint32_t *hist) {
+	static const char *glitchNames[] = { "0", "1", "skip" };
+	TQuantizer quant[6];
+	const char *quantNames[6];
+	int count = 0, i, j;
+	THypothesis h;
+
+	quantizer_default(&quant[count]);
+	quantNames[count++] = "nominal";
+	quantizer_default(&quant[count]);
+	quant[count].track = true;
+	quantNames[count++] = "nominal+track";
+	quantizer_default(&quant[count]);
+	scale_quantizer(&quant[count], 100 - SPEED_STEP);
+	quantNames[count++] = "fast";
+	quantizer_default(&quant[count]);
+	scale_quantizer(&quant[count], 100 + SPEED_STEP);
+	quantNames[count++] = "slow";
+	if (quantizer_from_histogram(&quant[count], hist)) {
+		quantNames[count++] = "fitted";
+		quant[count] = quant[count - 1];
+		quant[count].track = true;
+		quantNames[count++] = "fitted+track";
+	}
+
+	list->clear();
+	for (i = 0; i < count; i++) {
+		for (j = GLITCH_ZERO; j <= GLITCH_SKIP; j++) {
+			h.quant = quant[i];
+			h.glitch = j;
+			snprintf(h.name, sizeof(h.name), "%s, glitch %s", quantNames[i], glitchNames[j]);
+			list->push_back(h);
+		}
+	}
+}
+
+typedef struct SHypothesisJob {
+	THypothesis *hypothesis;
+	TDecoderContext ctx;
+	std::vector<TBlockInfo> blocks;
+	uint8_t *bin;
+	int binSize;
+} THypothesisJob;
+
+typedef struct SHypothesisWork {
+	std::vector<THypothesisJob> jobs;
+	uint8_t *raw;
+	int rawSize;
+} THypothesisWork;
+
+//each job has its own context and raw03 copy, the capture itself is only read
+static void decode_job(void *arg, int i) {
+	THypothesisWork *work = (THypothesisWork*)arg;
+	THypothesisJob *job = &work->jobs[i];
+	uint8_t *raw03 = (uint8_t*)malloc(work->rawSize);
+
+	memcpy(raw03, work->raw, work->rawSize);
+	raw_to_raw03_q(&job->hypothesis->quant, raw03, work->rawSize);
+	job->ctx.blocks = &job->blocks[0];
+	job->ctx.maxBlocks = (int)job->blocks.size();
+	raw03_to_bin(&job->ctx, raw03, work->rawSize, &job->bin, &job->binSize);
+	free(raw03);
+}
+
+void hypothesis_decode(CMultiRead *multi, TDecoderContext *ctx, std::vector<THypothesis> &list, int first,
+	uint8_t *raw, int rawSize, TRawRange *lost, int lostCount, const char *prefix) {
+	THypothesisWork work;
+	char label[80];
+	int i, count;
+
+	if (first >= (int)list.size())
+		return;
+	work.raw = raw;
+	work.rawSize = rawSize;
+	work.jobs.resize(list.size() - first);
+	for (i = 0; i < (int)work.jobs.size(); i++) {
+		THypothesisJob *job = &work.jobs[i];
+
+		job->hypothesis = &list[first + i];
+		decoder_init(&job->ctx, 0, 0);
+		job->ctx.crcFix = ctx->crcFix;
+		job->ctx.glitch = job->hypothesis->glitch;
+		job->ctx.lost = lost;
+		job->ctx.lostCount = lostCount;
+		job->blocks.resize(CMultiRead::MAXBLOCKS);
+	}
+	parallel_for((int)work.jobs.size(), decode_job, &work);
+
+	for (i = 0; i < (int)work.jobs.size(); i++) {
+		THypothesisJob *job = &work.jobs[i];
+
+		count = job->ctx.blockCount < job->ctx.maxBlocks ? job->ctx.blockCount : job->ctx.maxBlocks;
+		snprintf(label, sizeof(label), "%s%s", prefix, job->hypothesis->name);
+		multi->AddDecoded(job->bin, job->binSize, &job->blocks[0], count, label);
+	}
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "Codec.h"
+#include "MultiRead.h"
+
+//one way of decoding a capture
+typedef struct SHypothesis {
+	TQuantizer quant;
+	int glitch;					//GLITCH_xxx
+	char name[48];
+} THypothesis;
+
+//Standard set for a marginal capture: nominal, off speed and fitted (from hist, if it fits) thresholds, with and
+//without tracking, times each glitch policy.  The first entry is the plain raw_to_raw03 + raw03_to_bin decode.
+void hypothesis_defaults(std::vector<THypothesis> *list, uint32_t *hist);
+
+//Decode one capture (adapter data, not changed) under every hypothesis from 'first' on, concurrently, and add
+//the results to multi labelled prefix + hypothesis name.  ctx supplies the CRC repair setting.
+void hypothesis_decode(CMultiRead *multi, TDecoderContext *ctx, std::vector<THypothesis> &list, int first,
+	uint8_t *raw, int rawSize, TRawRange *lost, int lostCount, const char *prefix = "");
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "MultiRead.h"
+#include "Parallel.h"
+
+CMultiRead::CMultiRead(TDecoderContext *c)
+{
+	ctx = c;
+	base = -1;
+	result = 0;
+}
+
+CMultiRead::~CMultiRead()
+{
+	for (int i = 0; i < (int)reads.size(); i++) {
+		free(reads[i].bin);
+	}
+	free(result);
+}
+
+void CMultiRead::Add(uint8_t *raw03, int size, TRawRange *lost, int lostCount, const char *label)
+{
+	std::vector<TBlockInfo> blocks(MAXBLOCKS);
+	TDecoderMessage message = ctx->message;
+	uint8_t *bin;
+	int binSize;
+
+	//the block listing was already shown for the first read, don't repeat it for every read
+	ctx->message = 0;
+	ctx->blocks = &blocks[0];
+	ctx->maxBlocks = MAXBLOCKS;
+	ctx->lost = lost;
+	ctx->lostCount = lostCount;
+	raw03_to_bin(ctx, raw03, size, &bin, &binSize);
+	ctx->blocks = 0;
+	ctx->maxBlocks = 0;
+	ctx->lost = 0;
+	ctx->lostCount = 0;
+	ctx->message = message;
+	AddDecoded(bin, binSize, &blocks[0], ctx->blockCount < MAXBLOCKS ? ctx->blockCount : MAXBLOCKS, label);
+}
+
+void CMultiRead::AddDecoded(uint8_t *bin, int binSize, TBlockInfo *blocks, int count, const char *label)
+{
+	TRead read;
+	char str[24];
+	int i;
+
+	read.bin = bin;
+	read.binSize = binSize;
+	read.blocks.assign(blocks, blocks + count);
+	if (label == 0) {
+		snprintf(str, sizeof(str), "read %d", (int)reads.size() + 1);
+		label = str;
+	}
+	read.label = label;
+	read.first = read.blocks.size() ? read.blocks[0].rawStart : 0;
+	read.good = 0;
+	for (i = 0; i < (int)read.blocks.size(); i++) {
+		if (read.blocks[i].crcOk && !read.blocks[i].suspect && !read.blocks[i].corrected)
+			read.good++;
+	}
+	reads.push_back(read);
+}
+
+//same block in another read: same type and size, about the same distance from the first block
+int CMultiRead::Match(int read, TBlockInfo *block)
+{
+	TRead *r = &reads[read];
+	int pos = block->rawStart - reads[base].first;
+	int tolerance = 0x400 + pos / 32;		//drive speed varies a few percent
+	int best = -1, bestDist = tolerance + 1;
+	int i, dist;
+
+	for (i = 0; i < (int)r->blocks.size(); i++) {
+		TBlockInfo *b = &r->blocks[i];
+
+		if (b->type != block->type || b->len != block->len)
+			continue;
+		dist = abs((b->rawStart - r->first) - pos);
+		if (dist < bestDist) {
+			bestDist = dist;
+			best = i;
+		}
+	}
+	return(best);
+}
+
+void CMultiRead::VoteBlock(void *arg, int i)
+{
+	((CMultiRead*)arg)->Vote(i);
+}
+
+void CMultiRead::Vote(int i)
+{
+	TBlockInfo *block = &reads[base].blocks[i];
+	std::vector<uint8_t*> votes;
+	uint8_t *dst = result + block->start;
+	int size = block->len + 2;
+	int r, m;
+
+	if (block->len == 0) {
+		status[i] = BLOCK_UNKNOWN;
+		return;
+	}
+	if (block->start + size > reads[base].binSize) {
+		status[i] = BLOCK_BAD;
+		return;
+	}
+	if (block->crcOk && !block->suspect && !block->corrected) {
+		status[i] = BLOCK_OK;
+		source[i] = base;
+		return;
+	}
+
+	//any read with a good copy wins, otherwise collect everything that wasn't hit by lost data.
+	//a CRC repair can be wrong, so a block that read right somewhere else is preferred
+	if (!block->suspect && !block->corrected)
+		votes.push_back(reads[base].bin + block->start);
+	for (r = 0; r < (int)reads.size(); r++) {
+		if (r == base || (m = Match(r, block)) < 0)
+			continue;
+		TBlockInfo *b = &reads[r].blocks[m];
+		if (b->suspect || b->start + size > reads[r].binSize)
+			continue;
+		if (b->crcOk && !b->corrected) {
+			memcpy(dst, reads[r].bin + b->start, size);
+			status[i] = BLOCK_COPIED;
+			source[i] = r;
+			return;
+		}
+		if (!b->corrected)
+			votes.push_back(reads[r].bin + b->start);
+	}
+
+	status[i] = BLOCK_BAD;
+	if ((int)votes.size() >= MINVOTES && Majority(votes, dst, size)) {
+		status[i] = BLOCK_VOTED;
+		source[i] = (int)votes.size();
+	}
+	else if (block->crcOk && !block->suspect) {
+		status[i] = BLOCK_CORRECTED;
+		source[i] = base;
+	}
+}
+
+//per-bit majority of the votes, written to dst if its CRC is good
+bool CMultiRead::Majority(std::vector<uint8_t*> &votes, uint8_t *dst, int size)
+{
+	std::vector<uint8_t> voted(size, 0);
+	int r, j, bit, ones;
+
+	for (j = 0; j < size; j++) {
+		for (bit = 0; bit < 8; bit++) {
+			for (ones = 0, r = 0; r < (int)votes.size(); r++) {
+				ones += (votes[r][j] >> bit) & 1;
+			}
+			if (ones * 2 > (int)votes.size())
+				voted[j] |= 1 << bit;
+		}
+	}
+	if (calc_crc(&voted[0], size) != 0)
+		return(false);
+	memcpy(dst, &voted[0], size);
+	return(true);
+}
+
+int CMultiRead::Combine()
+{
+	int i, bad;
+
+	if (reads.size() == 0)
+		return(0);
+
+	//build on the read with the most good blocks
+	for (base = 0, i = 1; i < (int)reads.size(); i++) {
+		if (reads[i].good > reads[base].good)
+			base = i;
+	}
+	free(result);
+	result = (uint8_t*)malloc(reads[base].binSize);
+	memcpy(result, reads[base].bin, reads[base].binSize);
+	status.assign(reads[base].blocks.size(), BLOCK_BAD);
+	source.assign(reads[base].blocks.size(), -1);
+
+	parallel_for((int)reads[base].blocks.size(), VoteBlock, this);
+
+	for (bad = 0, i = 0; i < (int)status.size(); i++) {
+		if (status[i] == BLOCK_BAD || status[i] == BLOCK_CORRECTED)
+			bad++;
+	}
+	return(bad);
+}
+
+void CMultiRead::Report()
+{
+	std::vector<int> count(reads.size(), 0);
+	int i;
+
+	for (i = 0; i < (int)status.size(); i++) {
+		if (status[i] == BLOCK_OK || status[i] == BLOCK_COPIED || status[i] == BLOCK_CORRECTED)
+			count[source[i]]++;
+		switch (status[i]) {
+		case BLOCK_BAD:
+			decoder_message(ctx, "block %d: bad CRC in all %d reads\n", i + 1, (int)reads.size());
+			break;
+		case BLOCK_COPIED:
+			decoder_message(ctx, "block %d: taken from %s\n", i + 1, reads[source[i]].label.c_str());
+			break;
+		case BLOCK_CORRECTED:
+			decoder_message(ctx, "block %d: only good after a CRC fix\n", i + 1);
+			break;
+		case BLOCK_VOTED:
+			decoder_message(ctx, "block %d: fixed by majority of %d reads\n", i + 1, source[i]);
+			break;
+		}
+	}
+	for (i = 0; i < (int)reads.size(); i++) {
+		if (count[i])
+			decoder_message(ctx, "%d blocks from %s\n", count[i], reads[i].label.c_str());
+	}
+}
+
+int CMultiRead::GetWinner()
+{
+	std::vector<int> count(reads.size(), 0);
+	int i, best = base;
+
+	for (i = 0; i < (int)status.size(); i++) {
+		if (status[i] == BLOCK_OK || status[i] == BLOCK_COPIED || status[i] == BLOCK_CORRECTED)
+			count[source[i]]++;
+	}
+	for (i = 0; i < (int)count.size(); i++) {
+		if (count[i] > count[best])
+			best = i;
+	}
+	return(best);
+}
+
+TBlockInfo *CMultiRead::GetBlock(int i, int *blockStatus, const char **from)
+{
+	*blockStatus = status[i];
+	*from = "";
+	if (status[i] == BLOCK_OK || status[i] == BLOCK_COPIED || status[i] == BLOCK_CORRECTED)
+		*from = reads[source[i]].label.c_str();
+	return(&reads[base].blocks[i]);
+}
+
+void CMultiRead::GetResult(uint8_t **bin, int *binSize)
+{
+	*bin = 0;
+	*binSize = 0;
+	if (result == 0)
+		return;
+	*binSize = reads[base].binSize;
+	*bin = (uint8_t*)malloc(*binSize);
+	memcpy(*bin, result, *binSize);
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <string>
+#include "Codec.h"
+
+//Combines several reads (disk revolutions) of the same disk side.
+//Blocks are matched up by type, size and position from the first block.  For each block a read with a good
+//CRC is used if there is one, otherwise the block is rebuilt from a per-bit majority vote of all reads and kept
+//if that gives a good CRC.  Blocks are worked on in parallel.
+class CMultiRead
+{
+public:
+	enum {
+		MAXBLOCKS = 512,
+		MINVOTES = 3,			//reads needed for a majority vote
+	};
+
+	//how a block in the result was obtained
+	enum {
+		BLOCK_BAD = 0,
+		BLOCK_OK,				//first choice read had a good CRC
+		BLOCK_COPIED,			//good CRC in another read
+		BLOCK_VOTED,			//majority vote gave a good CRC
+		BLOCK_CORRECTED,		//no read was good, the first choice read's CRC fix is kept
+		BLOCK_UNKNOWN,			//unknown block type (junk after the last file), not counted as bad
+	};
+
+protected:
+	typedef struct SRead {
+		uint8_t *bin;
+		int binSize;
+		int first;				//raw03 offset of the first block, blocks are matched relative to it
+		int good;				//blocks with a good CRC
+		std::vector<TBlockInfo> blocks;
+		std::string label;		//for messages
+	} TRead;
+
+	TDecoderContext *ctx;
+	std::vector<TRead> reads;
+	int base;					//read the result is built on
+	uint8_t *result;
+	std::vector<int> status;	//per block of the base read
+	std::vector<int> source;	//read the block came from, or number of votes
+
+	static void VoteBlock(void *arg, int i);
+	void Vote(int i);
+	bool Majority(std::vector<uint8_t*> &votes, uint8_t *dst, int size);
+	int Match(int read, TBlockInfo *block);
+
+public:
+	CMultiRead(TDecoderContext *c);
+	virtual ~CMultiRead();
+
+	//decode one read (raw03 data) and add it, lost = ranges lost in transfer.  label = 0 for "read n"
+	void Add(uint8_t *raw03, int size, TRawRange *lost, int lostCount, const char *label = 0);
+
+	//add a read decoded elsewhere (blocks from TDecoderContext::blocks), bin is freed by CMultiRead
+	void AddDecoded(uint8_t *bin, int binSize, TBlockInfo *blocks, int count, const char *label = 0);
+
+	//rebuild the result from all reads so far, returns number of blocks still bad or only good after a CRC
+	//repair (a repair can be wrong, another read should confirm it)
+	int Combine();
+
+	//messages for blocks that weren't good in the first choice read, and which reads the result came from
+	void Report();
+
+	//read that supplied the most blocks of the result
+	int GetWinner();
+
+	//blocks of the result as found in the base read, status = BLOCK_xxx, from = label of the read it came from
+	int GetBlockCount() { return((int)status.size()); }
+	TBlockInfo *GetBlock(int i, int *blockStatus, const char **from);
+
+	//copy of the result, caller frees it
+	void GetResult(uint8_t **bin, int *binSize);
+
+	int GetReads() { return((int)reads.size()); }
+};
@@ -0,0 +1,62 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include "Parallel.h"
+#include "System.h"
+
+typedef struct SParallelJob {
+	TParallelFunc func;
+	void *arg;
+	int count;
+	std::atomic<int> next;
+} TParallelJob;
+
+//set while a thread works on parallel_for items, a parallel_for inside an item runs on that thread alone
+static thread_local bool inParallel = false;
+
+static void worker(void *param)
+{
+	TParallelJob *job = (TParallelJob*)param;
+	bool outer = inParallel;
+	int i;
+
+	inParallel = true;
+	while ((i = job->next++) < job->count) {
+		job->func(job->arg, i);
+	}
+	inParallel = outer;
+}
+
+void parallel_for(int count, TParallelFunc func, void *arg, int threads)
+{
+	TParallelJob job;
+	std::vector<void*> handles;
+	int i;
+
+	if (inParallel) {
+		for (i = 0; i < count; i++)
+			func(arg, i);
+		return;
+	}
+	if (threads <= 0)
+		threads = cpu_count();
+	if (threads > count)
+		threads = count;
+	job.func = func;
+	job.arg = arg;
+	job.count = count;
+	job.next = 0;
+
+	//this thread works too, so start one less
+	for (i = 1; i < threads; i++) {
+		void *h = thread_start(worker, &job);
+
+		if (h)
+			handles.push_back(h);
+	}
+	worker(&job);
+	for (i = 0; i < (int)handles.size(); i++) {
+		thread_join(handles[i]);
+	}
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+//work item for parallel_for, i = item index
+typedef void (*TParallelFunc)(void *arg, int i);
+
+//Run func(arg, 0..count-1) on up to 'threads' threads (0 = one per processor) and wait for all of them.
+//Items are handed out one at a time, so uneven items balance out.  Called from inside an item it runs the
+//items on the calling thread, so nested work doesn't start threads per item.
+void parallel_for(int count, TParallelFunc func, void *arg, int threads = 0);
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "StreamDecoder.h"
+
+CStreamDecoder::CStreamDecoder(TDecoderContext *c, int maxSize)
+{
+	ctx = c;
+	callback = 0;
+	user = 0;
+	raw = (uint8_t*)malloc(maxSize);
+	rawSize = 0;
+	rawMax = maxSize;
+	block = (uint8_t*)malloc(MAXBLOCK);
+	inBlock = false;
+	zeros = 0;
+	bitval = 0;
+	out = 0;
+	size = 0;
+	start = 0;
+	blocks = 0;
+	fileSize = -1;
+}
+
+CStreamDecoder::~CStreamDecoder()
+{
+	free(block);
+	free(raw);
+}
+
+void CStreamDecoder::SetCallback(TStreamCallback cb, void *data)
+{
+	callback = cb;
+	user = data;
+}
+
+int CStreamDecoder::Feed(uint8_t *buf, int len)
+{
+	int i;
+
+	if (len > rawMax - rawSize)
+		len = rawMax - rawSize;
+	if (len <= 0)
+		return(0);
+	memcpy(raw + rawSize, buf, len);
+	raw_to_raw03(raw + rawSize, len);
+	for (i = rawSize; i < rawSize + len; i++) {
+		Symbol(i, raw[i]);
+	}
+	rawSize += len;
+	return(len);
+}
+
+void CStreamDecoder::Finish(uint8_t **bin, int *binSize)
+{
+	raw03_to_bin(ctx, raw, rawSize, bin, binSize);
+}
+
+//same bit decoding as block_decode
+void CStreamDecoder::Symbol(int pos, uint8_t sym)
+{
+	if (!inBlock) {
+		if (sym == 1 && zeros >= MIN_GAP_SIZE) {
+			inBlock = true;
+			bitval = 1;
+			out = 0;
+			size = 0;
+			start = pos;
+			memset(block, 0, MAXBLOCK);
+		}
+		zeros = (sym == 0) ? zeros + 1 : 0;
+		return;
+	}
+
+	switch (sym | (bitval << 4)) {
+	case 0x11:
+		out++;
+		//fall through
+	case 0x00:
+		out++;
+		bitval = 0;
+		break;
+	case 0x12:
+		out++;
+		//fall through
+	case 0x01:
+	case 0x10:
+		block[out / 8] |= 1 << (out & 7);
+		out++;
+		bitval = 1;
+		break;
+	default:	//glitch, keep going and let the CRC tell
+		out++;
+		bitval = 0;
+		break;
+	}
+
+	//a 0x12 pair can finish a byte and start the next
+	while (inBlock && out >= ((size ? size + 2 : 1) * 8)) {
+		if (size == 0) {
+			ByteDone();
+		}
+		else {
+			BlockDone(pos);
+		}
+	}
+}
+
+//block type is known, work out the block size
+void CStreamDecoder::ByteDone()
+{
+	switch (block[0]) {
+	case 1:
+		size = 0x38;
+		break;
+	case 2:
+		size = 2;
+		break;
+	case 3:
+		size = 16;
+		break;
+	case 4:
+		if (fileSize >= 0) {
+			size = 1 + fileSize;
+			break;
+		}
+		//fall through
+	default:
+		decoder_message(ctx, "block %d: unknown type %X at %X\n", ++blocks, block[0], start);
+		inBlock = false;
+		zeros = 0;
+		return;
+	}
+}
+
+void CStreamDecoder::BlockDone(int pos)
+{
+	TStreamBlock b;
+
+	b.number = ++blocks;
+	b.type = block[0];
+	b.size = size;
+	b.rawStart = start;
+	b.rawEnd = pos + 1;
+	b.crcOk = calc_crc(block, size + 2) == 0;
+	b.data = block;
+
+	decoder_message(ctx, "block %d: type %X at %X, %X bytes%s\n", b.number, b.type, b.rawStart, b.size, b.crcOk ? "" : ", bad CRC");
+	switch (b.type) {
+	case 2:
+		decoder_message(ctx, "  %d files\n", block[1]);
+		break;
+	case 3:
+		fileSize = block[13] | (block[14] << 8);
+		decoder_message(ctx, "  file %d: id %02X '%.8s' %04X bytes at %04X, type %d\n",
+			block[1], block[2], (char*)block + 3, fileSize, block[11] | (block[12] << 8), block[15]);
+		break;
+	}
+	if (callback)
+		callback(user, &b);
+
+	inBlock = false;
+	zeros = 0;
+}
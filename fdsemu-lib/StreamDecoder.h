@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include "Codec.h"
+
+//block recognized while the disk is still being read
+typedef struct SStreamBlock {
+	int number;				//blocks seen so far, from 1
+	uint8_t type;			//block type (first byte)
+	int size;				//block size including the type byte, excluding CRC
+	int rawStart;			//raw03 offset of the gap end
+	int rawEnd;				//raw03 offset following the CRC
+	bool crcOk;
+	uint8_t *data;			//type byte + data + CRC, only valid during the callback
+} TStreamBlock;
+
+typedef void (*TStreamCallback)(void *user, TStreamBlock *block);
+
+//Incremental decoder fed with adapter data as it arrives.
+//Blocks, their CRC status and the file table are reported as soon as they're complete, using the simple
+//standard-layout rules (gap, then a block of the size its type says).  Finish() runs the full raw03_to_bin
+//decoder over everything fed, so the final image is exactly the batch decode of the same capture.
+class CStreamDecoder
+{
+public:
+	enum {
+		MAXBLOCK = 0x10000 + 16,
+	};
+
+protected:
+	TDecoderContext *ctx;
+	TStreamCallback callback;
+	void *user;
+
+	uint8_t *raw;			//raw03 data fed so far
+	int rawSize, rawMax;
+
+	//block recognizer state
+	bool inBlock;
+	int zeros;				//zeros seen while looking for a gap end
+	uint8_t bitval;
+	int out;				//bits decoded into block[]
+	int size;				//size of the block being decoded, 0 until the type is known
+	int start;
+	int blocks;
+	int fileSize;			//size from the last file header, -1 if none yet
+	uint8_t *block;
+
+	void Symbol(int pos, uint8_t sym);
+	void ByteDone();
+	void BlockDone(int pos);
+
+public:
+	CStreamDecoder(TDecoderContext *c, int maxSize);
+	virtual ~CStreamDecoder();
+
+	void SetCallback(TStreamCallback cb, void *data);
+
+	//add adapter data (unconverted pulse widths), returns number of bytes accepted
+	int Feed(uint8_t *buf, int len);
+
+	//decode everything fed so far, same as raw03_to_bin on the whole capture
+	void Finish(uint8_t **bin, int *binSize);
+
+	uint8_t *GetRaw03() { return(raw); }
+	int GetSize() { return(rawSize); }
+};
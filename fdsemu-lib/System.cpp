@@ -2,12 +2,22 @@
 
 #include <windows.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <conio.h>
+#include <io.h>
 
 uint32_t getTicks() {
 	return GetTickCount();
 }
 
+uint64_t getMicros() {
+	LARGE_INTEGER freq, now;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+	return (uint64_t)(now.QuadPart / freq.QuadPart) * 1000000ull + (uint64_t)(now.QuadPart % freq.QuadPart) * 1000000ull / freq.QuadPart;
+}
+
 void utf8_to_utf16(uint16_t *dst, char *src, size_t dstSize) {
 	MultiByteToWideChar(CP_ACP, 0, src, -1, (wchar_t*)dst, dstSize / sizeof(wchar_t));
 }
@@ -20,14 +30,151 @@ void sleep_ms(int millisecs) {
 	Sleep(millisecs);
 }
 
+typedef struct SThreadStart {
+	void (*func)(void*);
+	void *arg;
+} TThreadStart;
+
+static DWORD WINAPI thread_entry(LPVOID param) {
+	TThreadStart start = *(TThreadStart*)param;
+
+	delete (TThreadStart*)param;
+	start.func(start.arg);
+	return 0;
+}
+
+void *thread_start(void (*func)(void*), void *arg) {
+	TThreadStart *start = new TThreadStart;
+
+	start->func = func;
+	start->arg = arg;
+	HANDLE h = CreateThread(NULL, 0, thread_entry, start, 0, NULL);
+	if (h == NULL)
+		delete start;
+	return h;
+}
+
+void thread_join(void *thread) {
+	WaitForSingleObject((HANDLE)thread, INFINITE);
+	CloseHandle((HANDLE)thread);
+}
+
+bool thread_realtime() {
+	return SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+}
+
+int cpu_count() {
+	SYSTEM_INFO info;
+
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors;
+}
+
+bool mem_lock(void *buf, size_t size) {
+	return VirtualLock(buf, size) != 0;
+}
+
+void mem_unlock(void *buf, size_t size) {
+	VirtualUnlock(buf, size);
+}
+
+bool dir_list(const char *path, void (*func)(void *arg, const char *name), void *arg) {
+	WIN32_FIND_DATAA data;
+	HANDLE find;
+	char pattern[MAX_PATH];
+
+	_snprintf(pattern, sizeof(pattern), "%s\\*", path);
+	pattern[sizeof(pattern) - 1] = 0;
+	if ((find = FindFirstFileA(pattern, &data)) == INVALID_HANDLE_VALUE)
+		return false;
+	do {
+		if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0)
+			func(arg, data.cFileName);
+	} while (FindNextFileA(find, &data));
+	FindClose(find);
+	return true;
+}
+
+//the view keeps the mapping and file open after the handles are closed
+void *file_map(const char *filename, size_t *size) {
+	HANDLE file, mapping;
+	LARGE_INTEGER fileSize;
+	void *data = 0;
+
+	*size = 0;
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return 0;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (mapping) {
+			data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+	if (data)
+		*size = (size_t)fileSize.QuadPart;
+	return data;
+}
+
+void file_unmap(void *data, size_t size) {
+	(void)size;
+	UnmapViewOfFile(data);
+}
+
+void *file_map_rw(const char *filename, size_t *size, bool create) {
+	HANDLE file, mapping;
+	LARGE_INTEGER fileSize;
+	void *data = 0;
+
+	file = CreateFileA(filename, GENERIC_READ | GENERIC_WRITE, 0, NULL, create ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return 0;
+	if (create) {
+		fileSize.QuadPart = *size;
+		if (!SetFilePointerEx(file, fileSize, NULL, FILE_BEGIN) || !SetEndOfFile(file))
+			fileSize.QuadPart = 0;
+	}
+	else if (!GetFileSizeEx(file, &fileSize))
+		fileSize.QuadPart = 0;
+	if (fileSize.QuadPart > 0) {
+		mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0, 0, NULL);
+		if (mapping) {
+			data = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+			CloseHandle(mapping);
+		}
+	}
+	CloseHandle(file);
+	if (data)
+		*size = (size_t)fileSize.QuadPart;
+	return data;
+}
+
+bool file_map_sync(void *data, size_t size) {
+	return FlushViewOfFile(data, size) != 0;
+}
+
+bool file_sync(FILE *f) {
+	return fflush(f) == 0 && _commit(_fileno(f)) == 0;
+}
+
 #elif defined(__linux__) || defined(__APPLE__)
 
 #include <sys/time.h>
+#include <time.h>
+#include <stdint.h>
 #include <string.h>
 #include <iconv.h>
 #include <termios.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
 
 uint32_t getTicks() {
 	struct timeval tv;
@@ -35,6 +182,18 @@ uint32_t getTicks() {
 	return (unsigned long)((tv.tv_sec * 1000ul) + (tv.tv_usec / 1000ul));
 }
 
+uint64_t getMicros() {
+#if defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, 0);
+	return (uint64_t)tv.tv_sec * 1000000ull + tv.tv_usec;
+#endif
+}
+
 void utf8_to_utf16(uint16_t *dst, char *src, size_t dstSize) {
 	size_t srcSize = strlen(src) + 1;
 	iconv_t ic;
@@ -61,4 +220,129 @@ void sleep_ms(int millisecs) {
 	usleep(millisecs * 1000);
 }
 
+typedef struct SThreadStart {
+	void (*func)(void*);
+	void *arg;
+} TThreadStart;
+
+static void *thread_entry(void *param) {
+	TThreadStart start = *(TThreadStart*)param;
+
+	delete (TThreadStart*)param;
+	start.func(start.arg);
+	return 0;
+}
+
+void *thread_start(void (*func)(void*), void *arg) {
+	TThreadStart *start = new TThreadStart;
+	pthread_t *thread = new pthread_t;
+
+	start->func = func;
+	start->arg = arg;
+	if (pthread_create(thread, 0, thread_entry, start) != 0) {
+		delete start;
+		delete thread;
+		return 0;
+	}
+	return thread;
+}
+
+void thread_join(void *thread) {
+	pthread_join(*(pthread_t*)thread, 0);
+	delete (pthread_t*)thread;
+}
+
+//needs CAP_SYS_NICE (or root) on linux, fails harmlessly otherwise
+bool thread_realtime() {
+	struct sched_param param;
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+	return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+}
+
+int cpu_count() {
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (int)n : 1;
+}
+
+bool mem_lock(void *buf, size_t size) {
+	return mlock(buf, size) == 0;
+}
+
+void mem_unlock(void *buf, size_t size) {
+	munlock(buf, size);
+}
+
+bool dir_list(const char *path, void (*func)(void *arg, const char *name), void *arg) {
+	struct dirent *entry;
+	struct stat st;
+	char name[1024];
+	DIR *dir;
+
+	if ((dir = opendir(path)) == 0)
+		return false;
+	while ((entry = readdir(dir)) != 0) {
+		snprintf(name, sizeof(name), "%s/%s", path, entry->d_name);
+		if (stat(name, &st) == 0 && S_ISREG(st.st_mode))
+			func(arg, entry->d_name);
+	}
+	closedir(dir);
+	return true;
+}
+
+void *file_map(const char *filename, size_t *size) {
+	struct stat st;
+	void *data = 0;
+	int fd;
+
+	*size = 0;
+	if ((fd = open(filename, O_RDONLY)) < 0)
+		return 0;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED)
+			data = 0;
+	}
+	close(fd);
+	if (data)
+		*size = st.st_size;
+	return data;
+}
+
+void file_unmap(void *data, size_t size) {
+	munmap(data, size);
+}
+
+void *file_map_rw(const char *filename, size_t *size, bool create) {
+	struct stat st;
+	void *data = 0;
+	int fd;
+
+	if ((fd = open(filename, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0644)) < 0)
+		return 0;
+	if (create)
+		st.st_size = ftruncate(fd, *size) == 0 ? (off_t)*size : 0;
+	else if (fstat(fd, &st) != 0)
+		st.st_size = 0;
+	if (st.st_size > 0) {
+		data = mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (data == MAP_FAILED)
+			data = 0;
+	}
+	close(fd);
+	if (data)
+		*size = st.st_size;
+	return data;
+}
+
+bool file_map_sync(void *data, size_t size) {
+	return msync(data, size, MS_SYNC) == 0;
+}
+
+bool file_sync(FILE *f) {
+	return fflush(f) == 0 && fsync(fileno(f)) == 0;
+}
+
 #endif
@@ -1,6 +1,40 @@
 #pragma once
 
+#include <stdio.h>
+
 uint32_t getTicks();
+uint64_t getMicros();		//monotonic microsecond counter, for timing
 void utf8_to_utf16(uint16_t *dst, char *src, size_t dstSize);
 char readKb();
 void sleep_ms(int millisecs);
+
+//threads, returns 0 if the thread couldn't be started
+void *thread_start(void (*func)(void*), void *arg);
+void thread_join(void *thread);
+
+//raise the calling thread to real-time priority, false if not allowed
+bool thread_realtime();
+
+//number of logical processors
+int cpu_count();
+
+//keep buffer pages resident
+bool mem_lock(void *buf, size_t size);
+void mem_unlock(void *buf, size_t size);
+
+//call func for every file (not directory) in path, with the name only.  false if path can't be read
+bool dir_list(const char *path, void (*func)(void *arg, const char *name), void *arg);
+
+//map a whole file read-only, 0 if it can't be opened or is empty
+void *file_map(const char *filename, size_t *size);
+void file_unmap(void *data, size_t size);
+
+//map a file read-write, changes go to the file.  create = make it *size bytes (all 0), otherwise the file
+//must exist and *size is set to its size.  0 if it can't be done
+void *file_map_rw(const char *filename, size_t *size, bool create);
+
+//write the changes to a read-write mapping to the disk
+bool file_map_sync(void *data, size_t size);
+
+//flush a file all the way to the disk, for journals that must survive a crash
+bool file_sync(FILE *f);
@@ -0,0 +1,104 @@
+#include <string.h>
+#include "WavePyramid.h"
+
+static void combine(TWaveSpan *dst, const TWaveSpan *src)
+{
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+	dst->symbols |= src->symbols;
+}
+
+CWavePyramid::CWavePyramid()
+{
+	Clear();
+}
+
+CWavePyramid::~CWavePyramid()
+{
+}
+
+void CWavePyramid::Clear(const TQuantizer *q)
+{
+	int i, s;
+
+	if (q)
+		quant = *q;
+	else
+		quantizer_default(&quant);
+	for (i = 0; i < 256; i++) {
+		for (s = 0; s < 3 && !(i >= quant.limit[s] && i < quant.limit[s + 1]); s++);
+		symbol[i] = 1 << s;
+	}
+	levels.clear();
+	levels.resize(1);
+	size = 0;
+}
+
+//redo entries of level from index 'from' up from the level below
+void CWavePyramid::Update(int level, int from)
+{
+	std::vector<TWaveSpan> &below = levels[level - 1];
+	std::vector<TWaveSpan> &cur = levels[level];
+	int count = ((int)below.size() + FANOUT - 1) >> FANOUT_SHIFT;
+	int i, j, end;
+
+	cur.resize(count);
+	for (i = from; i < count; i++) {
+		end = (i + 1) << FANOUT_SHIFT;
+		if (end > (int)below.size())
+			end = (int)below.size();
+		cur[i] = below[i << FANOUT_SHIFT];
+		for (j = (i << FANOUT_SHIFT) + 1; j < end; j++)
+			combine(&cur[i], &below[j]);
+	}
+}
+
+void CWavePyramid::Append(const uint8_t *raw, int rawSize)
+{
+	std::vector<TWaveSpan> &base = levels[0];
+	int i, level, from;
+
+	if (rawSize <= 0)
+		return;
+	from = size;
+	base.resize(size + rawSize);
+	for (i = 0; i < rawSize; i++) {
+		TWaveSpan *s = &base[size + i];
+
+		s->min = s->max = raw[i];
+		s->symbols = symbol[raw[i]];
+	}
+	size += rawSize;
+
+	//the entry that held the old end may have been partial, it's redone along with the new ones
+	for (level = 1; levels[level - 1].size() > 1; level++) {
+		if (level == (int)levels.size())
+			levels.resize(level + 1);
+		from >>= FANOUT_SHIFT;
+		Update(level, from);
+	}
+}
+
+bool CWavePyramid::Get(int start, int end, TWaveSpan *span)
+{
+	int level, shift, i, last;
+
+	if (start < 0)
+		start = 0;
+	if (end > size)
+		end = size;
+	if (start >= end)
+		return(false);
+
+	//highest level with entries no longer than the range, then at most 2 * FANOUT + 1 entries are combined.
+	//the entries at both ends can reach a little outside the range, which doesn't show at that zoom
+	for (level = 0; level + 1 < (int)levels.size() && (1 << ((level + 1) * FANOUT_SHIFT)) <= end - start; level++);
+	shift = level * FANOUT_SHIFT;
+	last = (end - 1) >> shift;
+	*span = levels[level][start >> shift];
+	for (i = (start >> shift) + 1; i <= last; i++)
+		combine(span, &levels[level][i]);
+	return(true);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include "Codec.h"
+
+//pulse widths in a range of a capture
+typedef struct SWaveSpan {
+	uint8_t min;
+	uint8_t max;
+	uint8_t symbols;			//bit n set if raw03 symbol n (3 = glitch) is in the range
+} TWaveSpan;
+
+//Min/max pyramid of an adapter capture for drawing it at any zoom.
+//Level 0 has one entry per pulse, each level above combines FANOUT entries of the one below, so any range
+//is answered from a handful of entries.  Data can be appended while a capture is still coming in, only the
+//last entry of each level is redone.  Symbols use the quantizer's fixed thresholds (no tracking).
+class CWavePyramid
+{
+public:
+	enum {
+		FANOUT_SHIFT = 2,
+		FANOUT = 1 << FANOUT_SHIFT,
+	};
+
+protected:
+	TQuantizer quant;
+	uint8_t symbol[256];		//pulse width -> symbol bit
+	std::vector<std::vector<TWaveSpan> > levels;
+	int size;
+
+	void Update(int level, int from);
+
+public:
+	CWavePyramid();
+	virtual ~CWavePyramid();
+
+	//start over, symbols are classified with quant (0 = default thresholds)
+	void Clear(const TQuantizer *q = 0);
+
+	//add adapter data (pulse widths, not raw03) to the end
+	void Append(const uint8_t *raw, int rawSize);
+
+	//pulses [start, end) combined, false if the range is empty
+	bool Get(int start, int end, TWaveSpan *span);
+
+	int GetSize() { return(size); }
+	const TQuantizer *GetQuantizer() { return(&quant); }
+};
@@ -10,33 +10,66 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 TARGET = fdsemu-qt
 TEMPLATE = app
+CONFIG += c++11
 
 
 SOURCES += main.cpp\
         mainwindow.cpp \
     writestatus.cpp \
     diskreaddialog.cpp \
+    histogramwidget.cpp \
+    waveformwidget.cpp \
     writefilesdialog.cpp \
+    ../fdsemu-lib/Capture.cpp \
+    ../fdsemu-lib/CaptureFile.cpp \
+    ../fdsemu-lib/Codec.cpp \
     ../fdsemu-lib/Device.cpp \
     ../fdsemu-lib/DiskImage.cpp \
     ../fdsemu-lib/DiskSide.cpp \
     ../fdsemu-lib/Flash.cpp \
+    ../fdsemu-lib/FlashDefrag.cpp \
+    ../fdsemu-lib/FlashImage.cpp \
+    ../fdsemu-lib/FlashJournal.cpp \
+    ../fdsemu-lib/FlashPlan.cpp \
+    ../fdsemu-lib/FlashSync.cpp \
     ../fdsemu-lib/FlashUtil.cpp \
+    ../fdsemu-lib/GapIndex.cpp \
+    ../fdsemu-lib/Hypothesis.cpp \
+    ../fdsemu-lib/MultiRead.cpp \
+    ../fdsemu-lib/Parallel.cpp \
     ../fdsemu-lib/Sram.cpp \
-    ../fdsemu-lib/System.cpp
+    ../fdsemu-lib/StreamDecoder.cpp \
+    ../fdsemu-lib/System.cpp \
+    ../fdsemu-lib/WavePyramid.cpp
 
 HEADERS  += mainwindow.h \
     hidapi/hidapi.h \
     writestatus.h \
     diskreaddialog.h \
+    histogramwidget.h \
+    waveformwidget.h \
     writefilesdialog.h \
+    ../fdsemu-lib/Capture.h \
+    ../fdsemu-lib/CaptureFile.h \
+    ../fdsemu-lib/Codec.h \
     ../fdsemu-lib/Device.h \
     ../fdsemu-lib/DiskImage.h \
     ../fdsemu-lib/DiskSide.h \
     ../fdsemu-lib/Flash.h \
+    ../fdsemu-lib/FlashDefrag.h \
+    ../fdsemu-lib/FlashImage.h \
+    ../fdsemu-lib/FlashJournal.h \
+    ../fdsemu-lib/FlashPlan.h \
+    ../fdsemu-lib/FlashSync.h \
     ../fdsemu-lib/FlashUtil.h \
+    ../fdsemu-lib/GapIndex.h \
+    ../fdsemu-lib/Hypothesis.h \
+    ../fdsemu-lib/MultiRead.h \
+    ../fdsemu-lib/Parallel.h \
     ../fdsemu-lib/Sram.h \
-    ../fdsemu-lib/System.h
+    ../fdsemu-lib/StreamDecoder.h \
+    ../fdsemu-lib/System.h \
+    ../fdsemu-lib/WavePyramid.h
 
 FORMS    += mainwindow.ui \
     writestatus.ui \
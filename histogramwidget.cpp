@@ -0,0 +1,70 @@
+#include <string.h>
+#include <QPainter>
+#include "histogramwidget.h"
+
+HistogramWidget::HistogramWidget(QWidget *parent) :
+    QWidget(parent)
+{
+    valid = false;
+    quantizer_default(&quant);
+}
+
+void HistogramWidget::setData(const uint32_t *h, const TQuantizer *q)
+{
+    memcpy(hist, h, sizeof(hist));
+    quant = *q;
+    valid = true;
+    update();
+}
+
+void HistogramWidget::clear()
+{
+    valid = false;
+    update();
+}
+
+void HistogramWidget::paintEvent(QPaintEvent *event)
+{
+    QPainter painter(this);
+    TQuantizer nominal;
+    uint32_t peak = 1;
+    int i, x, h;
+
+    (void)event;
+    painter.fillRect(rect(), Qt::white);
+    painter.setPen(Qt::gray);
+    painter.drawRect(0, 0, width() - 1, height() - 1);
+    if (!valid) {
+        painter.drawText(rect(), Qt::AlignCenter, "Pulse widths");
+        return;
+    }
+
+    //scale to the tallest bar inside the pulse ranges, lost packets pile up at 0
+    for (i = quant.limit[0]; i < quant.limit[3]; i++) {
+        if (hist[i] > peak)
+            peak = hist[i];
+    }
+    painter.setPen(Qt::darkBlue);
+    for (i = 0; i < 256; i++) {
+        h = (int)((uint64_t)(hist[i] > peak ? peak : hist[i]) * (height() - 16) / peak);
+        x = i * (width() - 2) / 256 + 1;
+        if (h)
+            painter.drawLine(x, height() - 2, x, height() - 2 - h);
+    }
+
+    //fixed thresholds dashed, the ones used solid
+    quantizer_default(&nominal);
+    painter.setPen(QPen(Qt::gray, 1, Qt::DashLine));
+    for (i = 0; i < 4; i++) {
+        x = nominal.limit[i] * (width() - 2) / 256 + 1;
+        painter.drawLine(x, 1, x, height() - 2);
+    }
+    painter.setPen(Qt::red);
+    for (i = 0; i < 4; i++) {
+        x = quant.limit[i] * (width() - 2) / 256 + 1;
+        painter.drawLine(x, 1, x, height() - 2);
+    }
+    painter.setPen(Qt::black);
+    painter.drawText(4, 12, QString().sprintf("thresholds %02X/%02X/%02X/%02X%s", quant.limit[0], quant.limit[1],
+        quant.limit[2], quant.limit[3], quant.track ? ", tracking" : ""));
+}
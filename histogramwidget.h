@@ -0,0 +1,28 @@
+#ifndef HISTOGRAMWIDGET_H
+#define HISTOGRAMWIDGET_H
+
+#include <QWidget>
+#include <stdint.h>
+#include "fdsemu-lib/Codec.h"
+
+//Pulse width histogram of a disk capture with the quantizer thresholds drawn over it
+class HistogramWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit HistogramWidget(QWidget *parent = 0);
+
+    void setData(const uint32_t *hist, const TQuantizer *quant);
+    void clear();
+
+protected:
+    void paintEvent(QPaintEvent *event);
+
+private:
+    uint32_t hist[256];
+    TQuantizer quant;
+    bool valid;
+};
+
+#endif // HISTOGRAMWIDGET_H
@@ -2,15 +2,31 @@
 #include <QMimeData>
 #include <QMessageBox>
 #include <QFileDialog>
+#include <QDir>
+#include <QFile>
+#include <QApplication>
+#include <QInputDialog>
 #include <stdint.h>
 #include <stdio.h>
+#include <vector>
+#include <atomic>
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 #include "writestatus.h"
 #include "writefilesdialog.h"
 #include "diskreaddialog.h"
 #include "fdsemu-lib/Device.h"
+#include "fdsemu-lib/FlashDefrag.h"
+#include "fdsemu-lib/FlashImage.h"
+#include "fdsemu-lib/FlashPlan.h"
+#include "fdsemu-lib/FlashSync.h"
 #include "fdsemu-lib/System.h"
+#include "fdsemu-lib/Codec.h"
+#include "fdsemu-lib/StreamDecoder.h"
+#include "fdsemu-lib/Capture.h"
+#include "fdsemu-lib/MultiRead.h"
+#include "fdsemu-lib/Hypothesis.h"
+#include "fdsemu-lib/CaptureFile.h"
 
 #define VERSION_HI 0
 #define VERSION_LO 42
@@ -18,90 +34,41 @@
 
 CDevice dev;
 
+//keeps the idle work off the device for the rest of a handler that uses it
+class IdlePause
+{
+protected:
+    MainWindow *window;
+
+public:
+    IdlePause(MainWindow *w) { window = w; window->pauseIdle(); }
+    ~IdlePause() { window->resumeIdle(); }
+};
+
 int force = 0;
 
-__inline uint8_t raw_to_raw03_byte(uint8_t raw)
+//journal of flash operations that must be finished if they're cut off, a flash image has its own
+static QString deviceJournalPath()
 {
-    if (raw < 0x48)
-        return(3);
-    else if (raw < 0x70)
-        return(0);
-    else if (raw < 0xA0)
-        return(1);
-    else if (raw < 0xD0)
-        return(2);
-    return(3);
+    return(QDir::homePath() + "/.fdsemu-journal");
 }
 
-//Turn raw data from adapter to pulse widths (0..3)
-//Input capture clock is 6MHz.  At 96.4kHz (FDS bitrate), 1 bit ~= 62 clocks
-//We could be clever about this and account for drive speed fluctuations, etc. but this will do for now
-static void raw_to_raw03(uint8_t *raw, int rawSize) {
-    for (int i = 0; i<rawSize; ++i) {
-        raw[i] = raw_to_raw03_byte(raw[i]);
-    }
+QString journalPath()
+{
+    if(dev.IsImage())
+        return(QString(dev.DeviceName) + ".journal");
+    return(deviceJournalPath());
 }
 
-//don't include gap end
-uint16_t calc_crc(uint8_t *buf, int size) {
-    uint32_t crc = 0x8000;
-    int i;
-    while (size--) {
-        crc |= (*buf++) << 16;
-        for (i = 0; i<8; i++) {
-            if (crc & 1) crc ^= 0x10810;
-            crc >>= 1;
-        }
-    }
-    return crc;
+//decoder message sink for callers collecting into a QStringList
+static void decoder_append(void *user, const char *msg) {
+    ((QStringList*)user)->append(QString(msg));
 }
 
-void copy_block(uint8_t *dst, uint8_t *src, int size) {
-    dst[0] = 0x80;
-    memcpy(dst + 1, src, size);
-    uint32_t crc = calc_crc(dst + 1, size + 2);
-    dst[size + 1] = crc;
-    dst[size + 2] = crc >> 8;
-}
-
-//Adds GAP + GAP end (0x80) + CRCs to .FDS image
-//Returns size (0=error)
-int fds_to_bin(uint8_t *dst, uint8_t *src, int dstSize) {
-    int i = 0, o = 0;
-
-    //check *NINTENDO-HVC* header
-    if (src[0] != 0x01 || src[1] != 0x2a || src[2] != 0x4e) {
-        printf("Not an FDS file.\n");
-        return 0;
-    }
-    memset(dst, 0, dstSize);
-
-    //block type 1
-    copy_block(dst + o, src + i, 0x38);
-    i += 0x38;
-    o += 0x38 + 3 + GAP;
-
-    //block type 2
-    copy_block(dst + o, src + i, 2);
-    i += 2;
-    o += 2 + 3 + GAP;
-
-    //block type 3+4...
-    while (src[i] == 3) {
-        int size = (src[i + 13] | (src[i + 14] << 8)) + 1;
-        if (o + 16 + 3 + GAP + size + 3 > dstSize) {    //end + block3 + crc + gap + end + block4 + crc
-            printf("Out of space (%d bytes short), adjust GAP size?\n", (o + 16 + 3 + GAP + size + 3) - dstSize);
-            return 0;
-        }
-        copy_block(dst + o, src + i, 16);
-        i += 16;
-        o += 16 + 3 + GAP;
-
-        copy_block(dst + o, src + i, size);
-        i += size;
-        o += size + 3 + GAP;
-    }
-    return o;
+//decoder message sink for the console
+static void decoder_print(void *user, const char *msg) {
+    (void)user;
+    printf("%s", msg);
 }
 
 //allocate buffer and read whole file
@@ -200,468 +167,6 @@ bool firmware_update(char *filename)
     return(true);
 }*/
 
-uint32_t chksum_calc(uint8_t *buf, int size)
-{
-    uint32_t ret = 0;
-    int i;
-
-    for (i = 0; i < size / 4; i++) {
-        ret ^= buf[i];
-    }
-    return(ret);
-}
-
-//look for pattern of bits matching block 1
-static int findFirstBlock(uint8_t *raw) {
-    static const uint8_t dat[] = { 1,0,1,0,0,0,0,0, 0,1,2,2,1,0,1,0, 0,1,1,2,1,1,1,1, 1,1,0,0,1,1,1,0 };
-    int i, len;
-    for (i = 0, len = 0; i<0x2000 * 8; i++) {
-        if (raw[i] == dat[len]) {
-            if (len == sizeof(dat) - 1)
-                return i - len;
-            len++;
-        }
-        else {
-            i -= len;
-            len = 0;
-        }
-    }
-    return -1;
-}
-
-bool block_decode(uint8_t *dst, uint8_t *src, int *inP, int *outP, int srcSize, int dstSize, int blockSize, char blockType) {
-    if (*outP + blockSize + 2 > dstSize) {
-        printf("Out of space\n");
-        return false;
-    }
-
-    int in = *inP;
-    int outEnd = (*outP + blockSize + 2) * 8;
-    int out = (*outP) * 8;
-    int start;
-
-    //scan for gap end
-    for (int zeros = 0; src[in] != 1 || zeros<MIN_GAP_SIZE; in++) {
-        if (src[in] == 0) {
-            zeros++;
-        }
-        else {
-            zeros = 0;
-        }
-        if (in >= srcSize - 2)
-            return false;
-    }
-    start = in;
-
-    char bitval = 1;
-    in++;
-    do {
-        if (in >= srcSize) {   //not necessarily an error, probably garbage at end of disk
-                                      //printf("Disk end\n");
-            return false;
-        }
-        switch (src[in] | (bitval << 4)) {
-        case 0x11:
-            out++;
-        case 0x00:
-            out++;
-            bitval = 0;
-            break;
-        case 0x12:
-            out++;
-        case 0x01:
-        case 0x10:
-            dst[out / 8] |= 1 << (out & 7);
-            out++;
-            bitval = 1;
-            break;
-        default: //Unexpected value.  Keep going, we'll probably get a CRC warning
-                    //printf("glitch(%d) @ %X(%X.%d)\n", src[in], in, out/8, out%8);
-            out++;
-            bitval = 0;
-            break;
-        }
-        in++;
-    } while (out<outEnd);
-    if (dst[*outP] != blockType) {
-        printf("Wrong block type %X(%X)-%X(%X) (found %d, expected %d)\n", start, *outP, in, out - 1, dst[*outP], blockType);
-        return false;
-    }
-    out = out / 8 - 2;
-
-    //printf("Out%d %X(%X)-%X(%X)\n", blockType, start, *outP, in, out-1);
-
-    if (calc_crc(dst + *outP, blockSize + 2)) {
-        uint16_t crc1 = (dst[out + 1] << 8) | dst[out];
-        dst[out] = 0;
-        dst[out + 1] = 0;
-        uint16_t crc2 = calc_crc(dst + *outP, blockSize + 2);
-        printf("Bad CRC (%04X!=%04X)\n", crc1, crc2);
-    }
-
-    dst[out] = 0;     //clear CRC
-    dst[out + 1] = 0;
-    dst[out + 2] = 0;   //+spare bit
-    *inP = in;
-    *outP = out;
-    return true;
-}
-
-//Simplified disk decoding.  This assumes disk will follow standard FDS file structure
-static bool raw03_to_fds(uint8_t *raw, uint8_t *fds, int rawsize) {
-    int in, out;
-
-    memset(fds, 0, FDSSIZE);
-
-    //lead-in can vary a lot depending on drive, scan for first block to get our bearings
-    in = findFirstBlock(raw) - MIN_GAP_SIZE;
-    if (in<0)
-        return false;
-
-    out = 0;
-    if (!block_decode(fds, raw, &in, &out, rawsize, FDSSIZE + 2, 0x38, 1))
-        return false;
-    if (!block_decode(fds, raw, &in, &out, rawsize, FDSSIZE + 2, 2, 2))
-        return false;
-    do {
-        if (!block_decode(fds, raw, &in, &out, rawsize, FDSSIZE + 2, 16, 3))
-            return true;
-        if (!block_decode(fds, raw, &in, &out, rawsize, FDSSIZE + 2, 1 + (fds[out - 16 + 13] | (fds[out - 16 + 14] << 8)), 4))
-            return true;
-    } while (in<rawsize);
-    return true;
-}
-
-//make raw0-3 from flash image (sans header)
-static void bin_to_raw03(uint8_t *bin, uint8_t *raw, int binSize, int rawSize) {
-    int in, out;
-    uint8_t bit, data = 0;
-
-    memset(raw, 0xff, rawSize);
-    for (bit = 1, out = 0, in = 0; in<binSize * 8; in++) {
-        if ((in & 7) == 0) {
-            data = *bin;
-            bin++;
-        }
-        bit = (bit << 7) | (1 & (data >> (in & 7)));   //LSB first
-                                                                      //     bit = (bit<<7) | (1 & (bin[in/8]>>(in%8)));   //LSB first
-        switch (bit) {
-        case 0x00:  //10 10
-            out++;
-            raw[out]++;
-            break;
-        case 0x01:  //10 01
-        case 0x81:  //01 01
-            raw[out]++;
-            out++;
-            break;
-        case 0x80:  //01 10
-            raw[out] += 2;
-            break;
-        }
-    }
-    memset(raw + out, 3, rawSize - out);  //fill remainder with (undefined)
-}
-
-//check for gap at EOF
-bool looks_like_file_end(uint8_t *raw, int start, int rawSize) {
-    enum {
-        MIN_GAP = 976 - 100,
-        MAX_GAP = 976 + 100,
-    };
-    int zeros = 0;
-    int in = start;
-    for (; in<start + MAX_GAP && in<rawSize; in++) {
-        if (raw[in] == 1 && zeros>MIN_GAP) {
-            return true;
-        }
-        else if (raw[in] == 0) {
-            zeros++;
-        }
-        if (raw[in] != 0)
-            zeros = 0;
-    }
-    return in >= rawSize;  //end of disk = end of file!
-}
-
-//detect EOF by looking for good CRC.  in=start of file
-//returns 0 if nothing found
-int crc_detect(uint8_t *raw, int in, int rawSize) {
-    static uint32_t crc;
-    static uint8_t bitval;
-    static int out;
-    static bool match;
-
-    //local function ;)
-    struct {
-        void shift(uint8_t bit) {
-            crc |= bit << 16;
-            if (crc & 1) crc ^= 0x10810;
-            crc >>= 1;
-            bitval = bit;
-            out++;
-            if (crc == 0 && !(out & 7))  //on a byte bounary and CRC is valid
-                match = true;
-        }
-    } f;
-
-    crc = 0x8000;
-    bitval = 1;
-    out = 0;
-    do {
-        match = false;
-        switch (raw[in] | (bitval << 4)) {
-        case 0x11:
-            f.shift(0);
-        case 0x00:
-            f.shift(0);
-            break;
-        case 0x12:
-            f.shift(0);
-        case 0x01:
-        case 0x10:
-            f.shift(1);
-            break;
-        default:    //garbage / bad encoding
-            return 0;
-        }
-        in++;
-    } while (in<rawSize && !(match && looks_like_file_end(raw, in, rawSize)));
-    return match ? in : 0;
-}
-
-//gap end is known, backtrack and mark the start.  !! this assumes junk data exists between EOF and gap start
-static void mark_gap_start(QStringList *messages, uint8_t *raw, int gapEnd) {
-    int i;
-    QString str;
-    for (i = gapEnd - 1; i >= 0 && raw[i] == 0; --i)
-    {
-    }
-    raw[i + 1] = 3;
-
-    str.sprintf("mark gap %X-%X\n", i + 1, gapEnd);
-    messages->append(str);
-}
-
-//For information only for now.  This checks for standard file format
-static void verify_block(QStringList *messages, uint8_t *bin, int start, int *reverse) {
-    enum { MAX_GAP = (976 + 100) / 8, MIN_GAP = (976 - 100) / 8 };
-    static const uint8_t next[] = { 0,2,3,4,3 };
-    static int last = 0;
-    static int lastLen = 0;
-    static int blockCount = 0;
-    QString str, str2;
-
-    int len = 0;
-    uint8_t type = bin[start];
-
-    str.sprintf("%d:%X", ++blockCount, type);
-
-    switch (type) {
-    case 1:
-        len = 0x38;
-        break;
-    case 2:
-        len = 2;
-        break;
-    case 3:
-        len = 16;
-        break;
-    case 4:
-        len = 1 + (bin[last + 13] | (bin[last + 14] << 8));
-        break;
-    default:
-        str2.sprintf(" bad block (%X)\n", start);
-        messages->append(str + str2);
-        return;
-    }
-    str2.sprintf(" %X-%X / %X-%X(%X)", reverse[start], reverse[start + len], start, start + len, len);
-
-    str += str2;
-    if ((!last && type != 1) || (last && type != next[bin[last]]))
-        str += QString(", wrong filetype");
-    if (calc_crc(bin + start, len + 2) != 0)
-        str += QString(", bad CRC");
-    if (last && (last + lastLen + MAX_GAP)<start)
-        str += QString(", lost block?");
-    if (last + lastLen + MIN_GAP>start)
-        str += QString(", block overlap?");
-    //if(type==3 && ...)    //check other fields in file header?
-
-    str += "\n";
-    messages->append(str);
-    last = start;
-    lastLen = len;
-}
-
-//find gap + gap end.  returns bit following gap end, >=rawSize if not found.
-int nextGapEnd(uint8_t *raw, int in, int rawSize) {
-    enum { MIN_GAP = 976 - 100, };
-    int zeros = 0;
-    for (; (raw[in] != 1 || zeros<MIN_GAP) && in<rawSize; in++) {
-        if (raw[in] == 0) {
-            zeros++;
-        }
-        else {
-            zeros = 0;
-        }
-    }
-    return in + 1;
-}
-
-
-/*
-Try to create byte-for-byte, unadulterated representation of disk.  Use hints from the disk structure, given
-that it's probably a standard FDS game image but this should still make a best attempt regardless of the disk content.
-
-_bin and _binSize are updated on exit.  alloc'd buffer is returned in _bin, caller is responsible for freeing it.
-*/
-static void raw03_to_bin(QStringList *messages, uint8_t *raw, int rawSize, uint8_t **_bin, int *_binSize) {
-    enum {
-        BINSIZE = 0xa0000,
-        POST_GLITCH_GARBAGE = 16,
-        LONG_POST_GLITCH_GARBAGE = 64,
-        LONG_GAP = 900,   //976 typ.
-        SHORT_GAP = 16,
-    };
-    int in, out;
-    uint8_t *bin;
-    int *reverse;
-    int glitch;
-    int zeros;
-    QString str;
-
-    bin = (uint8_t*)malloc(BINSIZE);
-    reverse = (int*)malloc(BINSIZE*sizeof(int));
-    memset(bin, 0, BINSIZE);
-
-    //--- assume any glitch is OOB, mark a run of zeros near a glitch as a gap start.
-
-    int junk = 0;
-    glitch = 0;
-    zeros = 0;
-    junk = 0;
-    for (in = 0; in<rawSize; in++) {
-        if (raw[in] == 3) {
-            glitch = in;
-            junk = 0;
-        }
-        else if (raw[in] == 1 || raw[in] == 2) {
-            junk = in;
-        }
-        else if (raw[in] == 0) {
-            zeros++;
-            if (glitch && junk && zeros>SHORT_GAP && (junk - glitch)<POST_GLITCH_GARBAGE) {
-                mark_gap_start(messages, raw, in);
-                glitch = 0;
-            }
-        }
-        if (raw[in] != 0)
-            zeros = 0;
-    }
-
-    //--- Walk filesystem, mark blocks where something looks like a valid file
-
-    in = findFirstBlock(raw);
-    if (in>0) {
-        str.sprintf("header at %X\n", in);
-        messages->append(str);
-        mark_gap_start(messages, raw, in - 1);
-    }
-    /*
-    do {
-    if(block_decode(..)) {
-    raw[head]=0xff;
-    raw[tail]=3;
-    }
-    next_gap(..);
-    } while(..);
-    */
-    //--- Identify files by CRC. If data looks like it's surrounded by gaps and it has a valid CRC where we
-    //    expect one to be, assume it's a file and mark its start/end.
-
-    in = findFirstBlock(raw) + 1;
-    if (in>0) do {
-        out = crc_detect(raw, in, rawSize);
-        if (out) {
-            str.sprintf("crc found %X-%X\n", in, out);
-            messages->append(str);
-            raw[out] = 3;     //mark glitch (gap start)
-                                    //raw[in-1]=0xff;   //mark gap end
-        }
-        in = nextGapEnd(raw, out ? out : in, rawSize);
-    } while (in<rawSize);
-
-    //--- mark gap start/end using glitches to find gap start
-
-    for (glitch = 0, zeros = 0, in = 0; in<rawSize; in++) {
-        if (raw[in] == 3) {
-            glitch = in;
-        }
-        else if (raw[in] == 1) {
-            if (zeros>LONG_GAP && (in - zeros - LONG_POST_GLITCH_GARBAGE)<glitch) {
-                mark_gap_start(messages, raw, in);
-                raw[in] = 0xff;
-            }
-        }
-        else if (raw[in] == 0) {
-            zeros++;
-        }
-        if (raw[in] != 0)
-            zeros = 0;
-    }
-
-    //--- output
-
-    /*
-    FILE *f=fopen("raw03.bin","wb");
-    fwrite(raw,1,rawSize,f);
-    fclose(f);
-    */
-
-    char bitval = 0;
-    int lastBlockStart = 0;
-    for (in = 0, out = 0; in<rawSize; in++) {
-        switch (raw[in] | (bitval << 4)) {
-        case 0x11:
-            out++;
-        case 0x00:
-            out++;
-            bitval = 0;
-            break;
-        case 0x12:
-            out++;
-        case 0x01:
-        case 0x10:
-            bin[out / 8] |= 1 << (out & 7);
-            out++;
-            bitval = 1;
-            break;
-        case 0xff:  //block end
-            if (lastBlockStart)
-                verify_block(messages, bin, lastBlockStart, reverse);
-            bin[out / 8] = 0x80;
-            out = (out | 7) + 1;      //byte-align for readability
-            lastBlockStart = out / 8;
-            bitval = 1;
-            break;
-        case 0x02:
-            //printf("Encoding error @ %X(%X)\n",in,out/8);
-        default: //anything else (glitch)
-            out++;
-            bitval = 0;
-            break;
-        }
-        reverse[out / 8] = in;
-    }
-    //last block
-    verify_block(messages, bin, lastBlockStart, reverse);
-
-    *_bin = bin;
-    *_binSize = out / 8 + 1;
-    free(reverse);
-}
-
 // TODO - only handles one side, files will need to be joined manually
 bool FDS_readDisk(char *filename_raw, char *filename_bin, char *filename_fds, void(*callback)(void*,int), void *data) {
     enum { READBUFSIZE = 0x90000 };
@@ -709,7 +214,10 @@ bool FDS_readDisk(char *filename_raw, char *filename_bin, char *filename_fds, vo
     //decode to .fds
     if (filename_fds) {
         uint8_t *fds = (uint8_t*)malloc(FDSSIZE + 16);   //extra room for CRC junk
-        raw03_to_fds(readBuf, fds, bytesIn);
+        TDecoderContext ctx;
+
+        decoder_init(&ctx, decoder_print, 0);
+        raw03_to_fds(&ctx, readBuf, fds, bytesIn);
         if ((f = fopen(filename_fds, "wb"))) {
             fwrite(fds, 1, FDSSIZE, f);
             fclose(f);
@@ -722,9 +230,10 @@ bool FDS_readDisk(char *filename_raw, char *filename_bin, char *filename_fds, vo
     else if (filename_bin) {
         uint8_t *binBuf;
         int binSize;
-        QStringList messages;
+        TDecoderContext ctx;
 
-        raw03_to_bin(&messages, readBuf, bytesIn, &binBuf, &binSize);
+        decoder_init(&ctx, 0, 0);
+        raw03_to_bin(&ctx, readBuf, bytesIn, &binBuf, &binSize);
         if ((f = fopen(filename_bin, "wb"))) {
             fwrite(binBuf, 1, binSize, f);
             fclose(f);
@@ -737,56 +246,281 @@ bool FDS_readDisk(char *filename_raw, char *filename_bin, char *filename_fds, vo
     return true;
 }
 
-bool FDS_readDisk2(QStringList *messages, uint8_t **rawbuf, int *rawlen, uint8_t **binbuf, int *binlen, void(*callback)(void*,int), void *data) {
-    enum { READBUFSIZE = 0x90000 };
+//One disk revolution into buf.  Packets lost in transfer don't stop the read: their place is filled with
+//glitches (so offsets stay where they'd be on disk) and the range is added to lost.
+//decoder is fed as data comes in, if there is one.  packets (if not 0) gets where each packet went, for the
+//capture file.  callback gets the revolution so far every few packets.
+static bool capture_revolution(QStringList *messages, uint8_t *buf, int bufSize, int *size, std::vector<TRawRange> *lost,
+    std::vector<TCapPacket> *packets, CStreamDecoder *decoder, void(*callback)(void*,uint8_t*,int), void *data) {
+    enum { FILLER = 0x00 };     //decodes as a glitch (3)
+
+    int bytesIn = 0;
+    int nextCallback = DISK_READMAX * 32;
+    TCapturePacket *packet;
+    bool finished;
+    uint8_t expect = 1;         //DiskReadStart restarts the sequence at 1
+    int fill;
+    QString str;
+
+    //the adapter is polled from its own thread, this one only decodes and keeps the GUI alive
+    CCapture capture(&dev);
+
+    if (!capture.Start(bufSize, true)) {
+        messages->append("DiskReadStart failed\n");
+        return false;
+    }
+    if (!capture.IsLocked()) {
+        messages->append("Couldn't lock capture buffers in memory.\n");
+    }
+    for (;;) {
+        finished = capture.IsDone();
+        if ((packet = capture.Peek()) == 0) {
+            if (finished)
+                break;
+            sleep_ms(1);
+            continue;
+        }
+
+        //sequence is only 8 bits, more than 255 packets lost in a row can't be detected
+        if (packet->len > 0 && packet->seq != expect) {
+            fill = (uint8_t)(packet->seq - expect) * DISK_READMAX;
+            if (fill > bufSize - bytesIn - packet->len)
+                fill = bufSize - bytesIn - packet->len;
+            if (fill > 0) {
+                TRawRange range = { bytesIn, bytesIn + fill };
+                TCapPacket info = { (uint32_t)bytesIn, packet->micros, (uint16_t)fill, expect, CAPPACKET_FILLER };
+
+                if (packets)
+                    packets->push_back(info);
+                memset(buf + bytesIn, FILLER, fill);
+                if (decoder)
+                    decoder->Feed(buf + bytesIn, fill);
+                bytesIn += fill;
+                lost->push_back(range);
+            }
+        }
+        if (packet->len > 0)
+            expect = packet->seq + 1;
+        if (packet->len > bufSize - bytesIn)
+            packet->len = bufSize - bytesIn;
+
+        if (packets && packet->len > 0) {
+            TCapPacket info = { (uint32_t)bytesIn, packet->micros, (uint16_t)packet->len, packet->seq, 0 };
+
+            packets->push_back(info);
+        }
+        memcpy(buf + bytesIn, packet->data, packet->len);
+        if (decoder)
+            decoder->Feed(buf + bytesIn, packet->len);
+        bytesIn += packet->len;
+        capture.Release();
+        if (callback && bytesIn >= nextCallback) {
+            callback(data, buf, bytesIn);
+            nextCallback += DISK_READMAX * 32;
+        }
+    }
+    capture.Stop();
+
+    str.sprintf("Capture: %d packets, %d late polls (longest %dus), %d sequence gaps, %d overruns%s\n",
+        (int)capture.Packets, (int)capture.LatePolls, (int)capture.MaxPollGap, (int)capture.SequenceGaps,
+        (int)capture.Overruns, capture.IsElevated() ? "" : ", normal priority");
+    messages->append(str);
+
+    *size = bytesIn;
+    if (capture.IsFailed()) {
+        messages->append("Read error.\n");
+        return false;
+    }
+    return true;
+}
+
+//reads = number of revolutions to try for bad blocks (1 = single read)
+//rawbuf = the revolution most of the result was decoded from, quant = pulse width thresholds it was decoded with
+//record = every revolution read is added to it for saving, can be 0
+//callback = data of the revolution being read as it comes in (starts over at each revolution)
+bool FDS_readDisk2(QStringList *messages, uint8_t **rawbuf, int *rawlen, uint8_t **binbuf, int *binlen, int reads, TQuantizer *quant,
+    CCaptureWriter *record, void(*callback)(void*,uint8_t*,int), void *data) {
+    enum {
+        READBUFSIZE = 0x90000,
+        MAX_REREAD = 2,         //extra revolutions to fill in lost packets
+    };
 
     FILE *f;
     uint8_t *readBuf = NULL;
-    int result;
     int bytesIn = 0;
+    std::vector<TRawRange> lost;
+    std::vector<TCapPacket> packets;
+    bool merged = false;
+    uint8_t *raw03;
+    uint32_t hist[256];
+    TQuantizer q;
+    int i;
+    QString str;
 
+    quantizer_default(quant);
     *rawbuf = 0;
     *rawlen = 0;
     *binbuf = 0;
     *binlen = 0;
 
+    readBuf = (uint8_t*)malloc(READBUFSIZE);
+    memset(readBuf, 0, READBUFSIZE);
+
+    //blocks are decoded and reported while the disk is still spinning
+    TDecoderContext ctx;
+    CStreamDecoder decoder(&ctx, READBUFSIZE);
+
+    decoder_init(&ctx, decoder_append, messages);
+
     messages->append("Started read...\n");
     //if(!(dev_readIO()&MEDIA_SET)) {
     //    printf("Warning - Disk not inserted?\n");
     //}
-    if (!dev.DiskReadStart()) {
-        messages->append("DiskReadStart failed\n");
+    if (!capture_revolution(messages, readBuf, READBUFSIZE, &bytesIn, &lost, &packets, &decoder, callback, data)) {
+        free(readBuf);
         return false;
     }
+    if (record)
+        record->AddRevolution(readBuf, bytesIn, packets.size() ? &packets[0] : 0, (int)packets.size());
 
-    readBuf = (uint8_t*)malloc(READBUFSIZE);
+    //read again and take only the missing parts from the new capture
+    for (i = 0; i < MAX_REREAD && lost.size() > 0; i++) {
+        uint8_t *buf2 = (uint8_t*)malloc(READBUFSIZE);
+        uint8_t *out;
+        int size2, outSize, remaining;
+        std::vector<TRawRange> lost2;
+        std::vector<TRawRange> outLost(lost.size());
+        std::vector<TCapPacket> packets2;
 
-    do {
-        result = dev.DiskRead(readBuf + bytesIn);
-        bytesIn += result;
-        if (!(bytesIn % ((DISK_READMAX)* 32))) {
-            if(callback) {
-                callback(data,bytesIn);
-            }
-//            printf(".");
+        str.sprintf("Data lost in %d places, reading again to fill them in...\n", (int)lost.size());
+        messages->append(str);
+        if (!capture_revolution(messages, buf2, READBUFSIZE, &size2, &lost2, &packets2, 0, callback, data)) {
+            free(buf2);
+            break;
         }
-    } while (result == DISK_READMAX && bytesIn<READBUFSIZE - DISK_READMAX);
-    printf("\n");
-
-    if (result<0) {
-        messages->append("Read error.\n");
+        if (record)
+            record->AddRevolution(buf2, size2, packets2.size() ? &packets2[0] : 0, (int)packets2.size());
+        remaining = capture_merge(readBuf, bytesIn, &lost[0], (int)lost.size(), buf2, size2,
+            lost2.size() ? &lost2[0] : 0, (int)lost2.size(), &out, &outSize, &outLost[0]);
+        str.sprintf("Recovered %d of %d.\n", (int)lost.size() - remaining, (int)lost.size());
+        messages->append(str);
+        free(buf2);
         free(readBuf);
-        free(*rawbuf);
-        return false;
+        readBuf = out;
+        bytesIn = outSize;
+        lost.assign(outLost.begin(), outLost.begin() + remaining);
+        merged = true;
     }
 
     *rawbuf = (uint8_t*)malloc(bytesIn);
     *rawlen = bytesIn;
     memcpy(*rawbuf,readBuf,bytesIn);
+    if (record && merged)
+        record->AddMerged(readBuf, bytesIn, lost.size() ? &lost[0] : 0, (int)lost.size());
 
-    raw_to_raw03(readBuf, bytesIn);
+    messages->append("Read done, decoding...\n");
+    ctx.lost = lost.size() ? &lost[0] : 0;
+    ctx.lostCount = (int)lost.size();
+    if (!merged) {
+        //full decode of the capture, same as raw03_to_bin
+        decoder.Finish(binbuf, binlen);
+        raw03 = decoder.GetRaw03();
+    }
+    else {
+        raw_to_raw03(readBuf, bytesIn);
+        raw03_to_bin(&ctx, readBuf, bytesIn, binbuf, binlen);
+        raw03 = readBuf;
+    }
 
-    raw03_to_bin(messages,readBuf, bytesIn, binbuf, binlen);
+    //pulse widths of this capture, the fitted thresholds are one of the decodes tried below
+    raw_histogram(*rawbuf, *rawlen, hist);
+    if (quantizer_from_histogram(&q, hist)) {
+        str.sprintf("Pulse widths %02X/%02X/%02X, thresholds %02X/%02X/%02X/%02X\n", q.center[0], q.center[1], q.center[2],
+            q.limit[0], q.limit[1], q.limit[2], q.limit[3]);
+        messages->append(str);
+    }
+    if (ctx.suspectBlocks) {
+        str.sprintf("%d blocks have lost data, read the disk again.\n", ctx.suspectBlocks);
+        messages->append(str);
+    }
+    if (ctx.correctedBlocks) {
+        str.sprintf("%d blocks had bad CRCs fixed by flipping a bit.\n", ctx.correctedBlocks);
+        messages->append(str);
+    }
+
+    //bad CRCs: decode the capture again with other thresholds and glitch policies on all processors, then
+    //read more revolutions (same again for each) until every block has a good CRC somewhere
+    //blocks repaired from the CRC alone count as bad here, a real read of them wins if there is one
+    if (ctx.badBlocks || ctx.correctedBlocks || reads > 1) {
+        CMultiRead multi(&ctx);
+        std::vector<THypothesis> hypotheses;
+        std::vector<TQuantizer> readQuant;      //thresholds of each read added to multi
+        std::vector<int> readRev;               //revolution of each read, index into revs (-1 = *rawbuf)
+        std::vector<uint8_t*> revs;             //revolutions read here
+        std::vector<int> revSizes;
+        int bad = ctx.badBlocks + ctx.correctedBlocks;
+        int h, rev;
+
+        hypothesis_defaults(&hypotheses, hist);
+        TRawRange *lostRanges = lost.size() ? &lost[0] : 0;
+
+        multi.Add(raw03, bytesIn, lostRanges, (int)lost.size(), hypotheses[0].name);
+        readQuant.push_back(hypotheses[0].quant);
+        readRev.push_back(-1);
+        if (bad) {
+            str.sprintf("%d bad or CRC-repaired blocks, trying %d other ways to decode...\n", bad, (int)hypotheses.size() - 1);
+            messages->append(str);
+            hypothesis_decode(&multi, &ctx, hypotheses, 1, *rawbuf, bytesIn, lostRanges, (int)lost.size());
+            for (h = 1; h < (int)hypotheses.size(); h++) {
+                readQuant.push_back(hypotheses[h].quant);
+                readRev.push_back(-1);
+            }
+        }
+        bad = multi.Combine();
+        for (i = 1; i < reads && bad > 0; i++) {
+            uint8_t *buf2 = (uint8_t*)malloc(READBUFSIZE);
+            int size2;
+            std::vector<TRawRange> lost2;
+            std::vector<TCapPacket> packets2;
+            char prefix[16];
+
+            str.sprintf("%d bad or CRC-repaired blocks, reading again (%d of %d)...\n", bad, i + 1, reads);
+            messages->append(str);
+            if (!capture_revolution(messages, buf2, READBUFSIZE, &size2, &lost2, &packets2, 0, callback, data)) {
+                free(buf2);
+                break;
+            }
+            if (record)
+                record->AddRevolution(buf2, size2, packets2.size() ? &packets2[0] : 0, (int)packets2.size());
+            snprintf(prefix, sizeof(prefix), "read %d, ", i + 1);
+            hypothesis_decode(&multi, &ctx, hypotheses, 0, buf2, size2, lost2.size() ? &lost2[0] : 0, (int)lost2.size(), prefix);
+            for (h = 0; h < (int)hypotheses.size(); h++) {
+                readQuant.push_back(hypotheses[h].quant);
+                readRev.push_back((int)revs.size());
+            }
+            revs.push_back((uint8_t*)realloc(buf2, size2));
+            revSizes.push_back(size2);
+            bad = multi.Combine();
+        }
+        if (multi.GetReads() > 1) {
+            multi.Report();
+            str.sprintf("%d decodes, %d blocks still bad or only CRC-repaired.\n", multi.GetReads(), bad);
+            messages->append(str);
+            free(*binbuf);
+            multi.GetResult(binbuf, binlen);
+            *quant = readQuant[multi.GetWinner()];
+
+            //the thresholds only fit the revolution they came from
+            if ((rev = readRev[multi.GetWinner()]) >= 0) {
+                free(*rawbuf);
+                *rawbuf = revs[rev];
+                *rawlen = revSizes[rev];
+                revs[rev] = 0;
+            }
+        }
+        for (rev = 0; rev < (int)revs.size(); rev++)
+            free(revs[rev]);
+    }
 
 /*    if (filename_raw) {
         if ((f = fopen(filename_raw, "wb"))) {
@@ -824,6 +558,8 @@ bool FDS_readDisk2(QStringList *messages, uint8_t **rawbuf, int *rawlen, uint8_t
         free(binBuf);
     }*/
 
+    if (record)
+        record->SetQuantizer(quant);
     free(readBuf);
     return true;
 }
@@ -856,7 +592,9 @@ bool FDS_writeDisk(char *filename) {
     uint8_t *zero = 0;
     int filesize;
     int binSize;
+    TDecoderContext ctx;
 
+    decoder_init(&ctx, decoder_print, 0);
     if (!loadfile(filename, &inbuf, &filesize))
     {
         printf("Can't read %s\n", filename); return false;
@@ -881,7 +619,7 @@ bool FDS_writeDisk(char *filename) {
             return(false);
         }
         memset(bin, 0, LEAD_IN);
-        binSize = fds_to_bin(bin + LEAD_IN, inbuf + inpos, DISKSIZE - LEAD_IN);
+        binSize = fds_to_bin(bin + LEAD_IN, inbuf + inpos, DISKSIZE - LEAD_IN, &ctx);
         if (!binSize)
             break;
         if (!writeDisk2(bin, binSize + LEAD_IN))
@@ -921,12 +659,14 @@ bool read_flash(char *filename_fds, int slot)
         RAWSIZE = SLOTSIZE * 8,
     };
 
-    static uint8_t fwnesHdr[16] = { 0x46, 0x44, 0x53, 0x1a, };
+    uint8_t fwnesHdr[16] = { 0x46, 0x44, 0x53, 0x1a, };
 
     FILE *f;
     uint8_t *bin, *raw, *fds;
     bool result = true;
+    TDecoderContext ctx;
 
+    decoder_init(&ctx, decoder_print, 0);
     f = fopen(filename_fds, "wb");
     if (!f) {
         printf("Can't create %s\n", filename_fds);
@@ -941,24 +681,23 @@ bool read_flash(char *filename_fds, int slot)
     raw = (uint8_t*)malloc(RAWSIZE);      //..to raw03
     fds = (uint8_t*)malloc(FDSSIZE);      //..to FDS
 
-    int side = 0;
-    for (; side + slot <= (int)dev.Slots; side++) {
-        if (!dev.Flash->Read(bin,(slot + side)*SLOTSIZE, SLOTSIZE)) {
-            result = false;
-            break;
-        }
+    //sides can be spread over the flash, chained with nextslot
+    std::vector<int> slots;
+    if (dev.FlashUtil->GetSides(slot, &slots) == 0) {
+        printf("Warning! Not first side of game\n");
+        slots.push_back(slot);
+    }
 
-        if (bin[0] == 0xff || (bin[0] != 0 && side != 0)) {    //stop on empty slot or next game
+    for (int side = 0; side < (int)slots.size(); side++) {
+        if (!dev.Flash->Read(bin,slots[side]*SLOTSIZE, SLOTSIZE)) {
+            result = false;
             break;
         }
-        else if (bin[0] == 0 && side == 0) {
-            printf("Warning! Not first side of game\n");
-        }
 
         printf("Side %d\n", side + 1);
         memset(bin, 0, FLASHHEADERSIZE);  //clear header, use it as lead-in
         bin_to_raw03(bin, raw, SLOTSIZE, RAWSIZE);
-        if (!raw03_to_fds(raw, fds, RAWSIZE)) {
+        if (!raw03_to_fds(&ctx, raw, fds, RAWSIZE)) {
             result = false;
             break;
         }
@@ -1041,11 +780,11 @@ bool write_flash(char *filename, int slot, void *data, void(*callback)(void*,uin
         for (i = 1; i < dev.Slots; i++) {
 
             //check if slot is empty
-            if (headers[i].filename[0] == 0xFF) {
+            if (dev.FlashUtil->IsFree(i)) {
 
                 //check for more empty slots adjacent to this one
                 for (j = 1; j < totalslots; j++) {
-                    if (headers[i + j].filename[0] != 0xFF) {
+                    if (dev.FlashUtil->IsFree(i + j) == false) {
                         break;
                     }
                 }
@@ -1081,28 +820,16 @@ bool write_flash(char *filename, int slot, void *data, void(*callback)(void*,uin
     }
 
     outbuf = new uint8_t[SLOTSIZE];
+    if(duplicate == 0) {
+        strcpy(headerName,shortName);
+    }
+    else {
+        sprintf(headerName,"%s (%d)",shortName,duplicate);
+    }
 
     while (pos<filesize && inbuf[pos] == 0x01) {
         printf("Side %d", side + 1);
-        if (fds_to_bin(outbuf + FLASHHEADERSIZE, inbuf + pos, SLOTSIZE - FLASHHEADERSIZE)) {
-            memset(outbuf, 0, FLASHHEADERSIZE);
-            uint32_t chksum = chksum_calc(outbuf + FLASHHEADERSIZE, SLOTSIZE - FLASHHEADERSIZE);
-            outbuf[240] = (uint8_t)(chksum >> 0);
-            outbuf[241] = (uint8_t)(chksum >> 8);
-            outbuf[242] = (uint8_t)(chksum >> 16);
-            outbuf[243] = (uint8_t)(chksum >> 24);
-            outbuf[244] = DEFAULT_LEAD_IN & 0xff;
-            outbuf[245] = DEFAULT_LEAD_IN / 256;
-
-            if (side == 0) {
-                if(duplicate == 0) {
-                    strcpy(headerName,shortName);
-                }
-                else {
-                    sprintf(headerName,"%s (%d)",shortName,duplicate);
-                }
-                strncpy((char*)outbuf, headerName, 240);
-            }
+        if (flash_encode_side(outbuf, inbuf + pos, side == 0 ? headerName : 0)) {
             if(callback) {
                 callback(data, (side << 24) | 0x10000000);
             }
@@ -1151,23 +878,20 @@ int FDS_findSlot(char *name)
 
 int FDS_eraseSlot(int slot)
 {
-    TFlashHeader *headers = dev.FlashUtil->GetHeaders();
-    uint8_t *buf;
+    std::vector<int> slots;
 
     if(slot == 0) {
         QMessageBox::information(NULL,"Error","Cannot delete slot 0, it contains the loader.");
         return(1);
     }
-    dev.Flash->EraseSlot(slot);
-    for(uint32_t i=(slot + 1);i<dev.Slots;i++) {
-        buf = headers[i].filename;
-        if(buf[0]==0xff) {          //empty
-            return(0);
-        } else if(buf[0]!=0) {      //filename present
-            return(0);
-        } else {                    //next side
-            dev.Flash->EraseSlot(i);
-        }
+    //only the header sectors are erased, the rest of the slots in the background later
+    if(dev.FlashUtil->GetSides(slot, &slots) == 0) {
+        dev.Flash->EraseSlot(slot);
+        return(0);
+    }
+    if(dev.FlashUtil->Delete(slot) == false) {
+        QMessageBox::information(NULL,"Error","Cannot delete the disk image.");
+        return(1);
     }
     return(0);
 }
@@ -1244,45 +968,49 @@ MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow)
 {
-    QString str;
-
     statusLabel = new QLabel("Ready");
     ui->setupUi(this);
+    idleThread = 0;
+    idlePaused = 0;
+    idleTimer = new QTimer(this);
+    connect(idleTimer, SIGNAL(timeout()), this, SLOT(idleWork()));
     ui->statusBar->addWidget(statusLabel);
 
     setAcceptDrops(true);
 
     ui->listWidget->addAction(ui->action_Save);
+    ui->listWidget->addAction(ui->action_Rename);
 //    ui->listWidget->addAction(ui->action_Info);
     ui->listWidget->addAction(ui->action_Delete);
 
     ui->action_Write_disk->setEnabled(false);
 
     if(dev.Open() == false) {
-        QMessageBox::information(NULL,"Error","FDSemu not connected.");
-        exit(1);
+        if(QMessageBox::question(this, "Error", "FDSemu not connected.\n\nOpen a flash image file instead?", QMessageBox::Yes | QMessageBox::No) != QMessageBox::Yes ||
+            openImage() == false)
+            exit(1);
     }
 
-    str.sprintf("Opened %s, %dMB flash (firmware build %d, flashID %06X)\n", dev.DeviceName, dev.FlashSize / 0x100000, dev.Version, dev.FlashID);
-    statusLabel->setText(str);
-    statusLabel->adjustSize();
-
+    showDevice();
     updateList();
-
+    resumeJournal();
 }
 
 MainWindow::~MainWindow()
 {
+    pauseIdle();
     delete ui;
 }
 
 void MainWindow::updateList()
 {
+    IdlePause pause(this);
     TFlashHeader *headers;
-    QStringList list;
+    QList<QListWidgetItem*> items;
     QString str;
-    int empty = 0;
+    int empty = 0, split = 0;
     uint32_t i;
+    std::vector<int> slots;
 
     str.sprintf("Updating list...");
     ui->listWidget->setEnabled(false);
@@ -1292,39 +1020,60 @@ void MainWindow::updateList()
 
     dev.FlashUtil->ReadHeaders();
     headers = dev.FlashUtil->GetHeaders();
-    list.clear();
     if(headers == 0) {
         QMessageBox::information(NULL, "Error", "Device was disconnected or not found");
         return;
     }
     i = (dev.Version > 792) ? 0 : 1;
     for(;i<dev.Slots;i++) {
-        if(headers[i].filename[0] == 0xFF) {
+        if(headers[i].filename[0] == 0xFF || dev.FlashUtil->IsFree(i)) {
             empty++;
         }
         else if(headers[i].filename[0] != 0) {
-            QString str;
+            QString str, where;
+            QListWidgetItem *item;
 
+            //sides and where they are, split images are followed along their chain
             str.sprintf("%s",headers[i].filename);
-            list.append(str);
+            dev.FlashUtil->GetSides(i, &slots);
+            for(int side=0;side<(int)slots.size();side++) {
+                where += QString().sprintf("%s%d", side ? ", " : "", slots[side]);
+            }
+            if(slots.size() && slots.back() - slots.front() + 1 != (int)slots.size())
+                split++;
+            item = new QListWidgetItem(str);
+            item->setToolTip(QString().sprintf("%d side%s in slot%s ", (int)slots.size(), slots.size() == 1 ? "" : "s",
+                slots.size() == 1 ? "" : "s") + where);
+            items.append(item);
         }
     }
 
     str.sprintf("%d empty slots.", empty);
+    if(split)
+        str += QString().sprintf("  %d image%s split across slots.", split, split == 1 ? "" : "s");
+    if(dev.Flash->GetRetries() || dev.Flash->GetErrors())
+        str += QString().sprintf("  %u USB transfer%s retried, %u failed.", dev.Flash->GetRetries(), dev.Flash->GetRetries() == 1 ? "" : "s", dev.Flash->GetErrors());
     ui->listWidget->clear();
-    ui->listWidget->addItems(list);
+    for(int n=0;n<items.size();n++)
+        ui->listWidget->addItem(items[n]);
     ui->listWidget->sortItems(Qt::AscendingOrder);
     ui->label->setText(str);
     ui->label->adjustSize();
     ui->listWidget->setEnabled(true);
     qApp->processEvents();
+    idleTimer->start(20);
 }
 
 void MainWindow::openFiles(QStringList &list)
 {
-    WriteFilesDialog *wfd = new WriteFilesDialog(this);
+    IdlePause pause(this);
+    WriteFilesDialog *wfd;
     QString str;
 
+    if(resumeJournal() == false)
+        return;
+    wfd = new WriteFilesDialog(this);
+    ui->listWidget->setEnabled(false);
     wfd->writeFiles(list);
 
     delete wfd;
@@ -1366,6 +1115,8 @@ void MainWindow::on_actionE_xit_triggered()
 
 void MainWindow::on_action_Delete_triggered()
 {
+    IdlePause pause(this);
+
     if(ui->listWidget->selectedItems().count() == 1) {
         QString str = ui->listWidget->selectedItems().at(0)->text();
         int slot = FDS_findSlot((char*)str.toStdString().c_str());
@@ -1380,6 +1131,40 @@ void MainWindow::on_action_Delete_triggered()
     }
 }
 
+//only the header sector of the first side is rewritten
+void MainWindow::on_action_Rename_triggered()
+{
+    IdlePause pause(this);
+    QString str, name;
+    QByteArray newName;
+    int slot;
+    bool ok;
+
+    if(ui->listWidget->selectedItems().count() != 1) {
+        QMessageBox::information(NULL,"Error","Please select a disk image to rename in the list.");
+        return;
+    }
+    str = ui->listWidget->selectedItems().at(0)->text();
+    slot = FDS_findSlot(str.toLocal8Bit().data());
+    name = QInputDialog::getText(this, "Rename", "New name:", QLineEdit::Normal, str, &ok);
+    if(!ok || name == "" || name == str || slot == -1)
+        return;
+    newName = name.toLocal8Bit();
+    if(newName.size() >= 240) {
+        QMessageBox::information(NULL,"Error","The name is too long.");
+        return;
+    }
+    if(FDS_findSlot(newName.data()) != -1) {
+        QMessageBox::information(NULL,"Error","An image of that name is already stored in flash.");
+        return;
+    }
+    ui->listWidget->setEnabled(false);
+    if(dev.FlashUtil->Rename(slot, newName.constData()) == false) {
+        QMessageBox::information(NULL,"Error","Cannot rename the disk image.");
+    }
+    updateList();
+}
+
 void MainWindow::on_action_About_triggered()
 {
     QString str;
@@ -1408,6 +1193,8 @@ void MainWindow::on_action_Write_disk_image_triggered()
 
 void MainWindow::on_action_Save_disk_image_triggered()
 {
+    IdlePause pause(this);
+
     //save disk
     if(ui->listWidget->selectedItems().count() == 1) {
         QString str, filename;
@@ -1437,6 +1224,7 @@ void MainWindow::on_action_Save_triggered()
 
 void MainWindow::on_actionUpdate_loader_triggered()
 {
+    IdlePause pause(this);
     QString filename;
 
     if(dev.Version > 792) {
@@ -1460,7 +1248,9 @@ void MainWindow::on_actionUpdate_loader_triggered()
         else {
             WriteStatus *fw = new WriteStatus(this);
 
+            ui->listWidget->setEnabled(false);
             fw->writeloader(filename);
+            ui->listWidget->setEnabled(true);
         }
         delete[] buf;
     }
@@ -1473,6 +1263,7 @@ void MainWindow::on_action_Erase_triggered()
 
 void MainWindow::on_actionUpdate_firmware_triggered()
 {
+    IdlePause pause(this);
     QString filename;
 
     filename = QFileDialog::getOpenFileName(this, tr("Open firmware image"), "", tr("Firmware Images (*.bin)"));
@@ -1480,7 +1271,9 @@ void MainWindow::on_actionUpdate_firmware_triggered()
         WriteStatus *fw = new WriteStatus(this);
         QString str;
 
+        ui->listWidget->setEnabled(false);
         fw->writefirmware(filename);
+        ui->listWidget->setEnabled(true);
         str.sprintf("Opened %s, %dMB flash (firmware build %d, flashID %06X)\n", dev.DeviceName, dev.FlashSize / 0x100000, dev.Version, dev.FlashID);
         statusLabel->setText(str);
         statusLabel->adjustSize();
@@ -1490,7 +1283,338 @@ void MainWindow::on_actionUpdate_firmware_triggered()
 
 void MainWindow::on_action_Read_disk_triggered()
 {
+    IdlePause pause(this);
     DiskReadDialog *drd = new DiskReadDialog(this);
 
     drd->exec();
 }
+
+//status bar, and the actions that need the device itself
+void MainWindow::showDevice()
+{
+    QString str;
+    bool image = dev.IsImage();
+
+    if(image)
+        str.sprintf("Opened flash image %s, %dMB\n", dev.DeviceName, dev.FlashSize / 0x100000);
+    else
+        str.sprintf("Opened %s, %dMB flash (firmware build %d, flashID %06X)\n", dev.DeviceName, dev.FlashSize / 0x100000, dev.Version, dev.FlashID);
+    statusLabel->setText(str);
+    statusLabel->adjustSize();
+    ui->action_Read_disk->setEnabled(!image);
+    ui->actionUpdate_loader->setEnabled(!image);
+    ui->actionUpdate_firmware->setEnabled(!image);
+    ui->action_Push_image->setEnabled(image);
+    ui->action_Close_image->setEnabled(image);
+}
+
+//pick a flash image file to edit instead of the device, it's created if it doesn't exist (the size of the
+//device's flash, or 16mb)
+bool MainWindow::openImage()
+{
+    QString filename;
+    uint32_t size = (dev.FlashUtil && !dev.IsImage()) ? dev.FlashSize : CFlashImage::DEFAULT_SIZE;
+
+    filename = QFileDialog::getSaveFileName(this, tr("Open flash image"), "", tr("Flash images (*.bin)"), 0, QFileDialog::DontConfirmOverwrite);
+    if(filename == "")
+        return(false);
+    if(dev.OpenImage(filename.toLocal8Bit().constData(), QFile::exists(filename) == false, size) == false) {
+        QMessageBox::information(NULL,"Error","Cannot open the flash image.");
+        return(false);
+    }
+    return(true);
+}
+
+void MainWindow::on_action_Open_image_triggered()
+{
+    IdlePause pause(this);
+
+    if(resumeJournal() == false || openImage() == false)
+        return;
+    showDevice();
+    updateList();
+    resumeJournal();
+}
+
+void MainWindow::on_action_Close_image_triggered()
+{
+    IdlePause pause(this);
+    QByteArray image = QByteArray(dev.DeviceName);
+
+    if(dev.Open() == false) {
+        QMessageBox::information(NULL,"Error","FDSemu not connected.");
+        dev.OpenImage(image.constData(), false);
+    }
+    showDevice();
+    updateList();
+    resumeJournal();
+}
+
+//progress of a push in the label under the list
+static void push_callback(void *data, uint32_t sectors)
+{
+    QLabel *label = (QLabel*)data;
+
+    label->setText(QString().sprintf("Pushing... %u sectors", sectors));
+    label->adjustSize();
+    qApp->processEvents();
+}
+
+//the mirror remembers what the device held after the last push, so only what changed since is written
+void MainWindow::on_action_Push_image_triggered()
+{
+    IdlePause pause(this);
+    QByteArray mirror = (QDir::homePath() + "/.fdsemu-mirror").toLocal8Bit();
+    CFlashImage *image = (CFlashImage*)dev.Flash;
+    CDevice target;
+    QString str;
+
+    if(dev.IsImage() == false)
+        return;
+    if(target.Open() == false) {
+        QMessageBox::information(NULL,"Error","FDSemu not connected.");
+        return;
+    }
+    if(target.FlashSize != dev.FlashSize) {
+        str.sprintf("The flash image is %dMB, the device has %dMB of flash.", dev.FlashSize / 0x100000, target.FlashSize / 0x100000);
+        QMessageBox::information(NULL,"Error",str);
+        return;
+    }
+    if(QMessageBox::question(this, "Push flash image", "The flash of the device will be made the same as this image, disk images that are only on the device are lost.\n\n"
+        "Continue?", QMessageBox::Yes | QMessageBox::No) != QMessageBox::Yes)
+        return;
+
+    ui->listWidget->setEnabled(false);
+    if(image->Push(&target, mirror.constData(), push_callback, ui->label) == false) {
+        QMessageBox::information(NULL,"Error","Pushing the flash image failed.  Push it again to finish.");
+    }
+    else {
+        //whatever the device was in the middle of is gone now
+        QFile::remove(deviceJournalPath());
+        str.sprintf("The device matches the flash image, %u sector%s written.", image->GetPushed(), image->GetPushed() == 1 ? "" : "s");
+        QMessageBox::information(NULL,"Push flash image",str);
+    }
+    updateList();
+}
+
+//progress of a defrag run in the label under the list
+static void defrag_callback(void *data, int move, int step, int steps)
+{
+    QLabel *label = (QLabel*)data;
+
+    (void)move;
+    label->setText(QString().sprintf("Defragmenting... %d%%", steps ? step * 100 / steps : 100));
+    label->adjustSize();
+    qApp->processEvents();
+}
+
+//progress of a resumed write in the label under the list
+static void write_callback(void *data, int item, int side, uint32_t bytes)
+{
+    QLabel *label = (QLabel*)data;
+
+    label->setText(QString().sprintf("Writing... image %d, side %d, %d%%", item + 1, side + 1, bytes * 100 / SLOTSIZE));
+    label->adjustSize();
+    qApp->processEvents();
+}
+
+//finish an operation cut off last time, false if it's still unfinished (nothing else may use the journal then)
+bool MainWindow::resumeJournal()
+{
+    IdlePause pause(this);
+    QByteArray journal = journalPath().toLocal8Bit();
+
+    if(CFlashDefrag::Pending(journal.constData())) {
+        CFlashDefrag defrag(&dev);
+
+        //dropping it leaves the images copied so far listed twice, delete one of each to get the slots back
+        int answer = QMessageBox::question(this, "Defragment", "A defragment run was interrupted.  Finish it now?\n\n"
+            "Until then some disk images may be listed twice.  If it's discarded they stay that way.",
+            QMessageBox::Yes | QMessageBox::Discard | QMessageBox::Cancel);
+
+        if(answer == QMessageBox::Cancel)
+            return(false);
+        ui->listWidget->setEnabled(false);
+        if(answer == QMessageBox::Discard) {
+            defrag.Discard(journal.constData());
+            QFile::remove(journalPath());
+        }
+        else if(defrag.Resume(journal.constData(), defrag_callback, ui->label) == false &&
+            QMessageBox::question(this, "Error", "Cannot finish the defragment run, the flash doesn't match its journal.\n\nDiscard the journal?",
+            QMessageBox::Yes | QMessageBox::No) == QMessageBox::Yes) {
+            QFile::remove(journalPath());
+        }
+        updateList();
+        return(CFlashDefrag::Pending(journal.constData()) == false);
+    }
+    if(CFlashPlan::Pending(journal.constData())) {
+        CFlashPlan plan(&dev);
+
+        //the unfinished images have no name yet, dropping them erases their headers and the rest in the background
+        if(QMessageBox::question(this, "Write disk images", "Writing disk images was interrupted.  Finish writing them now?\n\n"
+            "If not, the partly written images are dropped.", QMessageBox::Yes | QMessageBox::No) != QMessageBox::Yes) {
+            plan.Discard(journal.constData());
+            QFile::remove(journalPath());
+            updateList();
+            return(true);
+        }
+        ui->listWidget->setEnabled(false);
+        if(plan.Resume(journal.constData(), write_callback, ui->label) == false) {
+            QMessageBox::information(NULL,"Error","Cannot finish writing the disk images.");
+        }
+        updateList();
+        return(CFlashPlan::Pending(journal.constData()) == false);
+    }
+    return(true);
+}
+
+void MainWindow::on_action_Defragment_triggered()
+{
+    IdlePause pause(this);
+    QByteArray journal = journalPath().toLocal8Bit();
+    CFlashDefrag defrag(&dev);
+    QString str;
+
+    if(resumeJournal() == false)
+        return;
+    if(defrag.Plan() == false) {
+        if(QMessageBox::question(this, "Defragment", "The empty slots can only be made one run by splitting some disk images across slots.  Split them?",
+            QMessageBox::Yes | QMessageBox::No) != QMessageBox::Yes)
+            return;
+        if(defrag.Plan(true) == false) {
+            QMessageBox::information(NULL,"Error","Cannot defragment the flash.");
+            return;
+        }
+    }
+    if(defrag.GetMoves() == 0 && defrag.GetFreeLength() > 0) {
+        QMessageBox::information(NULL,"Defragment","The empty slots are already together, nothing to do.");
+        return;
+    }
+    if(defrag.GetFreeLength() == 0) {
+        QMessageBox::information(NULL,"Defragment","There are no empty slots.");
+        return;
+    }
+
+    str.sprintf("%d disk image%s will be moved, %d side%s copied.\n\nThis takes about %d:%02d.  Afterwards slots %d to %d will be empty.\n\nContinue?",
+        defrag.GetMoves(), defrag.GetMoves() == 1 ? "" : "s", defrag.GetCopies(), defrag.GetCopies() == 1 ? "" : "s",
+        defrag.GetEstimate() / 60, defrag.GetEstimate() % 60, defrag.GetFreeStart(), defrag.GetFreeStart() + defrag.GetFreeLength() - 1);
+    if(QMessageBox::question(this, "Defragment", str, QMessageBox::Yes | QMessageBox::No) != QMessageBox::Yes)
+        return;
+
+    ui->listWidget->setEnabled(false);
+    if(defrag.Run(journal.constData(), defrag_callback, ui->label) == false) {
+        QMessageBox::information(NULL,"Error","Defragment failed.  It will be finished the next time this program is started.");
+    }
+    updateList();
+}
+//images are matched by name and content hash, so an unchanged folder is mostly a header scan
+//images are matched by name and checksums, so an unchanged folder is only a header scan
+void MainWindow::on_action_Sync_triggered()
+{
+    IdlePause pause(this);
+    QByteArray journal = journalPath().toLocal8Bit();
+    CFlashSync sync(&dev);
+    QString dir, str;
+    int adds, deletes;
+
+    if(resumeJournal() == false)
+        return;
+    dir = QFileDialog::getExistingDirectory(this, tr("Sync with folder"));
+    if(dir == "")
+        return;
+
+    ui->listWidget->setEnabled(false);
+    ui->label->setText("Reading folder...");
+    ui->label->adjustSize();
+    qApp->processEvents();
+    if(sync.Scan(QDir::toNativeSeparators(dir).toLocal8Bit().constData()) == false) {
+        QMessageBox::information(NULL,"Error","Cannot read the folder or the flash.");
+        updateList();
+        return;
+    }
+    adds = sync.Count(SYNC_ADD);
+    deletes = sync.Count(SYNC_DELETE);
+    if(adds == 0 && deletes == 0) {
+        QMessageBox::information(NULL,"Sync","The flash already holds the disk images in this folder.");
+        updateList();
+        return;
+    }
+    if(sync.GetNeededSlots() > sync.GetFreeSlots()) {
+        str.sprintf("The new disk images need %d slots, only %d are empty after deleting.\nNothing was changed.", sync.GetNeededSlots(), sync.GetFreeSlots());
+        QMessageBox::information(NULL,"Error",str);
+        updateList();
+        return;
+    }
+
+    str.sprintf("%d disk image%s will be written and %d deleted, %d %s already stored.", adds, adds == 1 ? "" : "s", deletes,
+        sync.Count(SYNC_KEEP) / 2, sync.Count(SYNC_KEEP) / 2 == 1 ? "is" : "are");
+    if(sync.Count(SYNC_BAD))
+        str += QString().sprintf("\n\n%d file%s in the folder %s not disk images.", sync.Count(SYNC_BAD), sync.Count(SYNC_BAD) == 1 ? "" : "s",
+            sync.Count(SYNC_BAD) == 1 ? "is" : "are");
+    str += "\n\nContinue?";
+    if(QMessageBox::question(this, "Sync", str, QMessageBox::Yes | QMessageBox::No) != QMessageBox::Yes) {
+        updateList();
+        return;
+    }
+
+    if(sync.Run(false, write_callback, ui->label, journal.constData()) == false) {
+        if(sync.GetNoRoom() && QMessageBox::question(this, "Sync", "Some of the new disk images don't fit in adjacent empty slots.\n\nThey can be split across the empty slots, "
+            "which needs firmware that follows the next slot field of the slot headers.\n\nSplit them?", QMessageBox::Yes | QMessageBox::No) == QMessageBox::Yes) {
+            if(sync.Run(true, write_callback, ui->label, journal.constData()) == false)
+                QMessageBox::information(NULL,"Error","Writing stopped.  The rest is written the next time this program is started.");
+        }
+        else if(sync.GetNoRoom() == false) {
+            QMessageBox::information(NULL,"Error","Writing stopped.  The rest is written the next time this program is started.");
+        }
+    }
+    updateList();
+}
+
+//IdleStep on a worker thread, an erase can take long enough to be noticed in the GUI
+static std::atomic<bool> idleBusy(false);
+static std::atomic<bool> idleMore(false);
+
+static void idle_step(void *arg)
+{
+    (void)arg;
+    idleMore = dev.FlashUtil->IdleStep();
+    idleBusy = false;
+}
+
+//wait for the idle step in progress and start no new ones until resumeIdle, for anything that uses the device
+void MainWindow::pauseIdle()
+{
+    idlePaused++;
+    if(idleThread) {
+        thread_join(idleThread);
+        idleThread = 0;
+    }
+}
+
+void MainWindow::resumeIdle()
+{
+    idlePaused--;
+}
+
+//one step of erasing deleted slots and checking empty ones at a time, only while the device isn't used for
+//anything else
+void MainWindow::idleWork()
+{
+    if(idleThread) {
+        if(idleBusy)
+            return;
+        thread_join(idleThread);
+        idleThread = 0;
+        if(idleMore == false) {
+            idleTimer->stop();
+            return;
+        }
+    }
+    if(idlePaused || QApplication::activeModalWidget() || !ui->listWidget->isEnabled() || !isActiveWindow())
+        return;
+    idleBusy = true;
+    if((idleThread = thread_start(idle_step, 0)) == 0) {
+        idleBusy = false;
+        idleTimer->stop();
+    }
+}
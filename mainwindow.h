@@ -3,6 +3,7 @@
 
 #include <QMainWindow>
 #include <QLabel>
+#include <QTimer>
 #include <stdint.h>
 #include "fdsemu-lib/Device.h"
 #include "fdsemu-lib/System.h"
@@ -11,6 +12,7 @@ extern CDevice dev;
 
 bool write_flash(char *filename, int slot, void *data, void(*callback)(void*,uint32_t));
 int FDS_getDiskSides(char *filename);
+QString journalPath();
 
 namespace Ui {
 class MainWindow;
@@ -24,14 +26,23 @@ public:
     explicit MainWindow(QWidget *parent = 0);
     ~MainWindow();
 
+    void pauseIdle();
+    void resumeIdle();
+
 protected:
     QLabel *statusLabel;
+    QTimer *idleTimer;      //runs IdleStep on a worker thread while nothing else is going on
+    void *idleThread;       //IdleStep in progress, 0 if none
+    int idlePaused;         //handlers using the device, see pauseIdle
 
 protected:
     void updateList();
     void openFiles(QStringList &list);
     void dragEnterEvent(QDragEnterEvent *event) Q_DECL_OVERRIDE;
     void dropEvent(QDropEvent *event) Q_DECL_OVERRIDE;
+    bool resumeJournal();
+    void showDevice();
+    bool openImage();
 
 private slots:
     void on_actionE_xit_triggered();
@@ -56,6 +67,20 @@ private slots:
 
     void on_action_Read_disk_triggered();
 
+    void on_action_Defragment_triggered();
+
+    void on_action_Sync_triggered();
+
+    void on_action_Rename_triggered();
+
+    void on_action_Open_image_triggered();
+
+    void on_action_Close_image_triggered();
+
+    void on_action_Push_image_triggered();
+
+    void idleWork();
+
 private:
     Ui::MainWindow *ui;
 };
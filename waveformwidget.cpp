@@ -0,0 +1,176 @@
+#include <QPainter>
+#include <QWheelEvent>
+#include <QMouseEvent>
+#include "waveformwidget.h"
+
+enum {
+    BLOCKROW = 14,          //block annotations at the top
+    SYMBOLROW = 8,          //raw03 symbols at the bottom
+    MINPIXELS = 8,          //most zoomed in: pixels per pulse
+};
+
+WaveformWidget::WaveformWidget(QWidget *parent) :
+    QWidget(parent)
+{
+    clear();
+}
+
+void WaveformWidget::clear()
+{
+    pyramid.Clear();
+    blocks.clear();
+    viewStart = 0;
+    viewLen = 0;
+    update();
+}
+
+void WaveformWidget::appendData(const uint8_t *raw, int size)
+{
+    bool follow = (viewStart == 0 && viewLen == pyramid.GetSize());
+
+    pyramid.Append(raw, size);
+    if (follow)
+        viewLen = pyramid.GetSize();
+    update();
+}
+
+void WaveformWidget::setData(const uint8_t *raw, int size, const TQuantizer *quant)
+{
+    pyramid.Clear(quant);
+    pyramid.Append(raw, size);
+    blocks.clear();
+    viewStart = 0;
+    viewLen = size;
+    update();
+}
+
+void WaveformWidget::setBlocks(const TBlockInfo *list, int count)
+{
+    blocks.assign(list, list + count);
+    update();
+}
+
+int WaveformWidget::toX(int pos)
+{
+    return(1 + (int)((int64_t)(pos - viewStart) * (width() - 2) / viewLen));
+}
+
+int WaveformWidget::toPos(int x)
+{
+    return(viewStart + (int)((int64_t)(x - 1) * viewLen / (width() - 2)));
+}
+
+//keep the view inside the capture and no closer than MINPIXELS per pulse
+void WaveformWidget::setView(int start, int len)
+{
+    int size = pyramid.GetSize();
+    int minLen = (width() - 2) / MINPIXELS;
+
+    if (len < minLen)
+        len = minLen;
+    if (len > size)
+        len = size;
+    if (start > size - len)
+        start = size - len;
+    if (start < 0)
+        start = 0;
+    viewStart = start;
+    viewLen = len;
+    update();
+}
+
+void WaveformWidget::paintEvent(QPaintEvent *event)
+{
+    QPainter painter(this);
+    const TQuantizer *quant = pyramid.GetQuantizer();
+    int top = BLOCKROW + 1, bottom = height() - SYMBOLROW - 2;
+    int i, x, x2, s, e;
+    TWaveSpan span;
+
+    (void)event;
+    painter.fillRect(rect(), Qt::white);
+    painter.setPen(Qt::gray);
+    painter.drawRect(0, 0, width() - 1, height() - 1);
+    if (viewLen == 0) {
+        painter.drawText(rect(), Qt::AlignCenter, "Capture");
+        return;
+    }
+
+    //blocks over the gaps: green good, yellow CRC fixed, orange lost data, red bad CRC
+    painter.fillRect(1, 1, width() - 2, BLOCKROW - 1, QColor(235, 235, 235));
+    for (i = 0; i < (int)blocks.size(); i++) {
+        TBlockInfo *b = &blocks[i];
+        QColor color = b->suspect ? QColor(255, 160, 60) : !b->crcOk ? QColor(230, 60, 60) : b->corrected ? QColor(240, 220, 60) : QColor(120, 200, 120);
+
+        if (b->rawEnd < viewStart || b->rawStart >= viewStart + viewLen)
+            continue;
+        x = qMax(toX(b->rawStart), 1);
+        x2 = qMin(toX(b->rawEnd), width() - 1);
+        painter.fillRect(x, 1, qMax(x2 - x, 1), BLOCKROW - 1, color);
+        if (x2 - x > 40) {
+            painter.setPen(Qt::black);
+            painter.drawText(QRect(x, 1, x2 - x, BLOCKROW - 1), Qt::AlignCenter, QString().sprintf("%d: type %d", i + 1, b->type));
+        }
+    }
+
+    //thresholds, pulse widths go up the widget
+    painter.setPen(QPen(Qt::gray, 1, Qt::DashLine));
+    for (i = 0; i < 4; i++) {
+        int y = bottom - quant->limit[i] * (bottom - top) / 256;
+
+        painter.drawLine(1, y, width() - 2, y);
+    }
+
+    //one min/max line and symbol mark per pixel column
+    for (x = 1; x < width() - 1; x++) {
+        s = toPos(x);
+        e = qMax(toPos(x + 1), s + 1);
+        if (!pyramid.Get(s, e, &span))
+            continue;
+        painter.setPen(Qt::darkBlue);
+        painter.drawLine(x, bottom - span.min * (bottom - top) / 256, x, bottom - span.max * (bottom - top) / 256);
+        if (span.symbols & 8)
+            painter.setPen(Qt::red);
+        else if (span.symbols == 1)
+            painter.setPen(QColor(200, 200, 200));
+        else if (span.symbols == 2)
+            painter.setPen(QColor(120, 120, 120));
+        else if (span.symbols == 4)
+            painter.setPen(Qt::black);
+        else
+            painter.setPen(Qt::darkCyan);
+        painter.drawLine(x, height() - SYMBOLROW - 1, x, height() - 2);
+    }
+
+    painter.setPen(Qt::black);
+    painter.drawText(4, top + 12, QString().sprintf("%X-%X of %X", viewStart, viewStart + viewLen, pyramid.GetSize()));
+}
+
+void WaveformWidget::wheelEvent(QWheelEvent *event)
+{
+    int pos = toPos(event->x());
+    int len = event->delta() > 0 ? viewLen / 2 : viewLen * 2;
+
+    if (viewLen == 0)
+        return;
+    setView(pos - (int)((int64_t)(pos - viewStart) * len / viewLen), len);
+}
+
+void WaveformWidget::mousePressEvent(QMouseEvent *event)
+{
+    dragX = event->x();
+    dragStart = viewStart;
+}
+
+void WaveformWidget::mouseMoveEvent(QMouseEvent *event)
+{
+    if (viewLen == 0 || !(event->buttons() & Qt::LeftButton))
+        return;
+    setView(dragStart - (int)((int64_t)(event->x() - dragX) * viewLen / (width() - 2)), viewLen);
+}
+
+void WaveformWidget::mouseDoubleClickEvent(QMouseEvent *event)
+{
+    (void)event;
+    setView(0, pyramid.GetSize());
+}
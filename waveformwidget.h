@@ -0,0 +1,50 @@
+#ifndef WAVEFORMWIDGET_H
+#define WAVEFORMWIDGET_H
+
+#include <QWidget>
+#include <stdint.h>
+#include <vector>
+#include "fdsemu-lib/Codec.h"
+#include "fdsemu-lib/WavePyramid.h"
+
+//Pulse widths of a disk capture along the revolution, with the raw03 symbols and the blocks found.
+//Wheel zooms around the mouse, dragging pans, double click shows the whole capture again.
+class WaveformWidget : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit WaveformWidget(QWidget *parent = 0);
+
+    void clear();
+
+    //add data of a capture still coming in, the view follows it while it shows everything
+    void appendData(const uint8_t *raw, int size);
+
+    //whole capture at once, symbols classified with quant
+    void setData(const uint8_t *raw, int size, const TQuantizer *quant);
+
+    //blocks from raw03_to_bin (rawStart/rawEnd are offsets into the capture)
+    void setBlocks(const TBlockInfo *list, int count);
+
+protected:
+    void paintEvent(QPaintEvent *event);
+    void wheelEvent(QWheelEvent *event);
+    void mousePressEvent(QMouseEvent *event);
+    void mouseMoveEvent(QMouseEvent *event);
+    void mouseDoubleClickEvent(QMouseEvent *event);
+
+private:
+    CWavePyramid pyramid;
+    std::vector<TBlockInfo> blocks;
+    int viewStart;      //first pulse shown
+    int viewLen;        //pulses across the widget
+    int dragX;
+    int dragStart;
+
+    int toX(int pos);
+    int toPos(int x);
+    void setView(int start, int len);
+};
+
+#endif // WAVEFORMWIDGET_H
@@ -5,13 +5,19 @@
 #include "ui_writefilesdialog.h"
 #include "mainwindow.h"
 
-void WriteFilesDialog::write_callback(void *data,uint32_t bytes)
+//item = plan item being written, bytes = progress within the side
+void WriteFilesDialog::write_callback(void *data,int item,int side,uint32_t bytes)
 {
     WriteFilesDialog *fw = (WriteFilesDialog*)data;
-    static int side = 0;
 
-    if(bytes & 0x10000000) {
-        side = (bytes >> 24) & 0xF;
+    if(item != fw->current) {
+        if(fw->current >= 0) {
+            fw->rows[fw->current]->setText(0,"Success");
+            fw->progressBarBase += fw->plan->GetItem(fw->current)->sides * 65500;
+        }
+        fw->current = item;
+        fw->rows[item]->setText(0,"Writing...");
+        fw->ui->diskProgressBar->setRange(0,fw->plan->GetItem(item)->sides * 65500);
     }
     fw->ui->progressBar->setValue(bytes + fw->progressBarBase + (side * 65500));
     fw->ui->diskProgressBar->setValue(bytes + (side * 65500));
@@ -23,6 +29,8 @@ WriteFilesDialog::WriteFilesDialog(QWidget *parent) :
     ui(new Ui::WriteFilesDialog)
 {
     ui->setupUi(this);
+    plan = 0;
+    current = -1;
 }
 
 WriteFilesDialog::~WriteFilesDialog()
@@ -30,68 +38,98 @@ WriteFilesDialog::~WriteFilesDialog()
     delete ui;
 }
 
+//the whole batch is planned before anything is erased, so it either fits or nothing is written
 void WriteFilesDialog::addFiles(QStringList &list)
 {
-    int i;
-    int size = 0, totalsize = 0;
+    static const char *stateNames[] = { "Not written", "No room", "Skipped", "Writing...", "Success", "Failed" };
+    int i, n, duplicates = 0;
+    int totalsize = 0;
 
     QStringList labels;
     QFileInfo fileinfo;
+    CFlashPlan batch(&dev);
 
     labels << "Status" << "Sides" << "Filename";
 //    QHeaderView *header = new QHeaderView;
 
     progressBarBase = 0;
+    plan = &batch;
+    rows.clear();
+    current = -1;
     ui->treeWidget->setHeaderLabels(labels);
     ui->treeWidget->header()->resizeSection(1,50);
 //    ui->treeWidget->setHeader(header);
+    if(batch.ReadCatalog() == false) {
+        QMessageBox::information(NULL, "Error", "Device was disconnected or not found");
+        return;
+    }
     for(i=0;i<list.size();i++) {
         QString filename = list.at(i);
         QString str;
-
-        fileinfo.setFile(filename);
-//        ui->listWidget->addItem(fileinfo.fileName());
         QTreeWidgetItem *item;
 
-        str.sprintf("%d", (int)(fileinfo.size() / 65500));
-        totalsize += (fileinfo.size() / 65500) * 65500;
+        fileinfo.setFile(filename);
         item = new QTreeWidgetItem();
-        item->setText(0,"");
-        item->setText(1,str);
         item->setText(2,fileinfo.fileName());
-        QVariant v;
-        v.setValue(filename);
-        item->setData(0,Qt::UserRole,v);
         ui->treeWidget->addTopLevelItem(item);
+        if((n = batch.AddFile(filename.toLocal8Bit().constData())) < 0) {
+            item->setText(0,"Not a disk image");
+            continue;
+        }
+        str.sprintf("%d", batch.GetItem(n)->sides);
+        item->setText(1,str);
+        rows.push_back(item);
+        if(batch.GetItem(n)->duplicate)
+            duplicates++;
     }
+    qApp->processEvents();
 
-    ui->progressBar->setRange(0,totalsize);
-    ui->progressBar->setValue(0);
+    if(duplicates) {
+        QString str;
 
-    for(i = 0; i < ui->treeWidget->topLevelItemCount(); ++i ) {
-        QTreeWidgetItem *item = ui->treeWidget->topLevelItem( i );
-        QString filename;
-        QVariant v;
+        str.sprintf("%d of these images have the same name as an image already stored in flash.\n\nDo you want to write another copy?", duplicates);
+        if(QMessageBox::information(NULL,"Error",str,QMessageBox::Yes,QMessageBox::No) == QMessageBox::No) {
+            for(i=0;i<batch.GetItems();i++) {
+                if(batch.GetItem(i)->duplicate)
+                    batch.Skip(i);
+            }
+        }
+    }
 
-        v = item->data(0,Qt::UserRole);
-        filename = v.value<QString>();
-        fileinfo.setFile(filename);
+    //capacity problems are reported before anything is touched.  images that only fit split up need firmware
+    //that follows nextslot, so that's asked first
+    bool fits = batch.Plan();
+    if(fits == false && batch.GetNeededSlots() <= batch.GetFreeSlots()) {
+        if(QMessageBox::information(NULL,"Message","Some of these disk images don't fit in adjacent empty slots.\n\nThey can be split across the empty slots, "
+            "which needs firmware that follows the next slot field of the slot headers.\n\nSplit them?",QMessageBox::Yes,QMessageBox::No) == QMessageBox::Yes) {
+            fits = batch.Plan(true);
+        }
+    }
+    if(fits == false) {
+        QString str, names;
 
-        ui->diskProgressBar->setRange(0,(fileinfo.size() / 65500) * 65500);
-        ui->diskProgressBar->setValue(0);
-        item->setText(0,"Writing...");
-        if(write_flash((char*)filename.toStdString().c_str(), -1, this, write_callback) == false) {
-            item->setText(0,"Failed");
+        for(i=0;i<batch.GetItems();i++) {
+            if(batch.GetItem(i)->state == PLAN_NOROOM)
+                names += "\n" + rows[i]->text(2);
         }
-        else {
-            item->setText(0,"Success");
+        str.sprintf("There is no room for these disk images:\n%s\n\nThe batch needs %d slots, %d are empty (at most %d next to each other).\nNothing was written.",
+            names.toLocal8Bit().constData(), batch.GetNeededSlots(), batch.GetFreeSlots(), batch.GetLargestRun());
+        QMessageBox::information(NULL,"Error",str);
+    }
+    else {
+        totalsize = batch.GetNeededSlots() * 65500;
+        ui->progressBar->setRange(0,totalsize);
+        ui->progressBar->setValue(0);
+        ui->diskProgressBar->setValue(0);
+        if(batch.Execute(write_callback, this, journalPath().toLocal8Bit().constData()) == false) {
+            QMessageBox::information(NULL,"Error","Writing stopped.  The rest of the batch is written the next time this program is started.");
         }
-        ui->diskProgressBar->setValue((fileinfo.size() / 65500) * 65500);
-        progressBarBase += (fileinfo.size() / 65500) * 65500;
-        ui->progressBar->setValue(progressBarBase);
+        ui->progressBar->setValue(totalsize);
     }
-
-    ui->progressBar->setValue(totalsize);
+    for(i=0;i<batch.GetItems();i++) {
+        rows[i]->setText(0,stateNames[batch.GetItem(i)->state]);
+    }
+    plan = 0;
     qApp->processEvents();
 }
 
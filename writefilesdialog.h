@@ -2,7 +2,10 @@
 #define WRITEFILESDIALOG_H
 
 #include <QDialog>
+#include <QTreeWidgetItem>
 #include <stdint.h>
+#include <vector>
+#include "fdsemu-lib/FlashPlan.h"
 
 namespace Ui {
 class WriteFilesDialog;
@@ -21,10 +24,13 @@ public:
 protected:
     int progressBarBase;
     int diskProgressBarBase;
+    CFlashPlan *plan;                       //batch being written
+    std::vector<QTreeWidgetItem*> rows;     //tree row of each plan item
+    int current;                            //plan item being written, -1 before the first
 
 private:
     Ui::WriteFilesDialog *ui;
-    static void write_callback(void *data,uint32_t bytes);
+    static void write_callback(void *data,int item,int side,uint32_t bytes);
 };
 
 #endif // WRITEFILESDIALOG_H